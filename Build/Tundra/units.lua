@@ -319,6 +319,7 @@ local CoalPyModuleIncludes = {
             Config = "win64-*-*"
         }
     },
+    files = { ZlibDir },
     texture = { LibJpgDir, LibPngDir, ZlibDir,
         {
             OpenEXRDir.."include/OpenEXR",
@@ -333,6 +334,7 @@ local CoalPyModuleIncludes = {
 
 local CoalPyModuleDeps = {
     render = { imguiLib, ImGuiFileDialog, implotLib, spirvreflect, tinyobjloader, cjson },
+    files = { zlibLib },
     texture = { zlibLib, libpngLib, libjpegLib }
 }
 
@@ -348,6 +350,8 @@ _G.BuildPyLibs(
 
 _G.DeployPyPackage("coalpy", "gpu", PythonModuleVersions, Binaries, ScriptsDir)
 _G.BuildProgram("coalpy_tests", "tests", { "CPY_ASSERT_ENABLED=1" }, SourceDir, LibIncludes, CoalPyModules, Libraries, LibPaths)
+_G.BuildProgram("coalpy_benchmarks", "benchmarks", {}, SourceDir, LibIncludes, { "core", "tasks" }, Libraries, LibPaths)
+_G.BuildProgram("coalpy_pack", "packtool", {}, SourceDir, LibIncludes, { "core", "tasks", "files", "zlib" }, Libraries, LibPaths)
 
 -- Deploy PIP package
 _G.DeployPyPackage("coalpy_pip/src/coalpy", "gpu", PythonModuleVersions, Binaries, ScriptsDir)
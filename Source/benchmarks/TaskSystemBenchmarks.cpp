@@ -0,0 +1,186 @@
+#include "benchmarks.h"
+#include <coalpy.tasks/ITaskSystem.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace coalpy
+{
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedNs(Clock::time_point start)
+{
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+//a few hundred nanoseconds of work the optimizer cannot remove.
+void doWork(int amount)
+{
+    volatile unsigned v = 0;
+    for (int i = 0; i < amount; ++i)
+        v = v * 31u + (unsigned)i;
+}
+
+//createTask + execute + wait + clean of an empty task, issued from outside the workers.
+void benchSpawnWait(BenchmarkContext& ctx)
+{
+    ITaskSystem& ts = *ctx.ts;
+    const int iterations = ctx.quick ? 2000 : 50000;
+    auto runRound = [&ts](int count)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            Task t = ts.createTask(TaskDesc("spawnWait", [](TaskContext& ctx) {}));
+            ts.execute(t);
+            ts.wait(t);
+            ts.cleanTaskTree(t);
+        }
+    };
+
+    runRound(iterations / 10);
+    Clock::time_point start = Clock::now();
+    runRound(iterations);
+    ctx.report("spawnWait", iterations, elapsedNs(start));
+}
+
+//one root waiting on many small independent tasks.
+void benchFanOutIn(BenchmarkContext& ctx)
+{
+    ITaskSystem& ts = *ctx.ts;
+    const int fanOut = 1024;
+    const int rounds = ctx.quick ? 4 : 64;
+    std::vector<Task> children(fanOut);
+    double totalNs = 0.0;
+    for (int round = 0; round <= rounds; ++round)
+    {
+        Clock::time_point start = Clock::now();
+        for (Task& child : children)
+            child = ts.createTask(TaskDesc("fanOut", [](TaskContext& ctx) { doWork(256); }));
+        Task root = ts.createTask(TaskDesc("fanIn", [](TaskContext& ctx) {}));
+        ts.depends(root, children.data(), fanOut);
+        ts.execute(root);
+        ts.wait(root);
+        ts.cleanTaskTree(root);
+
+        //first round warms up the pools.
+        if (round > 0)
+            totalNs += elapsedNs(start);
+    }
+    ctx.report("fanOutIn", rounds * fanOut, totalNs);
+}
+
+//every task depends on the previous one, so the whole chain runs serialized through the graph.
+void benchChain(BenchmarkContext& ctx)
+{
+    ITaskSystem& ts = *ctx.ts;
+    const int length = ctx.quick ? 1000 : 20000;
+    Clock::time_point start = Clock::now();
+    Task prev = ts.createTask(TaskDesc("chain", [](TaskContext& ctx) {}));
+    for (int i = 1; i < length; ++i)
+    {
+        Task next = ts.createTask(TaskDesc("chain", [](TaskContext& ctx) {}));
+        ts.depends(next, prev);
+        prev = next;
+    }
+    ts.execute(prev);
+    ts.wait(prev);
+    ts.cleanTaskTree(prev);
+    ctx.report("chain", length, elapsedNs(start));
+}
+
+void nestedYield(ITaskSystem& ts, int depth)
+{
+    TaskUtil::yieldUntil([]() { doWork(64); });
+    if (depth <= 1)
+        return;
+
+    Task child = ts.createTask(TaskDesc("nestedYield", [depth](TaskContext& ctx) { nestedYield(*ctx.ts, depth - 1); }));
+    ts.execute(child);
+    ts.wait(child);
+}
+
+//tasks yielding, then waiting on a child that yields too, depth levels deep.
+void benchYieldNesting(BenchmarkContext& ctx)
+{
+    ITaskSystem& ts = *ctx.ts;
+    const int depth = 8;
+    const int taskCount = ctx.quick ? 8 : 64;
+    Clock::time_point start = Clock::now();
+    std::vector<Task> tasks;
+    for (int i = 0; i < taskCount; ++i)
+        tasks.push_back(ts.createTask(TaskDesc("nestedYield", [depth](TaskContext& ctx) { nestedYield(*ctx.ts, depth); })));
+
+    Task root = ts.createTask(TaskDesc("yieldRoot", [](TaskContext& ctx) {}));
+    ts.depends(root, tasks.data(), taskCount);
+    ts.execute(root);
+    ts.wait(root);
+    ts.cleanTaskTree(root);
+    ts.cleanFinishedTasks();
+    ctx.report("yieldNesting", taskCount * depth, elapsedNs(start));
+}
+
+//external threads hammering the task system at once, each one spawning and waiting on its own tasks.
+void benchExternalContention(BenchmarkContext& ctx)
+{
+    ITaskSystem& ts = *ctx.ts;
+    const int externalThreads = 4;
+    const int iterations = ctx.quick ? 500 : 10000;
+    std::atomic<int> ready = 0;
+    std::atomic<bool> go = false;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < externalThreads; ++t)
+    {
+        threads.emplace_back([&ts, &ready, &go, iterations]()
+        {
+            ++ready;
+            while (!go.load())
+                std::this_thread::yield();
+
+            for (int i = 0; i < iterations; ++i)
+            {
+                Task task = ts.createTask(TaskDesc("external", [](TaskContext& ctx) { doWork(64); }));
+                ts.execute(task);
+                ts.wait(task);
+                ts.cleanTaskTree(task);
+            }
+        });
+    }
+
+    while (ready.load() != externalThreads)
+        std::this_thread::yield();
+
+    Clock::time_point start = Clock::now();
+    go = true;
+    for (auto& t : threads)
+        t.join();
+    ctx.report("externalContention", externalThreads * iterations, elapsedNs(start));
+}
+
+}
+
+static const BenchmarkCase* createCases(int& caseCounts)
+{
+    static BenchmarkCase sCases[] = {
+        { "spawnWait", benchSpawnWait },
+        { "fanOutIn", benchFanOutIn },
+        { "chain", benchChain },
+        { "yieldNesting", benchYieldNesting },
+        { "externalContention", benchExternalContention }
+    };
+
+    caseCounts = (int)(sizeof(sCases) / sizeof(BenchmarkCase));
+    return sCases;
+}
+
+void taskSystemBenchmarks(BenchmarkSuiteDesc& suite)
+{
+    suite.name = "tasksystem";
+    suite.cases = createCases(suite.casesCount);
+}
+
+}
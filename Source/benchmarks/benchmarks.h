@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace coalpy
+{
+
+class ITaskSystem;
+
+struct BenchmarkResult
+{
+    std::string benchmark;
+    int threads = 0;
+    bool fibers = false;
+    int iterations = 0;
+    double nsPerOp = 0.0;
+    double opsPerSecond = 0.0;
+};
+
+class BenchmarkContext
+{
+public:
+    ITaskSystem* ts = nullptr;
+    int threads = 0;
+    bool fibers = false;
+
+    //quick mode shrinks every workload, for smoke runs.
+    bool quick = false;
+
+    //records one measurement of the running benchmark: iterations operations took totalNs.
+    void report(const char* benchmark, int iterations, double totalNs);
+
+    std::vector<BenchmarkResult> results;
+};
+
+typedef void(*BenchmarkFn)(BenchmarkContext& ctx);
+
+struct BenchmarkCase
+{
+    const char* name;
+    BenchmarkFn fn;
+};
+
+struct BenchmarkSuiteDesc
+{
+    const char* name = {};
+    const BenchmarkCase* cases = {};
+    int casesCount = 0;
+};
+
+}
@@ -0,0 +1,180 @@
+#include <iostream>
+#include <coalpy.core/ClParser.h>
+#include <coalpy.core/ClTokenizer.h>
+#include <coalpy.tasks/ITaskSystem.h>
+#include <string>
+#include <algorithm>
+#include <set>
+#include <thread>
+#include <stdio.h>
+#include "benchmarks.h"
+
+using namespace coalpy;
+
+typedef void (*CreateBenchmarkSuiteFn)(BenchmarkSuiteDesc&);
+
+namespace coalpy
+{
+
+extern void taskSystemBenchmarks(BenchmarkSuiteDesc& suite);
+
+void BenchmarkContext::report(const char* benchmark, int iterations, double totalNs)
+{
+    BenchmarkResult result;
+    result.benchmark = benchmark;
+    result.threads = threads;
+    result.fibers = fibers;
+    result.iterations = iterations;
+    result.nsPerOp = iterations > 0 ? totalNs / (double)iterations : 0.0;
+    result.opsPerSecond = totalNs > 0.0 ? (double)iterations * 1.0e9 / totalNs : 0.0;
+    results.push_back(result);
+    fprintf(stderr, "  %-20s threads:%-3d %s %12.1f ns/op %14.0f ops/s\n", benchmark, threads, fibers ? "fibers " : "threads", result.nsPerOp, result.opsPerSecond);
+}
+
+}
+
+CreateBenchmarkSuiteFn g_suites[] = {
+    taskSystemBenchmarks
+};
+
+struct ArgParameters
+{
+    bool help = false;
+    bool printBenchmarks = false;
+    bool quick = false;
+    int maxThreads = 0;
+    const char* modes = "threads,fibers";
+    const char* filter = "";
+    const char* output = "";
+};
+
+bool prepareCli(ClParser& p, ArgParameters& params)
+{
+    ClParser::GroupId gid= p.createGroup("General", "General Params:");
+    p.bind(gid, &params);
+    CliSwitch(gid, "help", "h", "help", Bool, ArgParameters, help);
+    CliSwitch(gid, "print available benchmarks", "p", "print", Bool, ArgParameters, printBenchmarks);
+    CliSwitch(gid, "quick mode, runs every benchmark with a tiny workload (smoke test)", "q", "quick", Bool, ArgParameters, quick);
+    CliSwitch(gid, "Largest worker count measured, the sweep doubles from 1 up to it. Defaults to the hardware threads", "n", "maxthreads", Int, ArgParameters, maxThreads);
+    CliSwitch(gid, "Comma separated execution modes (threads, fibers)", "m", "modes", String, ArgParameters, modes);
+    CliSwitch(gid, "Comma separated benchmark filters", "b", "benchmarks", String, ArgParameters, filter);
+    CliSwitch(gid, "Path of the json report. Printed to stdout if not set", "o", "output", String, ArgParameters, output);
+    return true;
+}
+
+static void writeReport(FILE* file, const std::vector<BenchmarkResult>& results)
+{
+    fprintf(file, "{\n  \"hardwareThreads\": %u,\n  \"results\": [", std::thread::hardware_concurrency());
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const BenchmarkResult& r = results[i];
+        fprintf(file, "%s\n    { \"benchmark\": \"%s\", \"threads\": %d, \"fibers\": %s, \"iterations\": %d, \"nsPerOp\": %.3f, \"opsPerSecond\": %.3f }",
+            i == 0 ? "" : ",", r.benchmark.c_str(), r.threads, r.fibers ? "true" : "false", r.iterations, r.nsPerOp, r.opsPerSecond);
+    }
+    fprintf(file, "\n  ]\n}\n");
+}
+
+int main(int argc, char* argv[])
+{
+    ArgParameters params;
+    ClParser p;
+    if (!prepareCli(p, params))
+    {
+        std::cerr << "Error setting up cli parser\n";
+        return -1;
+    }
+
+    if (!p.parse(argc, argv))
+        return -1;
+
+    if (params.help)
+    {
+        p.prettyPrintHelp();
+        return 0;
+    }
+
+    int suiteCounts = (int)(sizeof(g_suites)/sizeof(g_suites[0]));
+    if (params.printBenchmarks)
+    {
+        for (int i = 0; i < suiteCounts; ++i)
+        {
+            BenchmarkSuiteDesc suite;
+            g_suites[i](suite);
+            printf("%s:\n", suite.name);
+            for (int j = 0; j < suite.casesCount; ++j)
+                printf("   %s\n", suite.cases[j].name);
+            printf("\n");
+        }
+        return 0;
+    }
+
+    std::set<std::string> filters;
+    for (auto s : ClTokenizer::splitString(params.filter, ','))
+        filters.insert(s);
+
+    std::vector<bool> modes;
+    for (auto s : ClTokenizer::splitString(params.modes, ','))
+    {
+        if (s != "threads" && s != "fibers")
+        {
+            std::cerr << "Valid modes must be 'threads', 'fibers' comma separated" << std::endl;
+            return -1;
+        }
+        modes.push_back(s == "fibers");
+    }
+
+    int maxThreads = params.maxThreads > 0 ? params.maxThreads : (int)std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<int> threadCounts;
+    for (int t = 1; t < maxThreads; t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(maxThreads);
+
+    BenchmarkContext ctx;
+    ctx.quick = params.quick;
+    for (int i = 0; i < suiteCounts; ++i)
+    {
+        BenchmarkSuiteDesc suite;
+        g_suites[i](suite);
+        fprintf(stderr, "[%s]\n", suite.name);
+        for (bool fibers : modes)
+        {
+            for (int threads : threadCounts)
+            {
+                //io tasks are not measured, keep the lane empty so the thread count is exact.
+                TaskSystemDesc desc;
+                desc.threadPoolSize = threads;
+                desc.ioThreadPoolSize = 0;
+                desc.enableFibers = fibers;
+                ctx.ts = ITaskSystem::create(desc);
+                ctx.threads = threads;
+                ctx.fibers = fibers;
+                ctx.ts->start();
+                for (int c = 0; c < suite.casesCount; ++c)
+                {
+                    if (filters.empty() || filters.count(suite.cases[c].name) != 0)
+                        suite.cases[c].fn(ctx);
+                }
+                ctx.ts->signalStop();
+                ctx.ts->join();
+                delete ctx.ts;
+                ctx.ts = nullptr;
+            }
+        }
+    }
+
+    if (params.output[0] == '\0')
+    {
+        writeReport(stdout, ctx.results);
+        return 0;
+    }
+
+    FILE* file = fopen(params.output, "w");
+    if (!file)
+    {
+        std::cerr << "Could not open benchmark report " << params.output << std::endl;
+        return -1;
+    }
+    writeReport(file, ctx.results);
+    fclose(file);
+    return 0;
+}
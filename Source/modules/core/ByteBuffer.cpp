@@ -25,14 +25,19 @@ ByteBuffer::ByteBuffer(size_t size)
 }
 
 ByteBuffer::ByteBuffer(ByteBuffer&& other)
+: m_data(nullptr), m_size(0), m_capacity(0)
 {
     *this = std::move(other);
 }
 
 ByteBuffer& ByteBuffer::operator=(ByteBuffer&& other)
 {
+    if (this == &other)
+        return *this;
+
+    free();
     m_data = other.m_data;
-    m_size = other.m_capacity;
+    m_size = other.m_size;
     m_capacity = other.m_capacity;
     other.forget();
     return *this;
@@ -45,8 +50,9 @@ ByteBuffer::~ByteBuffer()
 
 void ByteBuffer::append(const u8* data, size_t size)
 {
-    size_t totalNewSize = std::max(m_capacity, m_size + size);
-    reserve(totalNewSize);
+    //grows geometrically: files read in small chunks would otherwise copy everything they got so far on every chunk.
+    if (m_size + size > m_capacity)
+        reserve(std::max(m_size + size, m_capacity + m_capacity / 2));
     if (data)
         memcpy(m_data + m_size, data, size);
     m_size += size;
@@ -0,0 +1,184 @@
+#pragma once
+#include <coalpy.core/Assert.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+
+namespace coalpy
+{
+
+//Handle container whose handles pack a slot index with the generation of the slot. Freeing an element
+//bumps its generation, so stale handles stop resolving instead of aliasing whatever reuses the slot.
+//Slots are stored as arrays of fixed chunks that never move: contains and operator[] of a live handle
+//are lock free, and can run while another thread allocates or frees. allocate, free, forEach and clear
+//must still be serialized by the owner.
+//Freed slots are reused in fifo order, and only once MinFreeSlots of them are waiting, so a handle
+//can only alias after its slot cycled through every generation (MaxGenerations * MinFreeSlots frees).
+template<typename HandleType, typename DataType>
+class GenerationalHandleContainer
+{
+public:
+    using BaseHandleType = typename HandleType::BaseType;
+    using OnElementFn = std::function<void(HandleType handle, DataType& data)>;
+
+    enum : unsigned
+    {
+        IndexBits = 20,
+        IndexMask = (1u << IndexBits) - 1,
+        GenerationBits = sizeof(BaseHandleType) * 8 - IndexBits,
+        MaxGenerations = 1u << GenerationBits,
+        //the last index is never handed out, so no handle packs into the invalid id.
+        MaxElements = IndexMask,
+        ChunkBits = 10,
+        ChunkSize = 1u << ChunkBits,
+        MaxChunks = (MaxElements + ChunkSize - 1) / ChunkSize,
+        MinFreeSlots = 1024
+    };
+
+    static_assert(sizeof(BaseHandleType) * 8 > IndexBits, "Handle type too small to hold a generation.");
+
+    GenerationalHandleContainer()
+    {
+        for (auto& chunk : m_chunks)
+            chunk.store(nullptr, std::memory_order_relaxed);
+    }
+
+    ~GenerationalHandleContainer()
+    {
+        clear();
+    }
+
+    DataType& allocate(HandleType& outHandle)
+    {
+        unsigned index = 0;
+        if (m_freeSlots.size() > MinFreeSlots || (m_slotCount == MaxElements && !m_freeSlots.empty()))
+        {
+            index = m_freeSlots.front();
+            m_freeSlots.pop_front();
+        }
+        else
+        {
+            CPY_ASSERT_MSG(m_slotCount < MaxElements, "Generational handle container exceeded capacity.");
+            if (m_slotCount == MaxElements)
+            {
+                //callers write into what they get back: hand out an element no handle refers to.
+                outHandle = HandleType();
+                m_overflow = DataType();
+                return m_overflow;
+            }
+
+            index = m_slotCount++;
+            if ((index & (ChunkSize - 1)) == 0)
+                m_chunks[index >> ChunkBits].store(new Chunk, std::memory_order_release);
+        }
+
+        Chunk& c = chunk(index);
+        unsigned slot = index & (ChunkSize - 1);
+        outHandle.handleId = (BaseHandleType)((c.generations[slot] << IndexBits) | index);
+        c.liveHandles[slot].store(outHandle.handleId, std::memory_order_release);
+        m_numElements.fetch_add(1, std::memory_order_relaxed);
+        return c.data[slot];
+    }
+
+    //With resetObject false the data stays in the slot, and is handed back by the allocate that reuses it.
+    void free(HandleType handle, bool resetObject = true)
+    {
+        if (!contains(handle))
+            return;
+
+        unsigned index = handle.handleId & IndexMask;
+        Chunk& c = chunk(index);
+        unsigned slot = index & (ChunkSize - 1);
+        c.liveHandles[slot].store(HandleType::InvalidId, std::memory_order_release);
+        c.generations[slot] = (c.generations[slot] + 1) & (MaxGenerations - 1);
+        if (resetObject)
+            c.data[slot] = DataType();
+        m_freeSlots.push_back(index);
+        m_numElements.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void forEach(OnElementFn elementfn)
+    {
+        for (unsigned index = 0; index < m_slotCount; ++index)
+        {
+            Chunk& c = chunk(index);
+            unsigned slot = index & (ChunkSize - 1);
+            BaseHandleType live = c.liveHandles[slot].load(std::memory_order_relaxed);
+            if (live == HandleType::InvalidId)
+                continue;
+
+            HandleType h;
+            h.handleId = live;
+            elementfn(h, c.data[slot]);
+        }
+    }
+
+    bool contains(HandleType h) const
+    {
+        if (!h.valid())
+            return false;
+
+        unsigned index = h.handleId & IndexMask;
+        if (index >= MaxElements)
+            return false;
+
+        const Chunk* c = m_chunks[index >> ChunkBits].load(std::memory_order_acquire);
+        return c != nullptr && c->liveHandles[index & (ChunkSize - 1)].load(std::memory_order_acquire) == h.handleId;
+    }
+
+    DataType& operator[](HandleType h)
+    {
+        unsigned index = h.handleId & IndexMask;
+        return m_chunks[index >> ChunkBits].load(std::memory_order_acquire)->data[index & (ChunkSize - 1)];
+    }
+
+    const DataType& operator[](HandleType h) const
+    {
+        unsigned index = h.handleId & IndexMask;
+        return m_chunks[index >> ChunkBits].load(std::memory_order_acquire)->data[index & (ChunkSize - 1)];
+    }
+
+    int elementsCount() const { return m_numElements.load(std::memory_order_relaxed); }
+
+    void clear()
+    {
+        for (auto& c : m_chunks)
+            delete c.exchange(nullptr, std::memory_order_relaxed);
+        m_slotCount = 0;
+        m_freeSlots.clear();
+        m_numElements.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    struct Chunk
+    {
+        Chunk()
+        {
+            for (unsigned i = 0; i < ChunkSize; ++i)
+            {
+                liveHandles[i].store(HandleType::InvalidId, std::memory_order_relaxed);
+                generations[i] = 0;
+            }
+        }
+
+        //handle of the element living in the slot, or the invalid id while free.
+        std::atomic<BaseHandleType> liveHandles[ChunkSize];
+        BaseHandleType generations[ChunkSize];
+        DataType data[ChunkSize] = {};
+    };
+
+    Chunk& chunk(unsigned index)
+    {
+        return *m_chunks[index >> ChunkBits].load(std::memory_order_relaxed);
+    }
+
+    std::atomic<Chunk*> m_chunks[MaxChunks];
+    unsigned m_slotCount = 0;
+    std::deque<unsigned> m_freeSlots;
+    std::atomic<int> m_numElements = 0;
+
+    //what allocate returns once full, with an invalid handle.
+    DataType m_overflow = {};
+};
+
+}
@@ -25,8 +25,11 @@ public:
         {
             if (fixedContainerSize != -1 && m_data.size() == fixedContainerSize)
             {
+                //callers write into what they get back: hand out an element no handle refers to.
                 CPY_ASSERT_MSG(false, "Fixed sized container exceeded capacity.");
-                return m_data.back().data;
+                outHandle = HandleType();
+                m_overflow = DataType();
+                return m_overflow;
             }
 
             outHandle.handleId = (BaseHandleType)m_data.size();
@@ -83,7 +86,7 @@ public:
         return m_data[h.handleId].data;
     }
 
-    const int elementsCount() const { return m_numElements; }
+    int elementsCount() const { return m_numElements; }
 
     void clear()
     {
@@ -103,6 +106,9 @@ private:
     int m_numElements = 0;
     std::vector<HandleType> m_freeHandles;
     std::vector<DataContainer> m_data;
+
+    //what allocate returns once full, with an invalid handle.
+    DataType m_overflow = {};
 };
 
 }
@@ -0,0 +1,100 @@
+#include "FileCache.h"
+#include <utility>
+
+namespace coalpy
+{
+
+FileCache::FileCache(size_t budget)
+: m_budget(budget)
+{
+}
+
+SharedFileBuffer FileCache::find(const std::string& path, const FileStamp& stamp)
+{
+    std::unique_lock lock(m_mutex);
+    auto it = m_entries.find(path);
+    if (it == m_entries.end())
+    {
+        ++m_misses;
+        return nullptr;
+    }
+
+    if (it->second->stamp != stamp)
+    {
+        eraseEntry(it->second);
+        ++m_misses;
+        return nullptr;
+    }
+
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    ++m_hits;
+    return it->second->buffer;
+}
+
+bool FileCache::contains(const std::string& path, const FileStamp& stamp) const
+{
+    std::unique_lock lock(m_mutex);
+    auto it = m_entries.find(path);
+    return it != m_entries.end() && it->second->stamp == stamp;
+}
+
+SharedFileBuffer FileCache::insert(const std::string& path, const FileStamp& stamp, ByteBuffer&& contents)
+{
+    SharedFileBuffer buffer = std::make_shared<const ByteBuffer>(std::move(contents));
+    size_t bytes = buffer->size();
+    if (bytes > m_budget)
+        return buffer;
+
+    std::unique_lock lock(m_mutex);
+
+    //another reader may have raced us for the same file, the latest read wins.
+    auto existing = m_entries.find(path);
+    if (existing != m_entries.end())
+        eraseEntry(existing->second);
+
+    while (m_bytes + bytes > m_budget && !m_lru.empty())
+    {
+        eraseEntry(std::prev(m_lru.end()));
+        ++m_evictions;
+    }
+
+    m_lru.push_front(Entry { path, stamp, buffer });
+    m_entries[path] = m_lru.begin();
+    m_bytes += bytes;
+    return buffer;
+}
+
+void FileCache::invalidate(const std::string& path)
+{
+    std::unique_lock lock(m_mutex);
+    auto it = m_entries.find(path);
+    if (it != m_entries.end())
+        eraseEntry(it->second);
+}
+
+void FileCache::clear()
+{
+    std::unique_lock lock(m_mutex);
+    m_lru.clear();
+    m_entries.clear();
+    m_bytes = 0;
+}
+
+void FileCache::getStats(FileCacheStats& stats) const
+{
+    std::unique_lock lock(m_mutex);
+    stats.hits = m_hits;
+    stats.misses = m_misses;
+    stats.evictions = m_evictions;
+    stats.bytes = m_bytes;
+    stats.files = (int)m_entries.size();
+}
+
+void FileCache::eraseEntry(EntryList::iterator it)
+{
+    m_bytes -= it->buffer->size();
+    m_entries.erase(it->path);
+    m_lru.erase(it);
+}
+
+}
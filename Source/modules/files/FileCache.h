@@ -0,0 +1,68 @@
+#pragma once
+
+#include <coalpy.files/FileDefs.h>
+#include <coalpy.core/ByteBuffer.h>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace coalpy
+{
+
+//what a cached file looked like on disk when it got read. Any difference means the contents are stale.
+struct FileStamp
+{
+    uint64_t size = 0;
+    uint64_t modifiedTime = 0;
+
+    bool operator==(const FileStamp& other) const { return size == other.size && modifiedTime == other.modifiedTime; }
+    bool operator!=(const FileStamp& other) const { return !(*this == other); }
+};
+
+//Contents of recently read files, keyed by resolved path. Least recently used files are evicted past the
+//byte budget. Buffers are immutable and shared: one evicted or invalidated stays alive while a reader holds it.
+class FileCache
+{
+public:
+    explicit FileCache(size_t budget);
+
+    size_t budget() const { return m_budget; }
+
+    //null if the file is not cached, or was cached with a different stamp.
+    SharedFileBuffer find(const std::string& path, const FileStamp& stamp);
+
+    //like find, but neither counts as a hit or miss nor refreshes the entry.
+    bool contains(const std::string& path, const FileStamp& stamp) const;
+
+    //files larger than the whole budget are handed back without being kept.
+    SharedFileBuffer insert(const std::string& path, const FileStamp& stamp, ByteBuffer&& contents);
+
+    void invalidate(const std::string& path);
+    void clear();
+    void getStats(FileCacheStats& stats) const;
+
+private:
+    struct Entry
+    {
+        std::string path;
+        FileStamp stamp;
+        SharedFileBuffer buffer;
+    };
+
+    using EntryList = std::list<Entry>;
+
+    void eraseEntry(EntryList::iterator it);
+
+    size_t m_budget;
+    size_t m_bytes = 0;
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+    uint64_t m_evictions = 0;
+
+    mutable std::mutex m_mutex;
+    EntryList m_lru; //most recently used first
+    std::unordered_map<std::string, EntryList::iterator> m_entries;
+};
+
+}
@@ -3,20 +3,82 @@
 #include <coalpy.core/Assert.h>
 #include <coalpy.files/Utils.h>
 #include <sstream>
+#include <memory>
+#include <algorithm>
+#include <random>
 
 namespace coalpy
 {
 
+namespace
+{
+
+//bytes a ring read keeps in flight, and in memory, per request. A couple of ring chunks.
+enum { RingReadSize = 2 * 1024 * 1024 };
+
+}
+
 FileSystem::FileSystem(const FileSystemDesc& desc)
 : m_desc(desc)
 , m_ts(*desc.taskSystem)
 {
-    
+    if (desc.enableIoRing)
+        m_ring = IoRing::create();
+
+    //keeps temp file names of other instances, and other processes, apart from ours.
+    m_tempFileSalt = std::random_device()();
+
+    if (desc.cacheBudget > 0)
+        m_cache = new FileCache(desc.cacheBudget);
+
+    //without a watcher nothing tells us about files appearing under a root, so probing results cannot be kept.
+    CPY_ASSERT_MSG(!desc.cacheResolvedPaths || desc.fw != nullptr, "Caching resolved paths requires a file watcher.");
+    m_cacheResolvedPaths = desc.cacheResolvedPaths && desc.fw != nullptr;
+    if (desc.fw)
+        desc.fw->addListener(this);
 }
 
 FileSystem::~FileSystem()
 {
     CPY_ASSERT_FMT(m_requests.elementsCount() == 0, "%d File requests still alive. Please close the handles.", m_requests.elementsCount());
+    if (m_desc.fw)
+        m_desc.fw->removeListener(this);
+
+    {
+        std::unique_lock lock(m_prefetchMutex);
+        m_prefetchDone.wait(lock, [this]() { return m_pendingPrefetches == 0; });
+    }
+
+    delete m_cache;
+    delete m_ring;
+}
+
+void FileSystem::setupRead(Request& requestData, const FileReadRequest& request)
+{
+    requestData.type = InternalFileSystem::RequestType::Read;
+    requestData.candidates.push_back(request.path);
+    requestData.resolveKey = request.path;
+    for (auto& root : request.additionalRoots)
+    {
+        requestData.resolveKey += '\n';
+        requestData.resolveKey += root;
+        if (root[root.size() - 1] == '/' || root[root.size() - 1] == '\\')
+            requestData.candidates.push_back(root + request.path);
+        else
+            requestData.candidates.push_back(root + FILE_SEP + request.path);
+    }
+
+    for (const std::string& candidate : requestData.candidates)
+        requestData.filenames.push(candidate);
+
+    requestData.readCallback = request.doneCallback;
+    requestData.memoryMap = (request.flags & (int)FileRequestFlags::MemoryMap) != 0;
+    requestData.access = request.access;
+    requestData.readOffset = request.offset;
+    requestData.readLength = request.length;
+    requestData.opaqueHandle = {};
+    requestData.error = IoError::None;
+    requestData.fileStatus = FileStatus::Idle;
 }
 
 AsyncFileHandle FileSystem::read(const FileReadRequest& request)
@@ -29,124 +91,185 @@ AsyncFileHandle FileSystem::read(const FileReadRequest& request)
         std::unique_lock lock(m_requestsMutex);
         Request*& requestData = m_requests.allocate(asyncHandle);
         requestData = new Request();
-        requestData->type = InternalFileSystem::RequestType::Read;
-        requestData->filenames.push(request.path);
+        setupRead(*requestData, request);
+        requestData->task = m_ts.createTask(TaskDesc("FileSystem::read", TaskPriority::Critical, TaskLane::Io, [this](TaskContext& ctx)
         {
-            for (auto& root : request.additionalRoots)
-            {
-                if (root[root.size() - 1] == '/' || root[root.size() - 1] == '\\')
-                    requestData->filenames.push(root + request.path);
-                else
-                    requestData->filenames.push(root + FILE_SEP + request.path);
-            }
-        }
+            readFile((Request*)ctx.data);
+        }), requestData);
+        task = requestData->task;
+    }
 
-        requestData->readCallback = request.doneCallback;
-        requestData->opaqueHandle = {};
-        requestData->error = IoError::None;
-        requestData->fileStatus = FileStatus::Idle;
-        requestData->task = m_ts.createTask(TaskDesc("FileSystem::read", [this](TaskContext& ctx)
+    if ((request.flags & (int)FileRequestFlags::AutoStart) != 0)
+        m_ts.execute(task);
+    return asyncHandle;
+}
+
+AsyncFileHandle FileSystem::readBatch(const FileReadRequest* requests, int count)
+{
+    AsyncFileHandle asyncHandle;
+    Task task;
+    bool autoStart = false;
+
+    //the files are set up outside the lock, the group only takes it once to get its handle.
+    auto* batchData = new Request();
+    batchData->type = InternalFileSystem::RequestType::Read;
+    batchData->error = IoError::None;
+    batchData->fileStatus = FileStatus::Idle;
+    batchData->batch.resize(count);
+    for (int i = 0; i < count; ++i)
+    {
+        CPY_ASSERT_MSG(requests[i].doneCallback, "File read request must provide a done callback.");
+        batchData->batch[i] = new Request();
+        setupRead(*batchData->batch[i], requests[i]);
+        autoStart |= (requests[i].flags & (int)FileRequestFlags::AutoStart) != 0;
+    }
+
+    //a few lanes pull the next file until there are none left: no more reads in flight than lanes,
+    //and no task per file.
+    int laneCount = std::min(count, (int)MaxBatchConcurrency);
+    std::vector<Task> lanes(laneCount);
+    for (Task& lane : lanes)
+    {
+        lane = m_ts.createTask(TaskDesc("FileSystem::readBatchLane", TaskPriority::Critical, TaskLane::Io, [this](TaskContext& ctx)
         {
-            auto* requestData = (Request*)ctx.data;
-            {
-                requestData->fileStatus = FileStatus::Opening;
-                FileReadResponse response;
-                response.status = FileStatus::Opening;
-                requestData->readCallback(response);
-            }
+            auto* batchData = (Request*)ctx.data;
+            int fileCount = (int)batchData->batch.size();
+            for (int i = batchData->nextBatchFile.fetch_add(1); i < fileCount; i = batchData->nextBatchFile.fetch_add(1))
+                readFile(batchData->batch[i]);
+        }), batchData);
+    }
 
-            //pop all the candidate files that don't exist
-            while(!requestData->filenames.empty())
-            {
-                FileAttributes attr;
-                getFileAttributes(requestData->filenames.front().c_str(), attr);
-                if (!attr.exists || attr.isDir || attr.isDot)
-                    requestData->filenames.pop();
-                else
-                    break;
-            } 
-    
-            if (!requestData->filenames.empty())
-                requestData->opaqueHandle = InternalFileSystem::openFile(requestData->filenames.front().c_str(), InternalFileSystem::RequestType::Read);
+    batchData->task = m_ts.createTask(TaskDesc("FileSystem::readBatch", TaskPriority::Critical, TaskLane::Io, nullptr));
+    if (laneCount > 0)
+        m_ts.depends(batchData->task, lanes.data(), laneCount);
+    task = batchData->task;
 
-            if (!InternalFileSystem::valid(requestData->opaqueHandle))
-            {
-                {
-                    requestData->error = IoError::FailedOpening;
-                    requestData->fileStatus = FileStatus::Fail;
-                    FileReadResponse response;
-                    if (!requestData->filenames.empty())
-                        response.filePath = requestData->filenames.front();
-                    response.error = IoError::FailedOpening;
-                    response.status = FileStatus::Fail;
-                    requestData->readCallback(response);
-                }
-                return;
-            }
+    {
+        std::unique_lock lock(m_requestsMutex);
+        m_requests.allocate(asyncHandle) = batchData;
+    }
 
-            std::string resolvedFileName;
-            FileUtils::getAbsolutePath(requestData->filenames.front(), resolvedFileName);
+    if (autoStart)
+        m_ts.execute(task);
+    return asyncHandle;
+}
 
-            requestData->fileStatus = FileStatus::Reading;
+void FileSystem::readFile(Request* requestData)
+{
+    {
+        requestData->fileStatus = FileStatus::Opening;
+        FileReadResponse response;
+        response.status = FileStatus::Opening;
+        requestData->readCallback(response);
+    }
 
-            struct ReadState {
-                char* output = nullptr;
-                int bytesRead = 0;
-                bool isEof = false;
-                bool successRead = false;
-            } readState;
-            while (!readState.isEof)
-            {
-                TaskUtil::yieldUntil([&readState, requestData]() {
-                    readState.successRead = InternalFileSystem::readBytes(
-                        requestData->opaqueHandle, readState.output, readState.bytesRead, readState.isEof);
-                });
+    if (packRead(*requestData, PackMountOrder::BeforeDisk))
+        return;
 
-                {
-                    FileReadResponse response;
-                    response.status = FileStatus::Reading;
-                    response.buffer = readState.output;
-                    response.size = readState.bytesRead;
-                    response.filePath = resolvedFileName;
-                    requestData->readCallback(response);
-                }
+    //the cache keeps whole files, slices of a large one are read straight from disk. Mapped reads
+    //skip it too, copying the file would defeat the point of mapping it.
+    bool ranged = requestData->readOffset != 0 || requestData->readLength != 0;
+    if (m_cache != nullptr && !ranged && !requestData->memoryMap && cachedRead(*requestData))
+        return;
 
-                if (!readState.successRead)
-                {
-                    {
-                        if (InternalFileSystem::valid(requestData->opaqueHandle))
-                            InternalFileSystem::close(requestData->opaqueHandle);
-
-                        requestData->error = IoError::FailedReading;
-                        requestData->fileStatus = FileStatus::Fail;
-                        FileReadResponse response;
-                        response.error = IoError::FailedReading;
-                        response.filePath = resolvedFileName;
-                        response.status = FileStatus::Fail;
-                        requestData->readCallback(response);
-                    }
-                    return;
-                }
-            }
+    if (m_ring != nullptr && !requestData->memoryMap)
+    {
+        ringRead(*requestData);
+        return;
+    }
+
+    std::string resolvedFileName;
+    while (resolveFile(*requestData, resolvedFileName))
+    {
+        requestData->opaqueHandle = InternalFileSystem::openFile(requestData->filenames.front().c_str(), InternalFileSystem::RequestType::Read, requestData->access);
+        if (InternalFileSystem::valid(requestData->opaqueHandle) || !retryResolve(*requestData))
+            break;
+    }
+
+    if (!InternalFileSystem::valid(requestData->opaqueHandle))
+    {
+        failOpen(*requestData);
+        return;
+    }
+
+    requestData->fileStatus = FileStatus::Reading;
+    InternalFileSystem::setReadRange(requestData->opaqueHandle, requestData->readOffset, requestData->readLength);
+
+    if (requestData->memoryMap)
+    {
+        //one view of the whole file instead of chunks: mapping does not block on the disk, pages
+        //fault in as the consumer reads them. The file stays open for the view until closeHandle.
+        FileReadResponse response;
+        if (InternalFileSystem::mapFile(requestData->opaqueHandle, response.buffer, response.size))
+        {
+            response.status = FileStatus::Reading;
+            response.offset = requestData->readOffset;
+            response.filePath = resolvedFileName;
+            response.mapped = true;
+            requestData->readCallback(response);
 
+            requestData->fileStatus = FileStatus::Success;
+            FileReadResponse doneResponse;
+            doneResponse.filePath = resolvedFileName;
+            doneResponse.status = FileStatus::Success;
+            requestData->readCallback(doneResponse);
+            return;
+        }
+    }
+
+    struct ReadState {
+        char* output = nullptr;
+        int bytesRead = 0;
+        bool isEof = false;
+        bool successRead = false;
+    } readState;
+    uint64_t offset = requestData->readOffset;
+    while (!readState.isEof)
+    {
+        TaskUtil::yieldUntil([&readState, requestData]() {
+            readState.successRead = InternalFileSystem::readBytes(
+                requestData->opaqueHandle, readState.output, readState.bytesRead, readState.isEof);
+        });
+
+        {
+            FileReadResponse response;
+            response.status = FileStatus::Reading;
+            response.buffer = readState.output;
+            response.size = (size_t)readState.bytesRead;
+            response.offset = offset;
+            response.filePath = resolvedFileName;
+            requestData->readCallback(response);
+            offset += (uint64_t)readState.bytesRead;
+        }
+
+        if (!readState.successRead)
+        {
             {
                 if (InternalFileSystem::valid(requestData->opaqueHandle))
                     InternalFileSystem::close(requestData->opaqueHandle);
 
-                requestData->fileStatus = FileStatus::Success;
+                requestData->error = IoError::FailedReading;
+                requestData->fileStatus = FileStatus::Fail;
                 FileReadResponse response;
+                response.error = IoError::FailedReading;
                 response.filePath = resolvedFileName;
-                response.status = FileStatus::Success;
+                response.status = FileStatus::Fail;
                 requestData->readCallback(response);
             }
-
-        }), requestData);
-        task = requestData->task;
+            return;
+        }
     }
 
-    if ((request.flags & (int)FileRequestFlags::AutoStart) != 0)
-        m_ts.execute(task);
-    return asyncHandle;
+    {
+        if (InternalFileSystem::valid(requestData->opaqueHandle))
+            InternalFileSystem::close(requestData->opaqueHandle);
+
+        requestData->fileStatus = FileStatus::Success;
+        FileReadResponse response;
+        response.filePath = resolvedFileName;
+        response.status = FileStatus::Success;
+        requestData->readCallback(response);
+    }
 }
 
 void FileSystem::execute(AsyncFileHandle handle)
@@ -167,9 +290,22 @@ Task FileSystem::asTask(AsyncFileHandle handle)
     return task;
 }
 
+void FileSystem::setupWrite(Request& requestData, const FileWriteRequest& request)
+{
+    requestData.type = InternalFileSystem::RequestType::Write;
+    requestData.filenames.push(request.path);
+    InternalFileSystem::fixStringPath(requestData.filenames.front());
+    requestData.writeCallback = request.doneCallback;
+    requestData.borrowBuffers = (request.flags & (int)FileRequestFlags::BorrowBuffer) != 0;
+    requestData.atomicReplace = (request.flags & (int)FileRequestFlags::AtomicReplace) != 0;
+    requestData.opaqueHandle = {};
+    requestData.error = IoError::None;
+    requestData.fileStatus = FileStatus::Idle;
+}
+
 AsyncFileHandle FileSystem::write(const FileWriteRequest& request)
 {
-    CPY_ASSERT_MSG(request.doneCallback, "File read request must provide a done callback.");
+    CPY_ASSERT_MSG(request.doneCallback, "File write request must provide a done callback.");
 
     AsyncFileHandle asyncHandle;
     Task task;
@@ -178,16 +314,26 @@ AsyncFileHandle FileSystem::write(const FileWriteRequest& request)
         std::unique_lock lock(m_requestsMutex);
         Request*& requestData = m_requests.allocate(asyncHandle);
         requestData = new Request();
-        requestData->type = InternalFileSystem::RequestType::Write;
-        requestData->filenames.push(request.path);
-        InternalFileSystem::fixStringPath(requestData->filenames.front());
-        requestData->writeCallback = request.doneCallback;
-        requestData->opaqueHandle = {};
-        requestData->error = IoError::None;
-        requestData->fileStatus = FileStatus::Idle;
-        requestData->writeBuffer.append((const u8*)request.buffer, (size_t)request.size);
-        requestData->writeSize = request.size;
-        requestData->task = m_ts.createTask(TaskDesc([this](TaskContext& ctx)
+        setupWrite(*requestData, request);
+        if (request.sharedBuffer)
+        {
+            requestData->writeShared = request.sharedBuffer;
+            requestData->writeData = (const char*)request.sharedBuffer->data();
+            requestData->writeSize = request.sharedBuffer->size();
+        }
+        else if (requestData->borrowBuffers)
+        {
+            requestData->writeData = request.buffer;
+            requestData->writeSize = request.size;
+        }
+        else
+        {
+            requestData->writeBuffer.append((const u8*)request.buffer, request.size);
+            requestData->writeData = (const char*)requestData->writeBuffer.data();
+            requestData->writeSize = request.size;
+        }
+
+        requestData->task = m_ts.createTask(TaskDesc("FileSystem::write", TaskPriority::Normal, TaskLane::Io, [this](TaskContext& ctx)
         {
             auto* requestData = (Request*)ctx.data;
             {
@@ -197,84 +343,668 @@ AsyncFileHandle FileSystem::write(const FileWriteRequest& request)
                 requestData->writeCallback(response);
             }
 
-            if (!InternalFileSystem::carvePath(requestData->filenames.front()))
+            IoError error = openWrite(*requestData);
+            if (error == IoError::None)
             {
-                requestData->error = IoError::FailedCreatingDir;
-                requestData->fileStatus = FileStatus::Fail;
-                FileWriteResponse response;
-                response.error = IoError::FailedCreatingDir;
-                response.status = FileStatus::Fail;
-                requestData->writeCallback(response);
-                {
-                    FileWriteResponse response;
-                    response.status = FileStatus::Fail;
-                    response.error = IoError::FailedCreatingDir;
-                    requestData->writeCallback(response);
-                }
-                return;
-            }
-            requestData->opaqueHandle = InternalFileSystem::openFile(requestData->filenames.front().c_str(), InternalFileSystem::RequestType::Write);
-            if (!InternalFileSystem::valid(requestData->opaqueHandle))
-            {
-                {
-                    requestData->error = IoError::FailedOpening;
-                    requestData->fileStatus = FileStatus::Fail;
-                    FileWriteResponse response;
-                    response.error = IoError::FailedOpening;
-                    response.status = FileStatus::Fail;
-                    requestData->writeCallback(response);
-                }
-                return;
+                requestData->fileStatus = FileStatus::Writing;
+                if (!writeData(*requestData, requestData->writeData, requestData->writeSize, 0))
+                    error = IoError::FailedWriting;
             }
 
+            finishWrite(*requestData, error);
+        }), requestData);
+        task = requestData->task;
+    }
+
+    if ((request.flags & (int)FileRequestFlags::AutoStart) != 0)
+        m_ts.execute(task);
+    return asyncHandle;
+}
+
+AsyncFileHandle FileSystem::beginWrite(const FileWriteRequest& request)
+{
+    CPY_ASSERT_MSG(request.doneCallback, "File write request must provide a done callback.");
+
+    AsyncFileHandle asyncHandle;
+    auto* requestData = new Request();
+    setupWrite(*requestData, request);
+
+    //opening runs ahead, the first append chains after it.
+    TaskDesc openDesc("FileSystem::beginWrite", TaskPriority::Normal, TaskLane::Io, [this](TaskContext& ctx)
+    {
+        auto* requestData = (Request*)ctx.data;
+        {
+            requestData->fileStatus = FileStatus::Opening;
+            FileWriteResponse response;
+            response.status = FileStatus::Opening;
+            requestData->writeCallback(response);
+        }
+
+        IoError error = openWrite(*requestData);
+        if (error != IoError::None)
+            requestData->error = error;
+        else
             requestData->fileStatus = FileStatus::Writing;
+    });
 
-            struct WriteState {
-                const char* buffer;
-                int bufferSize;
-                bool successWrite;
-            } writeState = { (const char*)requestData->writeBuffer.data(), requestData->writeSize, false };
+    //stream links are auto released: each goes away once it ran and the next link is gone.
+    openDesc.flags = (int)TaskFlags::AutoRelease;
+    requestData->streamTail = m_ts.createTask(openDesc, requestData);
 
-            TaskUtil::yieldUntil([&writeState, requestData]() {
-                writeState.successWrite = InternalFileSystem::writeBytes(
-                    requestData->opaqueHandle, writeState.buffer, writeState.bufferSize);
-            });
+    requestData->task = m_ts.createTask(TaskDesc("FileSystem::endWrite", TaskPriority::Normal, TaskLane::Io, [this](TaskContext& ctx)
+    {
+        auto* requestData = (Request*)ctx.data;
+        finishWrite(*requestData, requestData->error);
+    }), requestData);
+
+    {
+        std::unique_lock lock(m_requestsMutex);
+        m_requests.allocate(asyncHandle) = requestData;
+    }
+
+    m_ts.execute(requestData->streamTail);
+    return asyncHandle;
+}
+
+void FileSystem::appendWrite(AsyncFileHandle handle, const char* buffer, size_t size)
+{
+    Request* requestData = nullptr;
+    {
+        std::shared_lock lock(m_requestsMutex);
+        requestData = m_requests[handle];
+    }
+
+    auto* chunk = new WriteChunk();
+    chunk->request = requestData;
+    chunk->offset = requestData->streamOffset;
+    chunk->size = size;
+    if (requestData->borrowBuffers)
+    {
+        chunk->data = buffer;
+    }
+    else
+    {
+        chunk->copy.append((const u8*)buffer, size);
+        chunk->data = (const char*)chunk->copy.data();
+    }
+    requestData->streamOffset += (uint64_t)size;
+
+    //every chunk waits for the one before: a file handle only has one write in flight at a time.
+    TaskDesc chunkDesc("FileSystem::appendWrite", TaskPriority::Normal, TaskLane::Io, [this](TaskContext& ctx)
+    {
+        std::unique_ptr<WriteChunk> chunk((WriteChunk*)ctx.data);
+        Request& requestData = *chunk->request;
+        if (requestData.error != IoError::None)
+            return;
+
+        if (!writeData(requestData, chunk->data, chunk->size, chunk->offset))
+            requestData.error = IoError::FailedWriting;
+    });
+    chunkDesc.flags = (int)TaskFlags::AutoRelease;
+
+    Task chunkTask = m_ts.createTask(chunkDesc, chunk);
+    m_ts.depends(chunkTask, requestData->streamTail);
+    requestData->streamTail = chunkTask;
+    m_ts.execute(chunkTask);
+}
+
+void FileSystem::endWrite(AsyncFileHandle handle)
+{
+    Request* requestData = nullptr;
+    {
+        std::shared_lock lock(m_requestsMutex);
+        requestData = m_requests[handle];
+    }
+
+    m_ts.depends(requestData->task, requestData->streamTail);
+    requestData->streamTail = Task();
+    m_ts.execute(requestData->task);
+}
+
+IoError FileSystem::openWrite(Request& requestData)
+{
+    const std::string& fileName = requestData.filenames.front();
+    if (!InternalFileSystem::carvePath(fileName))
+        return IoError::FailedCreatingDir;
+
+    //a temp file is created exclusively, it never truncates one that is not ours. A taken name gets
+    //another one, anything else fails.
+    const int maxAttempts = requestData.atomicReplace ? 8 : 1;
+    for (int attempt = 0; attempt < maxAttempts; ++attempt)
+    {
+        requestData.writePath = fileName;
+        if (requestData.atomicReplace)
+        {
+            //next to the target, so the rename stays within one volume.
+            std::stringstream ss;
+            ss << fileName << ".tmp" << std::hex << m_tempFileSalt << "-" << m_tempFileCounter.fetch_add(1);
+            requestData.writePath = ss.str();
+        }
+
+        bool opened = false;
+        if (m_ring != nullptr)
+        {
+            requestData.ringFd = m_ring->open(requestData.writePath.c_str(), true, requestData.atomicReplace);
+            opened = requestData.ringFd >= 0;
+            if (!opened)
+                requestData.ringFd = -1;
+        }
+        else
+        {
+            auto requestType = requestData.atomicReplace ? InternalFileSystem::RequestType::WriteNew : InternalFileSystem::RequestType::Write;
+            requestData.opaqueHandle = InternalFileSystem::openFile(requestData.writePath.c_str(), requestType);
+            opened = InternalFileSystem::valid(requestData.opaqueHandle);
+        }
+
+        if (opened)
+        {
+            //the file may be new, and shadow or satisfy paths that resolved differently before.
+            clearResolvedPaths();
+            return IoError::None;
+        }
+
+        bool exists = false, isDir = false, isDots = false;
+        InternalFileSystem::getAttributes(requestData.writePath, exists, isDir, isDots);
+        if (!exists)
+            break;
+    }
+
+    //the name was never ours, so finishing the request must not delete what sits there.
+    requestData.writePath.clear();
+    return IoError::FailedOpening;
+}
+
+bool FileSystem::writeData(Request& requestData, const char* buffer, size_t size, uint64_t offset)
+{
+    if (m_ring != nullptr)
+        return m_ring->write(requestData.ringFd, buffer, size, offset);
+
+    //one blocking call per piece, the io worker gets handed back in between instead of held for the whole file.
+    for (size_t written = 0; written < size;)
+    {
+        int pieceSize = (int)std::min(size - written, (size_t)WritePieceSize);
+        bool success = false;
+        TaskUtil::yieldUntil([&]()
+        {
+            success = InternalFileSystem::writeBytes(requestData.opaqueHandle, buffer + written, pieceSize, offset + (uint64_t)written);
+        });
+
+        if (!success)
+            return false;
+
+        written += (size_t)pieceSize;
+    }
+
+    return true;
+}
+
+void FileSystem::finishWrite(Request& requestData, IoError error)
+{
+    if (requestData.ringFd >= 0)
+    {
+        IoRing::close(requestData.ringFd);
+        requestData.ringFd = -1;
+    }
+
+    if (InternalFileSystem::valid(requestData.opaqueHandle))
+        InternalFileSystem::close(requestData.opaqueHandle);
+
+    if (requestData.atomicReplace && !requestData.writePath.empty())
+    {
+        if (error == IoError::None && InternalFileSystem::renameFile(requestData.writePath.c_str(), requestData.filenames.front().c_str()))
+            clearResolvedPaths();
+        else
+        {
+            InternalFileSystem::deleteFile(requestData.writePath.c_str());
+            if (error == IoError::None)
+                error = IoError::FailedWriting;
+        }
+    }
+
+    //borrowed and shared buffers are not needed past this point.
+    requestData.writeShared = nullptr;
+    requestData.writeData = nullptr;
+
+    requestData.error = error;
+    requestData.fileStatus = error == IoError::None ? FileStatus::Success : FileStatus::Fail;
+    FileWriteResponse response;
+    response.error = error;
+    response.status = requestData.fileStatus;
+    requestData.writeCallback(response);
+}
+
+void FileSystem::prefetch(const std::vector<std::string>& paths)
+{
+    if (paths.empty())
+        return;
+
+    {
+        std::unique_lock lock(m_prefetchMutex);
+        ++m_pendingPrefetches;
+    }
+
+    //background priority: a prefetch never holds up a read somebody waits on.
+    TaskDesc desc("FileSystem::prefetch", TaskPriority::Background, TaskLane::Io, [this](TaskContext& ctx)
+    {
+        auto* paths = (std::vector<std::string>*)ctx.data;
+        for (const std::string& path : *paths)
+            prefetchFile(path);
+        delete paths;
+
+        std::unique_lock lock(m_prefetchMutex);
+        if (--m_pendingPrefetches == 0)
+            m_prefetchDone.notify_all();
+    });
+    desc.flags = (int)TaskFlags::AutoRelease;
+    m_ts.execute(m_ts.createTask(desc, new std::vector<std::string>(paths)));
+}
+
+void FileSystem::prefetchFile(const std::string& path)
+{
+    //same key and stamp as cachedRead, so the read that follows finds it. Files the cache would
+    //not keep are only brought into the os page cache.
+    FileStamp stamp;
+    bool cacheable = m_cache != nullptr
+        && InternalFileSystem::getFileStamp(path, stamp.size, stamp.modifiedTime)
+        && stamp.size <= (uint64_t)m_cache->budget();
+    if (!cacheable)
+    {
+        TaskUtil::yieldUntil([&path]() { InternalFileSystem::prefetchFile(path.c_str()); });
+        return;
+    }
+
+    std::string resolvedFileName;
+    FileUtils::getAbsolutePath(path, resolvedFileName);
+    if (m_cache->contains(resolvedFileName, stamp))
+        return;
+
+    ByteBuffer bytes;
+    if (readContents(path, bytes) == IoError::None)
+        m_cache->insert(resolvedFileName, stamp, std::move(bytes));
+}
 
-            if (!writeState.successWrite)
+bool FileSystem::mountPack(const PackMountRequest& request)
+{
+    Pack* pack = Pack::open(request.path.c_str());
+    if (pack == nullptr)
+        return false;
+
+    MountedPack mounted;
+    mounted.pack = std::shared_ptr<Pack>(pack);
+    mounted.order = request.order;
+    PackFormat::normalizePath(request.mountPoint, mounted.prefix);
+    if (!mounted.prefix.empty() && mounted.prefix.back() != '/')
+        mounted.prefix += '/';
+
+    std::unique_lock lock(m_packsMutex);
+    m_packs.push_back(std::move(mounted));
+    return true;
+}
+
+bool FileSystem::unmountPack(const char* packPath)
+{
+    std::unique_lock lock(m_packsMutex);
+    auto it = std::find_if(m_packs.begin(), m_packs.end(), [packPath](const MountedPack& mounted) { return mounted.pack->filePath() == packPath; });
+    if (it == m_packs.end())
+        return false;
+
+    m_packs.erase(it);
+    return true;
+}
+
+bool FileSystem::packRead(Request& requestData, PackMountOrder order)
+{
+    std::shared_ptr<Pack> pack;
+    const PackFormat::Entry* entry = nullptr;
+    std::string filePath;
+    {
+        std::shared_lock lock(m_packsMutex);
+        std::string path;
+        for (size_t c = 0; entry == nullptr && c < requestData.candidates.size(); ++c)
+        {
+            PackFormat::normalizePath(requestData.candidates[c], path);
+            for (const MountedPack& mounted : m_packs)
             {
+                if (mounted.order != order || path.compare(0, mounted.prefix.size(), mounted.prefix) != 0)
+                    continue;
+
+                entry = mounted.pack->find(mounted.prefix.empty() ? path : path.substr(mounted.prefix.size()));
+                if (entry != nullptr)
                 {
-                    if (InternalFileSystem::valid(requestData->opaqueHandle))
-                        InternalFileSystem::close(requestData->opaqueHandle);
-
-                    requestData->error = IoError::FailedWriting;
-                    requestData->fileStatus = FileStatus::Fail;
-                    FileWriteResponse response;
-                    response.error = IoError::FailedWriting;
-                    response.status = FileStatus::Fail;
-                    requestData->writeCallback(response);
+                    pack = mounted.pack;
+                    filePath = requestData.candidates[c];
+                    break;
                 }
-                return;
             }
+        }
+    }
 
-            {
-                if (InternalFileSystem::valid(requestData->opaqueHandle))
-                    InternalFileSystem::close(requestData->opaqueHandle);
+    if (entry == nullptr)
+        return false;
 
-                requestData->fileStatus = FileStatus::Success;
-                FileWriteResponse response;
-                response.status = FileStatus::Success;
-                requestData->writeCallback(response);
+    requestData.pack = pack;
+    requestData.fileStatus = FileStatus::Reading;
+    uint64_t offset = std::min(requestData.readOffset, entry->size);
+    uint64_t length = entry->size - offset;
+    if (requestData.readLength != 0)
+        length = std::min(length, requestData.readLength);
+
+    FileReadResponse response;
+    response.status = FileStatus::Reading;
+    response.size = (size_t)length;
+    response.offset = offset;
+    response.filePath = filePath;
+    if ((entry->flags & PackFormat::Compressed) == 0)
+    {
+        //stored files are read in place, no copy and no io beyond the page faults.
+        response.buffer = pack->data(*entry) + offset;
+        response.mapped = true;
+    }
+    else
+    {
+        auto contents = std::make_shared<ByteBuffer>();
+        uint64_t contentsOffset = 0;
+        if (!pack->inflate(m_ts, *entry, offset, length, *contents, contentsOffset))
+        {
+            requestData.error = IoError::FailedReading;
+            requestData.fileStatus = FileStatus::Fail;
+            FileReadResponse failResponse;
+            failResponse.error = IoError::FailedReading;
+            failResponse.filePath = filePath;
+            failResponse.status = FileStatus::Fail;
+            requestData.readCallback(failResponse);
+            return true;
+        }
+
+        response.buffer = (const char*)contents->data() + (offset - contentsOffset);
+        response.sharedBuffer = contents;
+    }
+    requestData.readCallback(response);
+
+    {
+        requestData.fileStatus = FileStatus::Success;
+        FileReadResponse doneResponse;
+        doneResponse.filePath = filePath;
+        doneResponse.status = FileStatus::Success;
+        requestData.readCallback(doneResponse);
+    }
+    return true;
+}
+
+void FileSystem::failOpen(Request& requestData)
+{
+    if (packRead(requestData, PackMountOrder::AfterDisk))
+        return;
+
+    requestData.error = IoError::FailedOpening;
+    requestData.fileStatus = FileStatus::Fail;
+    FileReadResponse response;
+    if (!requestData.filenames.empty())
+        response.filePath = requestData.filenames.front();
+    response.error = IoError::FailedOpening;
+    response.status = FileStatus::Fail;
+    requestData.readCallback(response);
+}
+
+bool FileSystem::resolveFile(Request& requestData, std::string& resolvedFileName)
+{
+    requestData.resolvedFromCache = false;
+
+    //only the first resolution of a request goes through the cache, retries probe what is left.
+    bool firstResolve = requestData.candidateIndex == 0;
+    if (m_cacheResolvedPaths && firstResolve)
+    {
+        std::shared_lock lock(m_resolvedPathsMutex);
+        auto it = m_resolvedPaths.find(requestData.resolveKey);
+        if (it != m_resolvedPaths.end())
+        {
+            int candidate = it->second.candidate;
+            while (!requestData.filenames.empty() && (candidate < 0 || requestData.candidateIndex < candidate))
+            {
+                requestData.filenames.pop();
+                ++requestData.candidateIndex;
             }
 
-        }), requestData);
-        task = requestData->task;
+            resolvedFileName = it->second.absolutePath;
+            requestData.resolvedFromCache = candidate >= 0;
+            return !requestData.filenames.empty();
+        }
     }
 
-    if ((request.flags & (int)FileRequestFlags::AutoStart) != 0)
-        m_ts.execute(task);
-    return asyncHandle;
+    //pop all the candidate files that don't exist
+    while (!requestData.filenames.empty())
+    {
+        bool exists, isDir, isDot;
+        InternalFileSystem::getAttributes(requestData.filenames.front(), exists, isDir, isDot);
+        if (exists && !isDir && !isDot)
+            break;
+
+        requestData.filenames.pop();
+        ++requestData.candidateIndex;
+    }
+
+    bool found = !requestData.filenames.empty();
+    resolvedFileName.clear();
+    if (found)
+        FileUtils::getAbsolutePath(requestData.filenames.front(), resolvedFileName);
+
+    //the result holds as long as the watcher would tell about any of the probed candidates changing,
+    //all of them when none was found.
+    bool cacheable = m_cacheResolvedPaths && firstResolve;
+    int probed = found ? requestData.candidateIndex + 1 : (int)requestData.candidates.size();
+    for (int c = 0; cacheable && c < probed; ++c)
+        cacheable = m_desc.fw->isWatched(requestData.candidates[c].c_str());
+
+    if (cacheable)
+    {
+        std::unique_lock lock(m_resolvedPathsMutex);
+        m_resolvedPaths[requestData.resolveKey] = ResolvedPath { found ? requestData.candidateIndex : -1, resolvedFileName };
+    }
+
+    return found;
+}
+
+bool FileSystem::retryResolve(Request& requestData)
+{
+    if (!requestData.resolvedFromCache)
+        return false;
+
+    {
+        std::unique_lock lock(m_resolvedPathsMutex);
+        m_resolvedPaths.erase(requestData.resolveKey);
+    }
+
+    requestData.filenames.pop();
+    ++requestData.candidateIndex;
+    return true;
+}
+
+void FileSystem::clearResolvedPaths()
+{
+    if (!m_cacheResolvedPaths)
+        return;
+
+    std::unique_lock lock(m_resolvedPathsMutex);
+    m_resolvedPaths.clear();
+}
+
+bool FileSystem::cachedRead(Request& requestData)
+{
+    //the stamp is taken before reading: a file changing meanwhile gets a new stamp, and is read again next time.
+    FileStamp stamp;
+    std::string resolvedFileName;
+    bool found = false;
+    while (!found && resolveFile(requestData, resolvedFileName))
+    {
+        found = InternalFileSystem::getFileStamp(requestData.filenames.front(), stamp.size, stamp.modifiedTime);
+        if (!found && !retryResolve(requestData))
+            break;
+    }
+
+    if (!found)
+    {
+        failOpen(requestData);
+        return true;
+    }
+
+    //the cache would only drop it after reading it whole.
+    if (stamp.size > (uint64_t)m_cache->budget())
+        return false;
+
+    requestData.fileStatus = FileStatus::Reading;
+    SharedFileBuffer contents = m_cache->find(resolvedFileName, stamp);
+    if (contents == nullptr)
+    {
+        ByteBuffer bytes;
+        IoError error = readContents(requestData.filenames.front(), bytes);
+        if (error != IoError::None)
+        {
+            requestData.error = error;
+            requestData.fileStatus = FileStatus::Fail;
+            FileReadResponse response;
+            response.error = error;
+            response.filePath = resolvedFileName;
+            response.status = FileStatus::Fail;
+            requestData.readCallback(response);
+            return true;
+        }
+        contents = m_cache->insert(resolvedFileName, stamp, std::move(bytes));
+    }
+
+    {
+        FileReadResponse response;
+        response.status = FileStatus::Reading;
+        response.buffer = (const char*)contents->data();
+        response.size = contents->size();
+        response.sharedBuffer = contents;
+        response.filePath = resolvedFileName;
+        requestData.readCallback(response);
+    }
+
+    {
+        requestData.fileStatus = FileStatus::Success;
+        FileReadResponse response;
+        response.filePath = resolvedFileName;
+        response.status = FileStatus::Success;
+        requestData.readCallback(response);
+    }
+    return true;
+}
+
+IoError FileSystem::readContents(const std::string& fileName, ByteBuffer& contents)
+{
+    if (m_ring != nullptr)
+    {
+        int fd = m_ring->open(fileName.c_str(), false);
+        if (fd < 0)
+            return IoError::FailedOpening;
+
+        uint64_t fileSize = 0;
+        bool isDir = false;
+        bool success = m_ring->fileInfo(fd, fileSize, isDir) && !isDir;
+        if (success)
+        {
+            contents.resize((size_t)fileSize);
+            success = m_ring->read(fd, (char*)contents.data(), (size_t)fileSize);
+        }
+        IoRing::close(fd);
+        return success ? IoError::None : IoError::FailedReading;
+    }
+
+    InternalFileSystem::OpaqueFileHandle handle = InternalFileSystem::openFile(fileName.c_str(), InternalFileSystem::RequestType::Read);
+    if (!InternalFileSystem::valid(handle))
+        return IoError::FailedOpening;
+
+    //nobody consumes the chunks one by one here, so read them all in one blocking call.
+    bool success = true;
+    TaskUtil::yieldUntil([&success, &contents, handle]() {
+        bool isEof = false;
+        while (success && !isEof)
+        {
+            char* chunk = nullptr;
+            int bytesRead = 0;
+            success = InternalFileSystem::readBytes(handle, chunk, bytesRead, isEof);
+            if (success)
+                contents.append((const u8*)chunk, (size_t)bytesRead);
+        }
+    });
+
+    InternalFileSystem::close(handle);
+    return success ? IoError::None : IoError::FailedReading;
 }
 
+void FileSystem::ringRead(Request& requestData)
+{
+    int fd = -1;
+    uint64_t fileSize = 0;
+    std::string resolvedFileName;
+    while (resolveFile(requestData, resolvedFileName))
+    {
+        fd = m_ring->open(requestData.filenames.front().c_str(), false);
+        bool isDir = false;
+        if (fd >= 0 && m_ring->fileInfo(fd, fileSize, isDir) && !isDir)
+            break;
+
+        IoRing::close(fd);
+        fd = -1;
+        if (!retryResolve(requestData))
+            break;
+    }
+
+    if (fd < 0)
+    {
+        failOpen(requestData);
+        return;
+    }
+
+    requestData.fileStatus = FileStatus::Reading;
+
+    uint64_t offset = std::min(requestData.readOffset, fileSize);
+    uint64_t end = fileSize;
+    if (requestData.readLength != 0)
+        end = std::min(end, offset + requestData.readLength);
+
+    //one bounded buffer per request, reused for every piece of the range like the posix path does.
+    size_t bufferSize = (size_t)std::min(end - offset, (uint64_t)RingReadSize);
+    std::unique_ptr<char[]> buffer(new char[bufferSize > 0 ? bufferSize : 1]);
+    //an empty range still gets its (empty) Reading response, like the posix path.
+    do
+    {
+        size_t pieceSize = (size_t)std::min(end - offset, (uint64_t)bufferSize);
+        if (!m_ring->read(fd, buffer.get(), pieceSize, offset))
+        {
+            IoRing::close(fd);
+            requestData.error = IoError::FailedReading;
+            requestData.fileStatus = FileStatus::Fail;
+            FileReadResponse response;
+            response.error = IoError::FailedReading;
+            response.filePath = resolvedFileName;
+            response.status = FileStatus::Fail;
+            requestData.readCallback(response);
+            return;
+        }
+
+        FileReadResponse response;
+        response.status = FileStatus::Reading;
+        response.buffer = buffer.get();
+        response.size = pieceSize;
+        response.offset = offset;
+        response.filePath = resolvedFileName;
+        requestData.readCallback(response);
+        offset += pieceSize;
+    }
+    while (offset < end);
+
+    IoRing::close(fd);
+
+    {
+        requestData.fileStatus = FileStatus::Success;
+        FileReadResponse response;
+        response.filePath = resolvedFileName;
+        response.status = FileStatus::Success;
+        requestData.readCallback(response);
+    }
+}
 
 void FileSystem::wait(AsyncFileHandle handle)
 {
@@ -311,12 +1041,25 @@ void FileSystem::closeHandle(AsyncFileHandle handle)
             return;
     }
 
+    //a stream nobody ended still gets its file closed.
+    if (requestData->streamTail.valid())
+        endWrite(handle);
+
     m_ts.wait(requestData->task);
     m_ts.cleanTaskTree(requestData->task);
 
     if (InternalFileSystem::valid(requestData->opaqueHandle))
         InternalFileSystem::close(requestData->opaqueHandle);
 
+    for (Request* fileData : requestData->batch)
+    {
+        if (InternalFileSystem::valid(fileData->opaqueHandle))
+            InternalFileSystem::close(fileData->opaqueHandle);
+        delete fileData;
+    }
+
+    delete requestData->enumerate;
+
     delete requestData;
     
     {
@@ -338,13 +1081,168 @@ void FileSystem::enumerateFiles(const char* directoryName, std::vector<std::stri
     InternalFileSystem::enumerateFiles(dirName, dirList);
 }
 
+namespace
+{
+
+//'*' matches any run of characters, '?' any single one.
+bool matchGlob(const char* pattern, const char* name)
+{
+    const char* starPattern = nullptr;
+    const char* starName = nullptr;
+    while (*name != '\0')
+    {
+        if (*pattern == '*')
+        {
+            starPattern = ++pattern;
+            starName = name;
+        }
+        else if (*pattern == '?' || *pattern == *name)
+        {
+            ++pattern;
+            ++name;
+        }
+        else if (starPattern != nullptr)
+        {
+            //let the last star swallow one more character.
+            pattern = starPattern;
+            name = ++starName;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while (*pattern == '*')
+        ++pattern;
+    return *pattern == '\0';
+}
+
+}
+
+AsyncFileHandle FileSystem::enumerate(const FileEnumerateRequest& request)
+{
+    CPY_ASSERT_MSG(request.callback, "File enumerate request must provide a callback.");
+
+    AsyncFileHandle asyncHandle;
+    Task task;
+
+    {
+        std::unique_lock lock(m_requestsMutex);
+        Request*& requestData = m_requests.allocate(asyncHandle);
+        requestData = new Request();
+        requestData->error = IoError::None;
+        requestData->fileStatus = FileStatus::Idle;
+        requestData->enumerate = new EnumerateState();
+        requestData->enumerate->request = request;
+        requestData->task = m_ts.createTask(TaskDesc("FileSystem::enumerate", TaskPriority::Normal, TaskLane::Io, [this](TaskContext& ctx)
+        {
+            auto* requestData = (Request*)ctx.data;
+            EnumerateState& state = *requestData->enumerate;
+
+            bool exists = false, isDir = false, isDot = false;
+            InternalFileSystem::getAttributes(state.request.path, exists, isDir, isDot);
+            if (!exists || !isDir)
+            {
+                requestData->error = IoError::FailedOpening;
+                requestData->fileStatus = FileStatus::Fail;
+                FileEnumerateResponse response;
+                response.error = IoError::FailedOpening;
+                response.status = FileStatus::Fail;
+                state.request.callback(response);
+                return;
+            }
+
+            //every directory gets its own task, this one only comes back once the last of them is done.
+            requestData->fileStatus = FileStatus::Reading;
+            TaskUtil::suspendUntil([this, &state](TaskResumeFn resume)
+            {
+                state.resume = std::move(resume);
+                state.pendingDirs = 1;
+                enumerateDirectory(state, state.request.path);
+            });
+
+            requestData->fileStatus = FileStatus::Success;
+            FileEnumerateResponse response;
+            response.status = FileStatus::Success;
+            state.request.callback(response);
+        }), requestData);
+        task = requestData->task;
+    }
+
+    if ((request.flags & (int)FileRequestFlags::AutoStart) != 0)
+        m_ts.execute(task);
+    return asyncHandle;
+}
+
+void FileSystem::enumerateDirectory(EnumerateState& state, std::string path)
+{
+    auto* dir = new EnumerateDir { &state, std::move(path) };
+    TaskDesc desc("FileSystem::enumerateDirectory", TaskPriority::Normal, TaskLane::Io, [this](TaskContext& ctx)
+    {
+        std::unique_ptr<EnumerateDir> dir((EnumerateDir*)ctx.data);
+        EnumerateState& state = *dir->state;
+        const FileEnumerateRequest& request = state.request;
+
+        std::vector<std::string> subDirs;
+        std::vector<FileEntry> entries;
+        InternalFileSystem::listDirectory(dir->path, [&request](const char* name, bool isDir)
+        {
+            if (isDir && !request.includeDirectories)
+                return false;
+
+            if (request.patterns.empty())
+                return true;
+
+            for (const auto& pattern : request.patterns)
+                if (matchGlob(pattern.c_str(), name))
+                    return true;
+
+            return false;
+        }, subDirs, entries);
+
+        //subdirectories go out first, so other workers list them while this one reports.
+        if (request.recursive)
+        {
+            for (auto& subDir : subDirs)
+            {
+                state.pendingDirs.fetch_add(1);
+                enumerateDirectory(state, std::move(subDir));
+            }
+        }
+
+        if (!entries.empty())
+        {
+            std::unique_lock lock(state.callbackMutex);
+            FileEnumerateResponse response;
+            response.status = FileStatus::Reading;
+            response.entries = entries.data();
+            response.count = (int)entries.size();
+            state.request.callback(response);
+        }
+
+        //the walk task can finish, and the state be deleted, as soon as it is resumed: move the resume out before calling it.
+        if (state.pendingDirs.fetch_sub(1) == 1)
+        {
+            TaskResumeFn resume = std::move(state.resume);
+            resume();
+        }
+    });
+
+    //auto released, nothing ever waits on a single directory.
+    desc.flags = (int)TaskFlags::AutoRelease;
+    m_ts.execute(m_ts.createTask(desc, dir));
+}
+
 bool FileSystem::deleteDirectory(const char* directoryName)
 {
+    clearResolvedPaths();
     return InternalFileSystem::deleteDirectory(directoryName);
 }
 
 bool FileSystem::deleteFile(const char* fileName)
 {
+    clearResolvedPaths();
     return InternalFileSystem::deleteFile(fileName);
 }
 
@@ -353,6 +1251,30 @@ void FileSystem::getFileAttributes(const char* fileName, FileAttributes& attribu
     InternalFileSystem::getAttributes(fileName, attributes.exists, attributes.isDir, attributes.isDot);
 }
 
+void FileSystem::getCacheStats(FileCacheStats& stats)
+{
+    stats = FileCacheStats();
+    if (m_cache)
+        m_cache->getStats(stats);
+}
+
+void FileSystem::onFilesChanged(const std::set<std::string>& filesChanged)
+{
+    //the watcher does not say whether files got created, deleted or modified: any of them may change how
+    //a path resolves.
+    clearResolvedPaths();
+
+    if (m_cache == nullptr)
+        return;
+
+    for (const auto& fileChanged : filesChanged)
+    {
+        std::string resolvedFileName;
+        FileUtils::getAbsolutePath(fileChanged, resolvedFileName);
+        m_cache->invalidate(resolvedFileName);
+    }
+}
+
 IFileSystem* IFileSystem::create(const FileSystemDesc& desc)
 {
     return new FileSystem(desc);
@@ -1,16 +1,23 @@
 #pragma once
 #include <coalpy.files/IFileSystem.h>
+#include <coalpy.files/IFileWatcher.h>
 #include <coalpy.tasks/TaskDefs.h>
 #include <coalpy.core/ByteBuffer.h>
-#include <coalpy.core/HandleContainer.h>
+#include <coalpy.core/GenerationalHandleContainer.h>
 #include "InternalFileSystem.h"
+#include "IoRing.h"
+#include "FileCache.h"
+#include "Pack.h"
 #include <vector>
 #include <queue>
+#include <unordered_map>
 #include <variant>
 #include <string>
 #include <mutex>
+#include <condition_variable>
 #include <shared_mutex>
 #include <atomic>
+#include <memory>
 
 namespace coalpy
 {
@@ -21,13 +28,20 @@ namespace coalpy
 #define FILE_SEP '\\'
 #endif
 
-class FileSystem : public IFileSystem
+class FileSystem : public IFileSystem, public IFileWatchListener
 {
 public:
     FileSystem(const FileSystemDesc& desc);
     virtual ~FileSystem();
     virtual AsyncFileHandle read(const FileReadRequest& request) override;
+    virtual AsyncFileHandle readBatch(const FileReadRequest* requests, int count) override;
     virtual AsyncFileHandle write(const FileWriteRequest& request) override;
+    virtual AsyncFileHandle beginWrite(const FileWriteRequest& request) override;
+    virtual void appendWrite(AsyncFileHandle handle, const char* buffer, size_t size) override;
+    virtual void endWrite(AsyncFileHandle handle) override;
+    virtual void prefetch(const std::vector<std::string>& paths) override;
+    virtual bool mountPack(const PackMountRequest& request) override;
+    virtual bool unmountPack(const char* packPath) override;
     virtual void execute(AsyncFileHandle handle) override;
     virtual Task asTask(AsyncFileHandle handle) override;
     virtual void wait(AsyncFileHandle handle) override;
@@ -36,22 +50,117 @@ public:
     virtual void closeHandle(AsyncFileHandle handle) override;
     virtual bool carveDirectoryPath(const char* directoryName) override;
     virtual void enumerateFiles(const char* directoryName, std::vector<std::string>& dirList) override;
+    virtual AsyncFileHandle enumerate(const FileEnumerateRequest& request) override;
     virtual bool deleteDirectory(const char* directoryName) override;
     virtual bool deleteFile(const char* fileName) override;
     virtual void getFileAttributes(const char* fileName, FileAttributes& attributes) override;
+    virtual void getCacheStats(FileCacheStats& stats) override;
+    virtual void onFilesChanged(const std::set<std::string>& filesChanged) override;
 
 private:
+    struct Request;
+
+    enum
+    {
+        MaxBatchConcurrency = 16, //files of a batch read at the same time
+        WritePieceSize = 1024 * 1024 //bytes written per blocking call, without the ring
+    };
+
+    void setupRead(Request& requestData, const FileReadRequest& request);
+    void readFile(Request* requestData);
+    //pops candidates until the front one is the file to read, and gets its absolute path. False if none exists.
+    bool resolveFile(Request& requestData, std::string& resolvedFileName);
+    //when the front candidate came from the resolved path cache and could not be opened: forgets it and moves on.
+    bool retryResolve(Request& requestData);
+    void clearResolvedPaths();
+
+    void prefetchFile(const std::string& path);
+
+    //reads the first candidate found in a pack mounted with order. False if none is.
+    bool packRead(Request& requestData, PackMountOrder order);
+    //no candidate could be opened: packs mounted after the disk get a go before the read fails.
+    void failOpen(Request& requestData);
+
+    //false, with the request resolved to the file, when it does not fit the cache and has to be read from disk.
+    bool cachedRead(Request& requestData);
+    IoError readContents(const std::string& fileName, ByteBuffer& contents);
+    void ringRead(Request& requestData);
+
+    void setupWrite(Request& requestData, const FileWriteRequest& request);
+    //opens the file written to, the temporary one with AtomicReplace.
+    IoError openWrite(Request& requestData);
+    bool writeData(Request& requestData, const char* buffer, size_t size, uint64_t offset);
+    //closes the file, moves it over the target with AtomicReplace, and reports to the callback.
+    void finishWrite(Request& requestData, IoError error);
+
+    struct EnumerateState
+    {
+        FileEnumerateRequest request;
+        std::mutex callbackMutex;
+        std::atomic<int> pendingDirs = 0; //listed or being listed, the last one done resumes the walk task
+        TaskResumeFn resume;
+    };
+
+    //one directory of a walk, owned by its task.
+    struct EnumerateDir
+    {
+        EnumerateState* state = nullptr;
+        std::string path;
+    };
+
+    void enumerateDirectory(EnumerateState& state, std::string path);
+
+    //one appendWrite, owned by its task.
+    struct WriteChunk
+    {
+        Request* request = nullptr;
+        const char* data = nullptr;
+        size_t size = 0;
+        uint64_t offset = 0;
+        ByteBuffer copy;
+    };
 
     struct Request
     {
         InternalFileSystem::RequestType type = InternalFileSystem::RequestType::Read;
         std::queue<std::string> filenames;
+        std::vector<std::string> candidates; //all of filenames, those get popped while resolving
         FileReadDoneCallback readCallback = nullptr;
         FileWriteDoneCallback writeCallback = nullptr;
         InternalFileSystem::OpaqueFileHandle opaqueHandle = {};
 
+        bool memoryMap = false;
+        FileAccessHint access = FileAccessHint::Sequential;
+        uint64_t readOffset = 0;
+        uint64_t readLength = 0;
+
+        //the request path and its roots, which resolve to the same file until something changes on disk.
+        std::string resolveKey;
+        int candidateIndex = 0;
+        bool resolvedFromCache = false;
+
+        //files of a readBatch group, the group request itself only owns the task.
+        std::vector<Request*> batch;
+        std::atomic<int> nextBatchFile = 0;
+
+        EnumerateState* enumerate = nullptr;
+
+        //pack a read got served from, kept alive for the view handed out.
+        std::shared_ptr<Pack> pack;
+
+        //what gets written: writeBuffer holds a copy, unless the caller lends its buffer or shares it.
         ByteBuffer writeBuffer;
-        int writeSize = 0;
+        SharedFileBuffer writeShared;
+        const char* writeData = nullptr;
+        size_t writeSize = 0;
+        bool borrowBuffers = false;
+        bool atomicReplace = false;
+        std::string writePath; //temporary file with atomicReplace
+        int ringFd = -1;
+
+        //last task of a streamed write, appends chain after it.
+        Task streamTail;
+        uint64_t streamOffset = 0;
 
         Task task;
         std::atomic<IoError> error;
@@ -60,8 +169,38 @@ private:
 
     ITaskSystem& m_ts;
     FileSystemDesc m_desc;
+    IoRing* m_ring = nullptr;
+    FileCache* m_cache = nullptr;
+    std::atomic<unsigned> m_tempFileCounter = 0;
+    unsigned m_tempFileSalt = 0;
+
+    //prefetch tasks release themselves, the destructor waits for them through this count.
+    std::mutex m_prefetchMutex;
+    std::condition_variable m_prefetchDone;
+    int m_pendingPrefetches = 0;
+
+    struct MountedPack
+    {
+        std::shared_ptr<Pack> pack;
+        std::string prefix; //mount point normalized as pack paths are, with a trailing separator
+        PackMountOrder order;
+    };
+
+    std::shared_mutex m_packsMutex;
+    std::vector<MountedPack> m_packs;
+
+    //which candidate of a read resolved to what absolute path, -1 when none exists.
+    struct ResolvedPath
+    {
+        int candidate = -1;
+        std::string absolutePath;
+    };
+
+    bool m_cacheResolvedPaths = false;
+    std::shared_mutex m_resolvedPathsMutex;
+    std::unordered_map<std::string, ResolvedPath> m_resolvedPaths;
     mutable std::shared_mutex m_requestsMutex;
-    HandleContainer<AsyncFileHandle, Request*> m_requests;
+    GenerationalHandleContainer<AsyncFileHandle, Request*> m_requests;
 };
 
 }
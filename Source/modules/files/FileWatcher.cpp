@@ -1,15 +1,18 @@
 #include <coalpy.core/Assert.h>
 #include <coalpy.core/String.h>
-#include <coalpy.tasks/ThreadQueue.h>
 #include <iostream>
 #include <string>
 #include <sstream>
 #include <chrono>
 #include <thread>
+#include <mutex>
 #include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+#include <cctype>
 #include "FileWatcher.h"
 
-#ifdef _WIN32 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #elif defined(__linux__)
@@ -21,6 +24,9 @@
 #include <dirent.h>
 #include <unistd.h>
 #include <errno.h>
+#include <cstring>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/inotify.h>
 #endif
 
@@ -29,48 +35,45 @@
 namespace coalpy
 {
 
-enum class FileWatchMessageType
-{
-    ListenToDirectories,
-    Exit
-};
-
-struct FileWatchMessage
-{
-    FileWatchMessageType type;
-};
+using WatchClock = std::chrono::steady_clock;
 
 #ifdef _WIN32
-typedef void* WatchHandle;
 
 struct WinFileWatch
 {
-    bool waitResult;
+    std::string directory;
+    HANDLE dirHandle;
     HANDLE event;
     OVERLAPPED overlapped;
-    char payload[sizeof(FILE_NOTIFY_INFORMATION) + 1024];
+    bool inFlight;
+    alignas(DWORD) char payload[64 * 1024];
 };
 
-#elif defined(__linux__)
-typedef int WatchHandle;
 #endif
 
-
 struct FileWatchState
 {
 public:
     std::thread thread;
+
+    //guards the watches and the listeners. The watcher thread holds it shared while notifying, so a
+    //listener is never called once removeListener returned.
     std::shared_mutex fileWatchMutex;
     std::set<std::string> directoriesSet;
-    std::vector<std::string> directories;
-    std::vector<WatchHandle> handles;
     std::set<IFileWatchListener*> listeners;
-    ThreadQueue<FileWatchMessage> queue;
 
-#ifdef _WIN32 
+    //changes waiting for the debounce window to pass, only touched by the watcher thread.
+    std::set<std::string> pendingFiles;
+    WatchClock::time_point pendingDeadline;
+
+#ifdef _WIN32
     std::vector<WinFileWatch*> watches;
+    HANDLE stopEvent;
+    HANDLE wakeEvent; //new directories to watch
 #elif defined(__linux__)
     int inotifyInstance;
+    int stopEvent;
+    std::unordered_map<int, std::string> watchedDirs; //watch descriptor to directory
 #endif
 
 };
@@ -78,146 +81,213 @@ public:
 namespace
 {
 
-#ifdef _WIN32 
-void findResults(
-    const std::string& rootDir,
-    HANDLE dirHandle,
-    OVERLAPPED& overlapped,
-    FILE_NOTIFY_INFORMATION* infos,
-    int millisecondsToWait,
-    std::set<std::string>& caughtFiles)
+std::string joinPath(const std::string& dir, const char* name)
+{
+    std::string path = dir;
+    if (!path.empty() && path[path.size() - 1] != '/' && path[path.size() - 1] != '\\')
+        path += '/';
+    path += name;
+    return path;
+}
+
+void addPendingFile(FileWatchState& state, const FileWatchDesc& desc, std::string fileName)
+{
+    if (state.pendingFiles.empty())
+        state.pendingDeadline = WatchClock::now() + std::chrono::milliseconds(desc.debounceMS);
+    state.pendingFiles.insert(std::move(fileName));
+}
+
+//-1 waits forever, nothing is pending.
+int msUntilFlush(const FileWatchState& state)
+{
+    if (state.pendingFiles.empty())
+        return -1;
+
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(state.pendingDeadline - WatchClock::now()).count();
+    return remaining > 0 ? (int)remaining : 0;
+}
+
+void flushPendingFiles(FileWatchState& state)
+{
+    if (state.pendingFiles.empty() || WatchClock::now() < state.pendingDeadline)
+        return;
+
+    std::set<std::string> caughtFiles;
+    caughtFiles.swap(state.pendingFiles);
+
+    std::shared_lock lock(state.fileWatchMutex);
+    for (auto* listener : state.listeners)
+        listener->onFilesChanged(caughtFiles);
+}
+
+#ifdef _WIN32
+
+bool beginWatch(WinFileWatch& fileWatch)
 {
+    fileWatch.overlapped = {};
+    fileWatch.overlapped.hEvent = fileWatch.event;
     DWORD bytesReturned = 0;
+    bool result = ReadDirectoryChangesW(
+        fileWatch.dirHandle, (LPVOID)&fileWatch.payload, sizeof(fileWatch.payload), TRUE,
+        FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_CREATION | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE,
+        &bytesReturned, &fileWatch.overlapped, NULL);
+    CPY_ASSERT_FMT(result, "Failed watching directory \"%s\"", fileWatch.directory.c_str());
+    fileWatch.inFlight = result;
+    return result;
+}
 
-    auto hasOverlapped = GetOverlappedResult(dirHandle, &overlapped, &bytesReturned, FALSE);
+void findResults(FileWatchState& state, const FileWatchDesc& desc, WinFileWatch& fileWatch)
+{
+    DWORD bytesReturned = 0;
+    auto hasOverlapped = GetOverlappedResult(fileWatch.dirHandle, &fileWatch.overlapped, &bytesReturned, FALSE);
     if (!hasOverlapped)
         return;
 
-    FILE_NOTIFY_INFORMATION* curr = bytesReturned ? infos : nullptr;
+    fileWatch.inFlight = false;
+
+    //the payload overflowed and the changes got dropped: all we know is something under the directory changed.
+    if (bytesReturned == 0)
+    {
+        addPendingFile(state, desc, fileWatch.directory);
+        return;
+    }
+
+    auto* curr = reinterpret_cast<FILE_NOTIFY_INFORMATION*>(fileWatch.payload);
     while (curr != nullptr)
     {
-        if (curr->Action == FILE_ACTION_MODIFIED)
-        {
-            std::wstring wfilename;
-            wfilename.assign(curr->FileName, curr->FileNameLength / sizeof(wchar_t));
-            std::string filename = ws2s(wfilename);
-            caughtFiles.insert(rootDir + "/" + filename);
-        }
-#if WATCH_SERVICE_DEBUG_OUTPUT
-        else
-        {
-            std::cout << "Action not captured" << std::endl;
-        }
-#endif
+        //added, removed, modified and both ends of a rename all change what reads of that path get.
+        std::wstring wfilename;
+        wfilename.assign(curr->FileName, curr->FileNameLength / sizeof(wchar_t));
+        std::string filename = ws2s(wfilename);
+        addPendingFile(state, desc, joinPath(fileWatch.directory, filename.c_str()));
         curr = curr->NextEntryOffset == 0 ? nullptr : (FILE_NOTIFY_INFORMATION*)((char*)curr + curr->NextEntryOffset);
     }
 }
-#endif
 
-bool waitListenForDirs(FileWatchState& state, int millisecondsToWait)
+#elif defined(__linux__)
+
+const uint32_t WatchMask = IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW;
+
+bool isDirectory(const std::string& path, const struct dirent* entry)
 {
-    std::set<std::string> caughtFiles;
+    if (entry->d_type != DT_UNKNOWN)
+        return entry->d_type == DT_DIR;
+
+    struct stat statbuf;
+    return lstat(path.c_str(), &statbuf) == 0 && S_ISDIR(statbuf.st_mode);
+}
+
+//inotify watches are not recursive: every directory of the tree gets its own. Files already in directories
+//that just appeared are collected in newFiles, they got there before anything was watching.
+void watchTree(FileWatchState& state, const std::string& directory, std::vector<std::string>* newFiles)
+{
+    //a directory watched already keeps its descriptor, it only gets its path refreshed.
+    int wd = inotify_add_watch(state.inotifyInstance, directory.c_str(), WatchMask);
+    if (wd == -1)
+        return;
 
-#ifdef _WIN32 
+    state.watchedDirs[wd] = directory;
 
-    if (state.handles.empty())
-        return true;
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr)
+        return;
 
-    std::shared_lock lock(state.fileWatchMutex);
-    for (int i = 0; i < (int)state.handles.size(); ++i)
+    while (struct dirent* entry = readdir(dir))
     {
-        #if WATCH_SERVICE_DEBUG_OUTPUT
-            std::cout << "polling filewatch: " << state.directories[i] << std::endl;
-        #endif
-
-        auto dirHandle = (HANDLE)state.handles[i];
-        WinFileWatch& fileWatch = *state.watches[i];
-        auto event = fileWatch.event;
-        OVERLAPPED& overlapped = fileWatch.overlapped;
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        std::string path = joinPath(directory, entry->d_name);
+        if (isDirectory(path, entry))
+            watchTree(state, path, newFiles);
+        else if (newFiles != nullptr)
+            newFiles->push_back(path);
+    }
+    closedir(dir);
+}
+
+//a directory that moved away: its watches would keep reporting under the old paths.
+void unwatchTree(FileWatchState& state, const std::string& directory)
+{
+    std::string prefix = joinPath(directory, "");
+    for (auto it = state.watchedDirs.begin(); it != state.watchedDirs.end();)
+    {
+        if (it->second == directory || it->second.compare(0, prefix.size(), prefix) == 0)
         {
-            if (!fileWatch.waitResult)
+            inotify_rm_watch(state.inotifyInstance, it->first);
+            it = state.watchedDirs.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+void readEvents(FileWatchState& state, const FileWatchDesc& desc)
+{
+    alignas(struct inotify_event) char eventBuffer[64 * 1024];
+    while (true)
+    {
+        ssize_t bytesRead = ::read(state.inotifyInstance, eventBuffer, sizeof(eventBuffer));
+        if (bytesRead <= 0)
+            return;
+
+        for (ssize_t i = 0; i < bytesRead;)
+        {
+            const auto* event = (const struct inotify_event*)&eventBuffer[i];
+            i += sizeof(struct inotify_event) + event->len;
+
+            //the kernel dropped events: all we know is something under the roots changed.
+            if (event->mask & IN_Q_OVERFLOW)
             {
-                overlapped = {};
-                overlapped.hEvent = event;
-                DWORD bytesReturned = 0;
-                bool result = ReadDirectoryChangesW(
-                    dirHandle, (LPVOID)&fileWatch.payload, sizeof(fileWatch.payload), TRUE, FILE_NOTIFY_CHANGE_CREATION | FILE_NOTIFY_CHANGE_LAST_WRITE, &bytesReturned,
-                    &overlapped, NULL);
-                fileWatch.waitResult = true;
-                CPY_ASSERT_FMT(result, "Failed watching directory \"%s\"", state.directories[i].c_str());
-
-                if (!result)
-                    return false;
+                std::shared_lock lock(state.fileWatchMutex);
+                for (const auto& root : state.directoriesSet)
+                    addPendingFile(state, desc, root);
+                continue;
             }
 
-            if (fileWatch.waitResult)
+            if (event->mask & IN_IGNORED)
             {
-                auto waitResult = WaitForSingleObject(overlapped.hEvent, i == 0 ? millisecondsToWait : 0);
-                if (waitResult == WAIT_TIMEOUT)
-                    continue;
+                std::unique_lock lock(state.fileWatchMutex);
+                state.watchedDirs.erase(event->wd);
+                continue;
             }
 
-            findResults(
-                state.directories[i],
-                dirHandle,
-                overlapped,
-                reinterpret_cast<FILE_NOTIFY_INFORMATION*>(fileWatch.payload),
-                i == 0 ? millisecondsToWait : 0,
-                caughtFiles);
-            
-
-            fileWatch.waitResult = false;
-        }
-    }
-#elif defined(__linux__)
-    const size_t fileName = 64;
-    const size_t maxEvents = 512;
-    const size_t buffLen = maxEvents * (sizeof(struct inotify_event) + fileName);
+            if (event->len == 0)
+                continue;
 
-    char eventBuffer[buffLen];
-    ssize_t bytesRead = ::read(state.inotifyInstance, eventBuffer, buffLen);
-    ssize_t i = 0;
+            std::string path;
+            {
+                std::shared_lock lock(state.fileWatchMutex);
+                auto it = state.watchedDirs.find(event->wd);
+                if (it == state.watchedDirs.end())
+                    continue;
+                path = joinPath(it->second, event->name);
+            }
 
-    while (i < bytesRead)
-    {
-        struct inotify_event *event = (struct inotify_event *) &eventBuffer[i];
-        if(event->len)
-        {
-            if ( event->mask & IN_MODIFY )
+            //a directory created or moved in gets watched along with whatever it already holds.
+            if ((event->mask & IN_ISDIR) != 0 && (event->mask & (IN_CREATE | IN_MOVED_TO)) != 0)
             {
-                //find the watch descriptor
-                std::stringstream ss;
-                for (int k = 0; k < (int)state.handles.size(); ++k)
+                std::vector<std::string> newFiles;
                 {
-                    auto wd = state.handles[k];
-                    if (wd != event->wd)
-                        continue;
-                    
-                    const auto& dirName = state.directories[k];
-                    ss << dirName;
-                    if (!dirName.empty() && dirName[dirName.size() - 1] != '/')
-                        ss << '/';
-                    break;
+                    std::unique_lock lock(state.fileWatchMutex);
+                    watchTree(state, path, &newFiles);
                 }
-                ss << event->name;
-                caughtFiles.insert(ss.str());
+                for (auto& newFile : newFiles)
+                    addPendingFile(state, desc, std::move(newFile));
+            }
+            else if ((event->mask & IN_ISDIR) != 0 && (event->mask & IN_MOVED_FROM) != 0)
+            {
+                std::unique_lock lock(state.fileWatchMutex);
+                unwatchTree(state, path);
             }
-        }
-        i += sizeof(struct inotify_event) + event->len;
-    }
-#endif
 
-    if (!caughtFiles.empty())
-    {
-        for (auto* listener : state.listeners)
-            listener->onFilesChanged(caughtFiles);
+            addPendingFile(state, desc, std::move(path));
+        }
     }
-
-    std::this_thread::sleep_for(std::chrono::milliseconds(millisecondsToWait));
-
-    return true;
 }
 
+#endif
+
 }
 
 FileWatcher::FileWatcher(const FileWatchDesc& desc)
@@ -235,11 +305,14 @@ void FileWatcher::start()
     CPY_ASSERT(m_state == nullptr);
     m_state = new FileWatchState;
 
-#ifdef __linux__
-    m_state->inotifyInstance = ::inotify_init();
+#ifdef _WIN32
+    m_state->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    m_state->wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+#elif defined(__linux__)
+    m_state->inotifyInstance = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
     CPY_ASSERT(m_state->inotifyInstance != -1);
-    int hresult = fcntl(m_state->inotifyInstance, F_SETFL, O_NONBLOCK);
-    CPY_ASSERT(hresult == 0);
+    m_state->stopEvent = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CPY_ASSERT(m_state->stopEvent != -1);
 #endif
 
     m_state->thread = std::thread(
@@ -247,10 +320,6 @@ void FileWatcher::start()
     {
         onFileListening();
     });
-
-    FileWatchMessage msg;
-    msg.type = FileWatchMessageType::ListenToDirectories;
-    m_state->queue.push(msg);
 }
 
 void FileWatcher::stop()
@@ -258,27 +327,36 @@ void FileWatcher::stop()
     if (!m_state)
         return;
 
-    FileWatchMessage msg;
-    msg.type = FileWatchMessageType::Exit;
-    m_state->queue.push(msg);
+#ifdef _WIN32
+    SetEvent(m_state->stopEvent);
     m_state->thread.join();
 
-#ifdef _WIN32 
-    for (auto h : m_state->handles)
-        CloseHandle((HANDLE)h);
-
     for (auto& w : m_state->watches)
     {
-        CloseHandle((HANDLE)w->event);
+        if (w->inFlight)
+        {
+            CancelIoEx(w->dirHandle, &w->overlapped);
+            DWORD bytesReturned = 0;
+            GetOverlappedResult(w->dirHandle, &w->overlapped, &bytesReturned, TRUE);
+        }
+        CloseHandle(w->dirHandle);
+        CloseHandle(w->event);
         delete w;
     }
+    CloseHandle(m_state->stopEvent);
+    CloseHandle(m_state->wakeEvent);
 
 #elif defined(__linux__)
-    for (auto h : m_state->handles)
-        inotify_rm_watch(m_state->inotifyInstance, (int)h);
+    uint64_t stopValue = 1;
+    ssize_t written = ::write(m_state->stopEvent, &stopValue, sizeof(stopValue));
+    CPY_ASSERT(written == sizeof(stopValue));
+    m_state->thread.join();
+
+    //closing the instance drops all of its watches.
     ::close(m_state->inotifyInstance);
+    ::close(m_state->stopEvent);
 #endif
-    
+
     delete m_state;
     m_state = nullptr;
 }
@@ -295,35 +373,100 @@ void FileWatcher::addDirectory(const char* directory)
         std::cout << "opening " << dirStr << std::endl;
     #endif
 
-#ifdef _WIN32 
+#ifdef _WIN32
 
     HANDLE dirHandle = CreateFileA(
         directory,
         FILE_LIST_DIRECTORY,
-        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
         FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
 
     CPY_ASSERT_FMT(dirHandle != INVALID_HANDLE_VALUE, "Could not open directory \"%s\" for file watching service.", directory);
     if (dirHandle == INVALID_HANDLE_VALUE)
         return;
 
-    m_state->directories.push_back(dirStr);
-    m_state->handles.push_back((WatchHandle)dirHandle);
-
-    m_state->watches.push_back(new WinFileWatch);
-    WinFileWatch& fileWatch = *m_state->watches.back();
-    fileWatch.waitResult = false;
-    fileWatch.event = CreateEvent(NULL, TRUE, TRUE, NULL);
-    fileWatch.overlapped = {};
-    fileWatch.overlapped.hEvent = fileWatch.event;
+    //the watcher thread waits on every watch event at once.
+    CPY_ASSERT_MSG(m_state->watches.size() + 2 < MAXIMUM_WAIT_OBJECTS, "Too many directories watched, watch a common parent instead.");
+
+    //ReadDirectoryChangesW watches the whole tree by itself.
+    auto* fileWatch = new WinFileWatch;
+    fileWatch->directory = dirStr;
+    fileWatch->dirHandle = dirHandle;
+    fileWatch->event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    fileWatch->overlapped = {};
+    fileWatch->inFlight = false;
+    m_state->watches.push_back(fileWatch);
+    SetEvent(m_state->wakeEvent);
 #elif defined(__linux__)
-    m_state->directories.push_back(dirStr);
-    int wd = inotify_add_watch(
-        m_state->inotifyInstance, directory, IN_MODIFY | IN_CREATE | IN_DELETE);
-    m_state->handles.push_back((WatchHandle)wd);
+    watchTree(*m_state, dirStr, nullptr);
 #endif
 }
 
+//absolute path with / separators, without . or .. in it. Lexical: the path does not need to exist.
+static std::string fullWatchPath(const std::string& path)
+{
+#ifdef _WIN32
+    char fullPath[MAX_PATH] = {};
+    DWORD length = GetFullPathNameA(path.c_str(), MAX_PATH, fullPath, nullptr);
+    std::string result(fullPath, length < MAX_PATH ? length : 0);
+    for (char& c : result)
+        c = c == '\\' ? '/' : (char)tolower(c);
+    while (result.size() > 3 && result.back() == '/')
+        result.pop_back();
+    return result;
+#else
+    std::string absolutePath = path;
+    if (absolutePath.empty() || absolutePath[0] != '/')
+    {
+        char cwd[PATH_MAX] = {};
+        if (getcwd(cwd, PATH_MAX) == nullptr)
+            return std::string();
+        absolutePath = std::string(cwd) + "/" + absolutePath;
+    }
+
+    std::vector<std::string> components;
+    std::stringstream ss(absolutePath);
+    std::string component;
+    while (std::getline(ss, component, '/'))
+    {
+        if (component.empty() || component == ".")
+            continue;
+        if (component == "..")
+        {
+            if (!components.empty())
+                components.pop_back();
+            continue;
+        }
+        components.push_back(component);
+    }
+
+    std::string result;
+    for (const std::string& c : components)
+        result += "/" + c;
+    return result.empty() ? std::string("/") : result;
+#endif
+}
+
+bool FileWatcher::isWatched(const char* path)
+{
+    std::string fullPath = fullWatchPath(path);
+    if (fullPath.empty())
+        return false;
+
+    std::shared_lock lock(m_state->fileWatchMutex);
+    for (const std::string& directory : m_state->directoriesSet)
+    {
+        std::string fullDirectory = fullWatchPath(directory);
+        if (fullDirectory.empty() || fullPath.compare(0, fullDirectory.size(), fullDirectory) != 0)
+            continue;
+
+        if (fullPath.size() == fullDirectory.size() || fullDirectory.back() == '/' || fullPath[fullDirectory.size()] == '/')
+            return true;
+    }
+
+    return false;
+}
+
 void FileWatcher::addListener(IFileWatchListener* listener)
 {
     CPY_ASSERT(m_state);
@@ -346,36 +489,64 @@ void FileWatcher::removeListener(IFileWatchListener* listener)
 
 void FileWatcher::onFileListening()
 {
+    FileWatchState& state = *m_state;
     bool active = true;
 
+    //sleeps until the os reports a change, the debounce window of pending changes ends, or stop is called.
     while (active)
     {
-        FileWatchMessage msg;
-        bool receivedMessage = m_state->queue.waitPopUntil(msg, m_desc.pollingRateMS);
-        if (!receivedMessage)
+#ifdef _WIN32
+        std::vector<HANDLE> waitHandles = { state.stopEvent, state.wakeEvent };
+        std::vector<WinFileWatch*> watches;
+        {
+            std::shared_lock lock(state.fileWatchMutex);
+            watches = state.watches;
+        }
+
+        for (auto* fileWatch : watches)
         {
-            FileWatchMessage msg;
-            msg.type = FileWatchMessageType::ListenToDirectories;
-            m_state->queue.push(msg);
+            if (fileWatch->inFlight || beginWatch(*fileWatch))
+                waitHandles.push_back(fileWatch->event);
+        }
+
+        int timeout = msUntilFlush(state);
+        DWORD waitResult = WaitForMultipleObjects((DWORD)waitHandles.size(), waitHandles.data(), FALSE, timeout < 0 ? INFINITE : (DWORD)timeout);
+        if (waitResult == WAIT_OBJECT_0)
+        {
+            active = false;
             continue;
         }
 
-        switch (msg.type)
+        for (auto* fileWatch : watches)
         {
-        case FileWatchMessageType::ListenToDirectories:
-            {
-                active = waitListenForDirs(*m_state, m_desc.pollingRateMS);
-                FileWatchMessage msg;
-                msg.type = FileWatchMessageType::ListenToDirectories;
-                m_state->queue.push(msg);
-            }
-            break;
-        case FileWatchMessageType::Exit:
-        default:
-            {
-                active = false;
-            }
+            if (fileWatch->inFlight)
+                findResults(state, m_desc, *fileWatch);
         }
+#elif defined(__linux__)
+        struct pollfd fds[2] = {
+            { state.stopEvent, POLLIN, 0 },
+            { state.inotifyInstance, POLLIN, 0 }
+        };
+
+        int result = ::poll(fds, 2, msUntilFlush(state));
+        if (result < 0 && errno != EINTR)
+        {
+            CPY_ASSERT_FMT(false, "File watcher failed polling: %d", errno);
+            active = false;
+            continue;
+        }
+
+        if ((fds[0].revents & POLLIN) != 0)
+        {
+            active = false;
+            continue;
+        }
+
+        if ((fds[1].revents & POLLIN) != 0)
+            readEvents(state, m_desc);
+#endif
+
+        flushPendingFiles(state);
     }
 }
 
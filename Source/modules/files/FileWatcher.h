@@ -19,6 +19,7 @@ public:
     virtual void start() override;
     virtual void stop() override;
     virtual void addDirectory(const char* directory) override;
+    virtual bool isWatched(const char* path) override;
     virtual void addListener(IFileWatchListener* listener) override;
     virtual void removeListener(IFileWatchListener* listener) override;
 
@@ -2,10 +2,14 @@
 #include <coalpy.core/Assert.h>
 #include <sstream>
 #include <cstring>
+#include <algorithm>
 #include <coalpy.core/ClTokenizer.h>
 
 #ifdef _WIN32 
 #define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
 #include <windows.h>
 #elif defined(__linux__)
 #include <stdio.h>
@@ -13,6 +17,7 @@
 #include <sys/stat.h>
 #include <linux/limits.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <dirent.h>
 #include <unistd.h>
 #include <errno.h>
@@ -27,18 +32,42 @@ namespace InternalFileSystem
     struct WindowsFile
     {
         HANDLE h;
-        unsigned int fileSize;
+        uint64_t fileSize;
+        uint64_t readEnd;
         OVERLAPPED overlapped;
+        HANDLE mapping;
+        const void* mappedView;
         char buffer[bufferSize];
     };
 
+    uint64_t getOffset(const OVERLAPPED& overlapped)
+    {
+        return ((uint64_t)overlapped.OffsetHigh << 32) | (uint64_t)overlapped.Offset;
+    }
+
+    //overlapped handles ignore the file pointer, the offset travels in the overlapped struct.
+    void setOffset(OVERLAPPED& overlapped, uint64_t offset)
+    {
+        overlapped.Offset = (DWORD)(offset & 0xffffffffull);
+        overlapped.OffsetHigh = (DWORD)(offset >> 32);
+    }
+
     bool valid(OpaqueFileHandle h)
     {
         return h != nullptr;
     }
 
-    OpaqueFileHandle openFile(const char* filename, RequestType request)
+    OpaqueFileHandle openFile(const char* filename, RequestType request, FileAccessHint access)
     {
+        //the cache manager reads further ahead of sequential scans, and not at all for random access.
+        DWORD accessFlag = 0;
+        if (request == RequestType::Read)
+            accessFlag = access == FileAccessHint::Random ? FILE_FLAG_RANDOM_ACCESS : FILE_FLAG_SEQUENTIAL_SCAN;
+
+        DWORD creation = OPEN_EXISTING;
+        if (request != RequestType::Read)
+            creation = request == RequestType::WriteNew ? CREATE_NEW : CREATE_ALWAYS;
+
         bool retry = true;
         UINT attempt = 0;
         HANDLE h = INVALID_HANDLE_VALUE;
@@ -49,8 +78,8 @@ namespace InternalFileSystem
                 request == RequestType::Read ? GENERIC_READ : GENERIC_WRITE, //dwDesiredAccess
                 request == RequestType::Read ? (FILE_SHARE_READ | FILE_SHARE_WRITE) : 0u, //dwShareMode
                 NULL, //lpSecurityAttributes
-                request == RequestType::Read ? OPEN_EXISTING : CREATE_ALWAYS,//dwCreationDisposition
-                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, //dwFlagsAndAttributes
+                creation,//dwCreationDisposition
+                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | accessFlag, //dwFlagsAndAttributes
                 NULL); //template attribute
 
             ++attempt;
@@ -68,8 +97,13 @@ namespace InternalFileSystem
 
         auto* wf = new WindowsFile;
         wf->h = h;
-        wf->fileSize = GetFileSize(wf->h, NULL);
+        LARGE_INTEGER fileSize = {};
+        GetFileSizeEx(wf->h, &fileSize);
+        wf->fileSize = (uint64_t)fileSize.QuadPart;
+        wf->readEnd = wf->fileSize;
         wf->overlapped = {};
+        wf->mapping = NULL;
+        wf->mappedView = nullptr;
         wf->overlapped.hEvent = CreateEvent(
             NULL, //default security attribute
             TRUE, //manual reset event
@@ -79,6 +113,31 @@ namespace InternalFileSystem
         return (OpaqueFileHandle)wf;
     }
 
+    bool prefetchFile(const char* filename)
+    {
+        HANDLE h = CreateFileA(
+            filename,
+            GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_WRITE,
+            NULL,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+            NULL);
+
+        if (h == INVALID_HANDLE_VALUE)
+            return false;
+
+        //there is no hint to load a file that is not mapped, reading it through leaves it in the file cache.
+        char buffer[64 * 1024];
+        DWORD bytesRead = 0;
+        while (ReadFile(h, buffer, (DWORD)sizeof(buffer), &bytesRead, NULL) && bytesRead > 0)
+        {
+        }
+
+        CloseHandle(h);
+        return true;
+    }
+
     bool readBytes(OpaqueFileHandle h, char*& outputBuffer, int& bytesRead, bool& isEof)
     {
         CPY_ASSERT(h != nullptr);
@@ -89,11 +148,20 @@ namespace InternalFileSystem
         auto* wf = (WindowsFile*)h;
         CPY_ASSERT(wf->h != INVALID_HANDLE_VALUE);
 
+        uint64_t offset = getOffset(wf->overlapped);
+        outputBuffer = wf->buffer;
+        if (offset >= wf->readEnd)
+        {
+            bytesRead = 0;
+            isEof = true;
+            return true;
+        }
+
         DWORD dwordBytesRead;
         bool result = ReadFile(
             wf->h,
             wf->buffer,
-            bufferSize,
+            (DWORD)std::min((uint64_t)bufferSize, wf->readEnd - offset),
             &dwordBytesRead,
             &wf->overlapped);
 
@@ -145,16 +213,60 @@ namespace InternalFileSystem
         }
 
         if (result)
-            wf->overlapped.Offset += dwordBytesRead;
-        if (wf->overlapped.Offset >= wf->fileSize)
+            setOffset(wf->overlapped, offset + dwordBytesRead);
+        if (getOffset(wf->overlapped) >= wf->readEnd)
             isEof = true;
 
         bytesRead = (int)dwordBytesRead;
-        outputBuffer = wf->buffer;
         return result;
     }
 
-    bool writeBytes(OpaqueFileHandle h, const char* buffer, int bufferSize)
+    void setReadRange(OpaqueFileHandle h, uint64_t offset, uint64_t length)
+    {
+        CPY_ASSERT(h != nullptr);
+        auto* wf = (WindowsFile*)h;
+        offset = std::min(offset, wf->fileSize);
+        wf->readEnd = length == 0 ? wf->fileSize : offset + std::min(length, wf->fileSize - offset);
+        setOffset(wf->overlapped, offset);
+    }
+
+    bool mapFile(OpaqueFileHandle h, const char*& outputBuffer, size_t& size)
+    {
+        CPY_ASSERT(h != nullptr);
+        outputBuffer = nullptr;
+        size = 0;
+        if (h == nullptr)
+            return false;
+
+        auto* wf = (WindowsFile*)h;
+        CPY_ASSERT(wf->h != INVALID_HANDLE_VALUE);
+        uint64_t offset = getOffset(wf->overlapped);
+        if (offset >= wf->readEnd)
+            return true;
+
+        HANDLE mapping = CreateFileMappingA(wf->h, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL)
+            return false;
+
+        //views start at a multiple of the allocation granularity, the range sits a bit further in.
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        uint64_t viewOffset = offset - offset % (uint64_t)systemInfo.dwAllocationGranularity;
+        const void* view = MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(viewOffset >> 32), (DWORD)(viewOffset & 0xffffffffull), (SIZE_T)(wf->readEnd - viewOffset));
+        if (view == nullptr)
+        {
+            CloseHandle(mapping);
+            return false;
+        }
+
+        wf->mapping = mapping;
+        wf->mappedView = view;
+        outputBuffer = (const char*)view + (offset - viewOffset);
+        size = (size_t)(wf->readEnd - offset);
+        return true;
+    }
+
+    bool writeBytes(OpaqueFileHandle h, const char* buffer, int bufferSize, uint64_t offset)
     {
         CPY_ASSERT(h != nullptr);
         if (h == nullptr)
@@ -163,6 +275,8 @@ namespace InternalFileSystem
         auto* wf = (WindowsFile*)h;
         CPY_ASSERT(wf->h != INVALID_HANDLE_VALUE);
 
+        setOffset(wf->overlapped, offset);
+
         DWORD dwordBytesWritten;
         bool result = WriteFile(
             wf->h,
@@ -211,6 +325,10 @@ namespace InternalFileSystem
         CPY_ASSERT(h != nullptr);
         auto* wf = (WindowsFile*)h;
         CPY_ASSERT(wf->h != INVALID_HANDLE_VALUE);
+        if (wf->mappedView != nullptr)
+            UnmapViewOfFile(wf->mappedView);
+        if (wf->mapping != NULL)
+            CloseHandle(wf->mapping);
         CloseHandle(wf->h);
         CloseHandle(wf->overlapped.hEvent);
         h = {};
@@ -263,6 +381,11 @@ namespace InternalFileSystem
         return DeleteFile(str);
     }
 
+    bool renameFile(const char* from, const char* to)
+    {
+        return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+    }
+
     void getFileName(const std::string& path, std::string& outName)
     {
         int index = path.size() - 1;
@@ -299,6 +422,20 @@ namespace InternalFileSystem
         return;
     }
 
+    bool getFileStamp(const std::string& fileName, uint64_t& size, uint64_t& modifiedTime)
+    {
+        WIN32_FILE_ATTRIBUTE_DATA data = {};
+        if (!GetFileAttributesExA(fileName.c_str(), GetFileExInfoStandard, &data))
+            return false;
+
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            return false;
+
+        size = ((uint64_t)data.nFileSizeHigh << 32) | (uint64_t)data.nFileSizeLow;
+        modifiedTime = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | (uint64_t)data.ftLastWriteTime.dwLowDateTime;
+        return true;
+    }
+
     bool carvePath(const std::string& path, bool lastIsFile)
     {
         bool exists, isDir, isDots;
@@ -348,6 +485,44 @@ namespace InternalFileSystem
         FindClose(hFind);
     }
 
+    bool listDirectory(
+        const std::string& path,
+        const std::function<bool(const char* name, bool isDir)>& keep,
+        std::vector<std::string>& subDirs,
+        std::vector<FileEntry>& entries)
+    {
+        //the basic info level skips short names, and large fetches get more entries per call.
+        WIN32_FIND_DATAA data = {};
+        std::string query = path + "\\*";
+        HANDLE hFind = FindFirstFileExA(query.c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+        if (hFind == INVALID_HANDLE_VALUE)
+            return false;
+
+        do {
+            if (strcmp(data.cFileName, ".") == 0 || strcmp(data.cFileName, "..") == 0)
+                continue;
+
+            bool isDir = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+            bool isLink = (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+            std::string fullPath = path + "\\" + data.cFileName;
+            if (isDir && !isLink)
+                subDirs.push_back(fullPath);
+
+            if (!keep(data.cFileName, isDir))
+                continue;
+
+            //the listing carries the attributes already, no stat needed.
+            FileEntry entry;
+            entry.path = std::move(fullPath);
+            entry.isDir = isDir;
+            entry.size = isDir ? 0ull : (((uint64_t)data.nFileSizeHigh << 32) | (uint64_t)data.nFileSizeLow);
+            entry.modifiedTime = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | (uint64_t)data.ftLastWriteTime.dwLowDateTime;
+            entries.push_back(std::move(entry));
+        } while (FindNextFileA(hFind, &data));
+        FindClose(hFind);
+        return true;
+    }
+
     void getAbsolutePath(const std::string& path, std::string& outDir)
     {
         const int DestBufferSize = 1024;
@@ -373,8 +548,12 @@ namespace InternalFileSystem
     struct PosixFile 
     {
         int h;
-        unsigned int fileSize;
-        ssize_t offset;
+        uint64_t fileSize;
+        uint64_t offset;
+        uint64_t readEnd;
+        void* mappedView = nullptr;
+        size_t mappedSize = 0;
+        FileAccessHint access = FileAccessHint::Sequential;
         char buffer[bufferSize];
     };
 
@@ -383,9 +562,13 @@ namespace InternalFileSystem
         return (PosixFile*)h != nullptr;
     }
 
-    OpaqueFileHandle openFile(const char* filename, RequestType request)
+    OpaqueFileHandle openFile(const char* filename, RequestType request, FileAccessHint access)
     {
-        int fd = ::open(filename, request == InternalFileSystem::Read ? O_RDONLY : (O_CREAT | O_TRUNC | O_WRONLY ), S_IRUSR | S_IWUSR);
+        int flags = O_RDONLY;
+        if (request != InternalFileSystem::Read)
+            flags = request == InternalFileSystem::WriteNew ? (O_CREAT | O_EXCL | O_WRONLY) : (O_CREAT | O_TRUNC | O_WRONLY);
+
+        int fd = ::open(filename, flags, S_IRUSR | S_IWUSR);
 
         if (fd == -1)
             return nullptr;
@@ -397,35 +580,118 @@ namespace InternalFileSystem
             ::close(fd);
             return nullptr;
         }
-        auto* pf = new PosixFile { fd, (unsigned)statbuf.st_size, 0u };
+        auto* pf = new PosixFile { fd, (uint64_t)statbuf.st_size, 0u, (uint64_t)statbuf.st_size };
+        if (request == InternalFileSystem::Read)
+        {
+            //sequential doubles the read ahead window, random turns it off.
+            pf->access = access;
+            posix_fadvise(fd, 0, 0, access == FileAccessHint::Random ? POSIX_FADV_RANDOM : POSIX_FADV_SEQUENTIAL);
+        }
         return (OpaqueFileHandle)pf;
     }
 
+    bool prefetchFile(const char* filename)
+    {
+        int fd = ::open(filename, O_RDONLY);
+        if (fd == -1)
+            return false;
+
+        //queues the reads and returns, pages land in the page cache in the background.
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        ::close(fd);
+        return true;
+    }
+
     bool readBytes(OpaqueFileHandle h, char*& outputBuffer, int& bytesRead, bool& isEof)
     {
         auto* pf = (PosixFile*)h;
         if (pf == nullptr || pf->h == -1)
             return false;
 
-        ssize_t preadBytes = pread(pf->h, pf->buffer, std::min((ssize_t)bufferSize, pf->fileSize - pf->offset), pf->offset);
+        size_t bytesToRead = (size_t)std::min((uint64_t)bufferSize, pf->readEnd > pf->offset ? pf->readEnd - pf->offset : (uint64_t)0);
+        ssize_t preadBytes = pread(pf->h, pf->buffer, bytesToRead, (off_t)pf->offset);
         if (preadBytes == -1)
             return false;
 
-        pf->offset += preadBytes;
-        bytesRead = preadBytes;
+        //0 bytes before the end means the file got shorter than it was when we opened it.
+        if (preadBytes == 0 && bytesToRead > 0)
+            return false;
+
+        pf->offset += (uint64_t)preadBytes;
+        bytesRead = (int)preadBytes;
         outputBuffer = pf->buffer;
-        isEof = pf->offset >= pf->fileSize;
+        isEof = pf->offset >= pf->readEnd;
         return true;
     }
 
-    bool writeBytes(OpaqueFileHandle h, const char* buffer, int bufferSize)
+    void setReadRange(OpaqueFileHandle h, uint64_t offset, uint64_t length)
     {
         auto* pf = (PosixFile*)h;
+        if (pf == nullptr)
+            return;
+
+        pf->offset = std::min(offset, pf->fileSize);
+        pf->readEnd = length == 0 ? pf->fileSize : pf->offset + std::min(length, pf->fileSize - pf->offset);
+    }
+
+    bool mapFile(OpaqueFileHandle h, const char*& outputBuffer, size_t& size)
+    {
+        auto* pf = (PosixFile*)h;
+        outputBuffer = nullptr;
+        size = 0;
         if (pf == nullptr || pf->h == -1)
             return false;
-        
-        ssize_t pwriteBytes = pwrite(pf->h, buffer, (size_t)bufferSize, 0u);
-        return pwriteBytes != -1;
+
+        if (pf->offset >= pf->readEnd)
+            return true;
+
+        //views start on a page, the range sits a bit further in.
+        uint64_t pageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+        uint64_t viewOffset = pf->offset - pf->offset % pageSize;
+        size_t viewSize = (size_t)(pf->readEnd - viewOffset);
+        void* view = mmap(nullptr, viewSize, PROT_READ, MAP_PRIVATE, pf->h, (off_t)viewOffset);
+        if (view == MAP_FAILED)
+            return false;
+
+        //consumers walking the file front to back get aggressive read ahead, and pages start coming in right away.
+        //Random access only faults in what gets touched.
+        if (pf->access == FileAccessHint::Random)
+        {
+            madvise(view, viewSize, MADV_RANDOM);
+        }
+        else
+        {
+            madvise(view, viewSize, MADV_SEQUENTIAL);
+            madvise(view, viewSize, MADV_WILLNEED);
+        }
+
+        pf->mappedView = view;
+        pf->mappedSize = viewSize;
+        outputBuffer = (const char*)view + (pf->offset - viewOffset);
+        size = (size_t)(pf->readEnd - pf->offset);
+        return true;
+    }
+
+    bool writeBytes(OpaqueFileHandle h, const char* buffer, int bufferSize, uint64_t offset)
+    {
+        auto* pf = (PosixFile*)h;
+        if (pf == nullptr || pf->h == -1)
+            return false;
+
+        //pwrite can stop short, carry on from where it did.
+        size_t written = 0;
+        while (written < (size_t)bufferSize)
+        {
+            ssize_t pwriteBytes = pwrite(pf->h, buffer + written, (size_t)bufferSize - written, (off_t)(offset + written));
+            if (pwriteBytes == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            written += (size_t)pwriteBytes;
+        }
+        return true;
     }
 
     void close(OpaqueFileHandle& h)
@@ -434,6 +700,8 @@ namespace InternalFileSystem
         if (pf == nullptr)
             return;
 
+        if (pf->mappedView != nullptr)
+            munmap(pf->mappedView, pf->mappedSize);
         ::close(pf->h);
         delete pf;
         h = {};
@@ -494,6 +762,11 @@ namespace InternalFileSystem
         return unlink(str) == 0;
     }
 
+    bool renameFile(const char* from, const char* to)
+    {
+        return rename(from, to) == 0;
+    }
+
     void getAttributes(const std::string& dirName_in, bool& exists, bool& isDir, bool& isDots)
     {
         struct stat statbuf;
@@ -516,6 +789,17 @@ namespace InternalFileSystem
         }
     }
 
+    bool getFileStamp(const std::string& fileName, uint64_t& size, uint64_t& modifiedTime)
+    {
+        struct stat statbuf;
+        if (stat(fileName.c_str(), &statbuf) < 0 || S_ISDIR(statbuf.st_mode))
+            return false;
+
+        size = (uint64_t)statbuf.st_size;
+        modifiedTime = (uint64_t)statbuf.st_mtim.tv_sec * 1000000000ull + (uint64_t)statbuf.st_mtim.tv_nsec;
+        return true;
+    }
+
     bool carvePath(const std::string& path, bool lastIsFile)
     {
         bool exists, isDir, isDots;
@@ -567,11 +851,7 @@ namespace InternalFileSystem
             return;
         }
 
-        // the length of the path
-        size_t path_len = path.size();
-        char *full_path;
         struct dirent *entry;
-        struct stat stat_entry;
 
         // iteration through entries in the directory
         while ((entry = readdir(dir)) != nullptr)
@@ -581,17 +861,69 @@ namespace InternalFileSystem
                 continue;
 
             // determinate a full path of an entry
-            full_path = (char*)calloc(path_len + strlen(entry->d_name) + 1, sizeof(char));
-            strcpy(full_path, path.c_str());
-            strcat(full_path, "/");
-            strcat(full_path, entry->d_name);
-            files.push_back(full_path);
-            free(full_path);
+            files.push_back(path + "/" + entry->d_name);
         }
 
         closedir(dir);
     }
 
+    bool listDirectory(
+        const std::string& path,
+        const std::function<bool(const char* name, bool isDir)>& keep,
+        std::vector<std::string>& subDirs,
+        std::vector<FileEntry>& entries)
+    {
+        DIR* dir = opendir(path.c_str());
+        if (dir == nullptr)
+            return false;
+
+        //entries get looked up relative to the directory, instead of walking the whole path again.
+        int dirFd = dirfd(dir);
+        while (struct dirent* dirEntry = readdir(dir))
+        {
+            if (strcmp(dirEntry->d_name, ".") == 0 || strcmp(dirEntry->d_name, "..") == 0)
+                continue;
+
+            //links, and file systems not filling d_type, need a stat to tell their type.
+            struct stat statbuf;
+            bool hasStat = false;
+            bool isLink = dirEntry->d_type == DT_LNK;
+            bool isDir = dirEntry->d_type == DT_DIR;
+            if (dirEntry->d_type == DT_UNKNOWN || isLink)
+            {
+                hasStat = fstatat(dirFd, dirEntry->d_name, &statbuf, 0) == 0;
+                if (!hasStat)
+                    continue;
+                isDir = S_ISDIR(statbuf.st_mode);
+                if (dirEntry->d_type == DT_UNKNOWN)
+                {
+                    struct stat linkbuf;
+                    isLink = fstatat(dirFd, dirEntry->d_name, &linkbuf, AT_SYMLINK_NOFOLLOW) == 0 && S_ISLNK(linkbuf.st_mode);
+                }
+            }
+
+            std::string fullPath = path + "/" + dirEntry->d_name;
+            if (isDir && !isLink)
+                subDirs.push_back(fullPath);
+
+            if (!keep(dirEntry->d_name, isDir))
+                continue;
+
+            if (!hasStat && fstatat(dirFd, dirEntry->d_name, &statbuf, 0) != 0)
+                continue;
+
+            FileEntry entry;
+            entry.path = std::move(fullPath);
+            entry.isDir = isDir;
+            entry.size = isDir ? 0ull : (uint64_t)statbuf.st_size;
+            entry.modifiedTime = (uint64_t)statbuf.st_mtim.tv_sec * 1000000000ull + (uint64_t)statbuf.st_mtim.tv_nsec;
+            entries.push_back(std::move(entry));
+        }
+
+        closedir(dir);
+        return true;
+    }
+
     void getAbsolutePath(const std::string& path, std::string& outDir)
     {
         char resolvedPath[PATH_MAX] = {};
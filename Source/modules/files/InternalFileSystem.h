@@ -3,6 +3,7 @@
 #include <coalpy.files/FileDefs.h>
 #include <string>
 #include <vector>
+#include <functional>
 
 namespace coalpy
 {
@@ -17,7 +18,8 @@ namespace InternalFileSystem
     enum RequestType
     {
         Read,
-        Write
+        Write,
+        WriteNew //like Write, but fails if the file already exists
     };
 
     typedef void* OpaqueFileHandle;
@@ -32,11 +34,25 @@ namespace InternalFileSystem
 
     bool valid(OpaqueFileHandle h);
 
-    OpaqueFileHandle openFile(const char* filename, RequestType request);
+    //access only matters to reads.
+    OpaqueFileHandle openFile(const char* filename, RequestType request, FileAccessHint access = FileAccessHint::Sequential);
+
+    //starts bringing a file into the os page cache without handing its contents to anyone.
+    //False if it cannot be opened.
+    bool prefetchFile(const char* filename);
 
     bool readBytes(OpaqueFileHandle h, char*& outputBuffer, int& bytesRead, bool& isEof);
 
-    bool writeBytes(OpaqueFileHandle h, const char* buffer, int bufferSize);
+    //readBytes and mapFile only see length bytes from offset (0 reads to the end), clamped to the file.
+    //Must be set before the first read.
+    void setReadRange(OpaqueFileHandle h, uint64_t offset, uint64_t length);
+
+    //maps the read range (the whole file by default) read only, the view stays valid until the file is closed.
+    //Empty ranges map to null.
+    bool mapFile(OpaqueFileHandle h, const char*& outputBuffer, size_t& size);
+
+    //writes all of buffer at offset, independently of any other write on the file.
+    bool writeBytes(OpaqueFileHandle h, const char* buffer, int bufferSize, uint64_t offset);
 
     void close(OpaqueFileHandle& h);
 
@@ -52,11 +68,25 @@ namespace InternalFileSystem
 
     bool deleteFile(const char* str);
 
+    //replaces to if it exists, in one step.
+    bool renameFile(const char* from, const char* to);
+
     void getAttributes(const std::string& dirName_in, bool& exists, bool& isDir, bool& isDots);
 
+    //size and last write time of a file, false if it does not exist or is a directory.
+    bool getFileStamp(const std::string& fileName, uint64_t& size, uint64_t& modifiedTime);
+
     bool carvePath(const std::string& path, bool lastIsFile = true);
 
     void enumerateFiles(const std::string& path, std::vector<std::string>& files);
+
+    //one level of path: every subdirectory (symlinked ones excluded), and the entries keep accepts with their
+    //size and time. Types come from the listing itself, only the accepted entries cost a stat.
+    bool listDirectory(
+        const std::string& path,
+        const std::function<bool(const char* name, bool isDir)>& keep,
+        std::vector<std::string>& subDirs,
+        std::vector<FileEntry>& entries);
 }
 
 }
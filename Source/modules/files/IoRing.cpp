@@ -0,0 +1,445 @@
+#include "IoRing.h"
+#include <coalpy.core/Assert.h>
+#include <coalpy.tasks/ITaskSystem.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+namespace coalpy
+{
+
+#ifdef __linux__
+
+namespace InternalIoRing
+{
+
+//no liburing: the three syscalls and the ring layout are all there is to it.
+int setup(unsigned entries, io_uring_params* params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+int enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+int registerOp(int fd, unsigned opcode, void* arg, unsigned argCount)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, argCount);
+}
+
+//every chunk of a transfer is its own operation, in flight at the same time as the others.
+enum { ChunkSize = 1024 * 1024 };
+
+}
+
+struct IoRingState
+{
+    int fd = -1;
+
+    void* sqRing = nullptr;
+    size_t sqRingSize = 0;
+    void* cqRing = nullptr;
+    size_t cqRingSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    unsigned cqMask = 0;
+
+    //ops reach the reaper through the kernel, which race checkers cannot see through: this counter carries the
+    //ordering between what a submitter wrote in its ops and the reaper reading them back.
+    std::atomic<uint64_t> submitted = 0;
+
+    ~IoRingState()
+    {
+        if (sqes != nullptr)
+            munmap(sqes, sqesSize);
+        if (cqRing != nullptr && cqRing != sqRing)
+            munmap(cqRing, cqRingSize);
+        if (sqRing != nullptr)
+            munmap(sqRing, sqRingSize);
+        if (fd != -1)
+            ::close(fd);
+    }
+};
+
+//the ops of one suspension: whoever completes the last one resumes the task.
+struct IoRing::Batch
+{
+    std::atomic<int> pending = 0;
+    TaskResumeFn resume;
+};
+
+struct IoRing::Op
+{
+    unsigned char opcode = IORING_OP_NOP;
+    int fd = -1;
+    uint64_t addr = 0;
+    uint32_t len = 0;
+    uint64_t off = 0;
+    uint32_t flags = 0;
+    int result = 0;
+    Batch* batch = nullptr;
+};
+
+IoRing* IoRing::create(unsigned entries)
+{
+    IoRing* ring = new IoRing();
+    if (!ring->init(entries))
+    {
+        delete ring;
+        return nullptr;
+    }
+
+    ring->m_reaper = std::thread([ring]() { ring->reaperLoop(); });
+    return ring;
+}
+
+bool IoRing::init(unsigned entries)
+{
+    m_state = new IoRingState();
+    IoRingState& s = *m_state;
+
+    io_uring_params params = {};
+    s.fd = InternalIoRing::setup(entries, &params);
+    if (s.fd < 0)
+        return false;
+
+    //without NODROP completions can be lost when the queue overflows, and a task would never resume.
+    if ((params.features & IORING_FEAT_NODROP) == 0)
+        return false;
+
+    {
+        enum { ProbeOps = 256 };
+        std::vector<char> probeStorage(sizeof(io_uring_probe) + ProbeOps * sizeof(io_uring_probe_op), 0);
+        auto* probe = (io_uring_probe*)probeStorage.data();
+        if (InternalIoRing::registerOp(s.fd, IORING_REGISTER_PROBE, probe, ProbeOps) < 0)
+            return false;
+
+        for (unsigned op : { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_WRITE })
+        {
+            if (op > probe->last_op || (probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0)
+                return false;
+        }
+    }
+
+    s.sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    s.cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMmap)
+        s.sqRingSize = s.cqRingSize = std::max(s.sqRingSize, s.cqRingSize);
+
+    void* sqRing = mmap(nullptr, s.sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s.fd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED)
+        return false;
+    s.sqRing = sqRing;
+
+    if (singleMmap)
+    {
+        s.cqRing = sqRing;
+    }
+    else
+    {
+        void* cqRing = mmap(nullptr, s.cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s.fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED)
+            return false;
+        s.cqRing = cqRing;
+    }
+
+    s.sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, s.sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s.fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        return false;
+    s.sqes = (io_uring_sqe*)sqes;
+
+    char* sq = (char*)s.sqRing;
+    s.sqHead = (unsigned*)(sq + params.sq_off.head);
+    s.sqTail = (unsigned*)(sq + params.sq_off.tail);
+    s.sqArray = (unsigned*)(sq + params.sq_off.array);
+    s.sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    s.sqEntries = params.sq_entries;
+
+    char* cq = (char*)s.cqRing;
+    s.cqHead = (unsigned*)(cq + params.cq_off.head);
+    s.cqTail = (unsigned*)(cq + params.cq_off.tail);
+    s.cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    s.cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    return true;
+}
+
+IoRing::~IoRing()
+{
+    if (m_reaper.joinable())
+    {
+        //a nop with no op attached tells the reaper to leave.
+        Op exitOp;
+        submit(&exitOp, 1);
+        m_reaper.join();
+    }
+    delete m_state;
+}
+
+void IoRing::submit(Op* ops, int count)
+{
+    IoRingState& s = *m_state;
+    s.submitted.fetch_add((uint64_t)count, std::memory_order_release);
+
+    std::unique_lock lock(m_submitMutex);
+    unsigned toSubmit = 0;
+    auto flush = [&s, &toSubmit]()
+    {
+        while (toSubmit > 0)
+        {
+            int submitted = InternalIoRing::enter(s.fd, toSubmit, 0, 0);
+            if (submitted < 0)
+            {
+                //EBUSY / EAGAIN: the completion side is backed up, give the reaper a chance to drain it.
+                CPY_ASSERT_FMT(errno == EINTR || errno == EAGAIN || errno == EBUSY, "io_uring_enter failed submitting: %s", strerror(errno));
+                std::this_thread::yield();
+                continue;
+            }
+            toSubmit -= (unsigned)std::min((unsigned)submitted, toSubmit);
+        }
+    };
+
+    for (int i = 0; i < count; ++i)
+    {
+        //only submitters write the tail, and they hold the lock.
+        unsigned tail = *s.sqTail;
+        if (tail - __atomic_load_n(s.sqHead, __ATOMIC_ACQUIRE) == s.sqEntries)
+        {
+            flush();
+            --i;
+            continue;
+        }
+
+        const Op& op = ops[i];
+        unsigned index = tail & s.sqMask;
+        io_uring_sqe& sqe = s.sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = op.opcode;
+        sqe.fd = op.fd;
+        sqe.addr = op.addr;
+        sqe.len = op.len;
+        sqe.off = op.off;
+        if (op.opcode == IORING_OP_STATX)
+            sqe.statx_flags = op.flags;
+        else
+            sqe.open_flags = op.flags;
+        sqe.user_data = (uint64_t)(uintptr_t)(op.batch != nullptr ? &op : nullptr);
+        s.sqArray[index] = index;
+        __atomic_store_n(s.sqTail, tail + 1, __ATOMIC_RELEASE);
+        ++toSubmit;
+    }
+
+    flush();
+}
+
+void IoRing::submitAndWait(Op* ops, int count)
+{
+    if (count == 0)
+        return;
+
+    Batch batch;
+    batch.pending.store(count, std::memory_order_relaxed);
+    for (int i = 0; i < count; ++i)
+        ops[i].batch = &batch;
+
+    //the resume is in place before anything is submitted, the reaper can run it right away.
+    TaskUtil::suspendUntil([this, ops, count, &batch](TaskResumeFn resume)
+    {
+        batch.resume = std::move(resume);
+        submit(ops, count);
+    });
+}
+
+void IoRing::reaperLoop()
+{
+    IoRingState& s = *m_state;
+    bool exitRequested = false;
+    while (!exitRequested)
+    {
+        //only this thread moves the head.
+        unsigned head = *s.cqHead;
+        unsigned tail = __atomic_load_n(s.cqTail, __ATOMIC_ACQUIRE);
+        if (head == tail)
+        {
+            InternalIoRing::enter(s.fd, 0, 1, IORING_ENTER_GETEVENTS);
+            continue;
+        }
+
+        s.submitted.load(std::memory_order_acquire);
+
+        for (; head != tail; ++head)
+        {
+            const io_uring_cqe& cqe = s.cqes[head & s.cqMask];
+            auto* op = (Op*)(uintptr_t)cqe.user_data;
+            if (op == nullptr)
+            {
+                exitRequested = true;
+                continue;
+            }
+
+            op->result = cqe.res;
+            Batch* batch = op->batch;
+            if (batch->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                //the task owns the batch again once resumed: move the resume out before calling it.
+                TaskResumeFn resume = std::move(batch->resume);
+                resume();
+            }
+        }
+        __atomic_store_n(s.cqHead, head, __ATOMIC_RELEASE);
+    }
+}
+
+int IoRing::open(const char* path, bool write, bool exclusive)
+{
+    Op op;
+    op.opcode = IORING_OP_OPENAT;
+    op.fd = AT_FDCWD;
+    op.addr = (uint64_t)(uintptr_t)path;
+    op.len = S_IRUSR | S_IWUSR;
+    op.flags = (write ? (O_CREAT | O_WRONLY | (exclusive ? O_EXCL : O_TRUNC)) : O_RDONLY) | O_CLOEXEC;
+    submitAndWait(&op, 1);
+    return op.result;
+}
+
+bool IoRing::fileInfo(int fd, uint64_t& size, bool& isDir)
+{
+    struct statx info = {};
+    Op op;
+    op.opcode = IORING_OP_STATX;
+    op.fd = fd;
+    op.addr = (uint64_t)(uintptr_t)"";
+    op.len = STATX_TYPE | STATX_SIZE;
+    op.off = (uint64_t)(uintptr_t)&info;
+    op.flags = AT_EMPTY_PATH;
+    submitAndWait(&op, 1);
+    if (op.result < 0)
+        return false;
+
+    size = info.stx_size;
+    isDir = S_ISDIR(info.stx_mode);
+    return true;
+}
+
+bool IoRing::transfer(int fd, char* buffer, size_t size, uint64_t fileOffset, bool write)
+{
+    struct Range
+    {
+        size_t offset;
+        size_t size;
+    };
+
+    std::vector<Range> ranges;
+    for (size_t offset = 0; offset < size; offset += InternalIoRing::ChunkSize)
+        ranges.push_back(Range { offset, std::min(size - offset, (size_t)InternalIoRing::ChunkSize) });
+
+    std::vector<Op> ops;
+    while (!ranges.empty())
+    {
+        ops.clear();
+        for (const Range& range : ranges)
+        {
+            Op op;
+            op.opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+            op.fd = fd;
+            op.addr = (uint64_t)(uintptr_t)(buffer + range.offset);
+            op.len = (uint32_t)range.size;
+            op.off = fileOffset + range.offset;
+            ops.push_back(op);
+        }
+
+        submitAndWait(ops.data(), (int)ops.size());
+
+        //short transfers go around again for what is left of their range.
+        std::vector<Range> remaining;
+        for (int i = 0; i < (int)ops.size(); ++i)
+        {
+            int result = ops[i].result;
+            if (result == -EINTR || result == -EAGAIN)
+            {
+                remaining.push_back(ranges[i]);
+                continue;
+            }
+
+            //0 bytes read means the file got shorter than it was when we looked at it.
+            if (result <= 0)
+                return false;
+
+            if ((size_t)result < ranges[i].size)
+                remaining.push_back(Range { ranges[i].offset + result, ranges[i].size - result });
+        }
+        ranges.swap(remaining);
+    }
+
+    return true;
+}
+
+bool IoRing::read(int fd, char* buffer, size_t size, uint64_t offset)
+{
+    return transfer(fd, buffer, size, offset, false);
+}
+
+bool IoRing::write(int fd, const char* buffer, size_t size, uint64_t offset)
+{
+    return transfer(fd, const_cast<char*>(buffer), size, offset, true);
+}
+
+void IoRing::close(int fd)
+{
+    if (fd >= 0)
+        ::close(fd);
+}
+
+#else
+
+struct IoRingState {};
+struct IoRing::Op {};
+
+IoRing* IoRing::create(unsigned entries)
+{
+    return nullptr;
+}
+
+IoRing::~IoRing()
+{
+    delete m_state;
+}
+
+bool IoRing::init(unsigned entries) { return false; }
+void IoRing::submitAndWait(Op* ops, int count) {}
+void IoRing::submit(Op* ops, int count) {}
+bool IoRing::transfer(int fd, char* buffer, size_t size, uint64_t fileOffset, bool write) { return false; }
+void IoRing::reaperLoop() {}
+int IoRing::open(const char* path, bool write, bool exclusive) { return -1; }
+bool IoRing::fileInfo(int fd, uint64_t& size, bool& isDir) { return false; }
+bool IoRing::read(int fd, char* buffer, size_t size, uint64_t offset) { return false; }
+bool IoRing::write(int fd, const char* buffer, size_t size, uint64_t offset) { return false; }
+void IoRing::close(int fd) {}
+
+#endif
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+#include <thread>
+
+namespace coalpy
+{
+
+struct IoRingState;
+
+//Asynchronous file io through linux io_uring. Operations are submitted to the kernel and the calling task
+//suspends (TaskUtil::suspendUntil) until they complete, so a few io workers keep many requests in flight.
+//A single reaper thread collects the completions and resumes the tasks.
+//Every operation must be called from within a task.
+class IoRing
+{
+public:
+    //returns null when the kernel (or the platform) cannot run the operations needed, use the posix path then.
+    static IoRing* create(unsigned entries = 256);
+    ~IoRing();
+
+    //returns the file descriptor, or -errno. An exclusive write fails with -EEXIST if the file is there already.
+    int open(const char* path, bool write, bool exclusive = false);
+
+    bool fileInfo(int fd, uint64_t& size, bool& isDir);
+
+    //reads / writes exactly size bytes at offset in the file, chunks are all submitted at once.
+    bool read(int fd, char* buffer, size_t size, uint64_t offset = 0);
+    bool write(int fd, const char* buffer, size_t size, uint64_t offset = 0);
+
+    //closing is cheap, it is not worth a round trip through the ring.
+    static void close(int fd);
+
+private:
+    struct Op;
+    struct Batch;
+
+    IoRing() {}
+    bool init(unsigned entries);
+    void submitAndWait(Op* ops, int count);
+    void submit(Op* ops, int count);
+    bool transfer(int fd, char* buffer, size_t size, uint64_t fileOffset, bool write);
+    void reaperLoop();
+
+    IoRingState* m_state = nullptr;
+    std::mutex m_submitMutex;
+    std::thread m_reaper;
+};
+
+}
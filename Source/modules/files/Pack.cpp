@@ -0,0 +1,146 @@
+#include "Pack.h"
+#include <coalpy.tasks/ITaskSystem.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+#include <zlib.h>
+
+namespace coalpy
+{
+
+Pack* Pack::open(const char* filePath)
+{
+    auto* pack = new Pack();
+    pack->m_filePath = filePath;
+
+    //lookups and reads land all over the file, read ahead would only bring in what nobody asked for.
+    pack->m_file = InternalFileSystem::openFile(filePath, InternalFileSystem::RequestType::Read, FileAccessHint::Random);
+    bool success = InternalFileSystem::valid(pack->m_file)
+        && InternalFileSystem::mapFile(pack->m_file, pack->m_view, pack->m_size)
+        && pack->validate();
+
+    if (!success)
+    {
+        delete pack;
+        return nullptr;
+    }
+
+    return pack;
+}
+
+Pack::~Pack()
+{
+    if (InternalFileSystem::valid(m_file))
+        InternalFileSystem::close(m_file);
+}
+
+bool Pack::validate()
+{
+    if (m_size < sizeof(PackFormat::Header))
+        return false;
+
+    auto* header = (const PackFormat::Header*)m_view;
+    if (header->magic != PackFormat::Magic || header->version != PackFormat::Version)
+        return false;
+
+    if (header->alignment == 0 || (header->alignment & (header->alignment - 1)) != 0)
+        return false;
+
+    uint64_t entriesEnd = sizeof(PackFormat::Header) + (uint64_t)header->entryCount * sizeof(PackFormat::Entry);
+    if (entriesEnd > m_size || header->pathsOffset < entriesEnd || header->pathsOffset > m_size || header->pathsSize > m_size - header->pathsOffset)
+        return false;
+
+    //entries are only trusted once, here, lookups and reads do not check bounds again.
+    auto* entries = (const PackFormat::Entry*)(m_view + sizeof(PackFormat::Header));
+    for (uint32_t i = 0; i < header->entryCount; ++i)
+    {
+        const PackFormat::Entry& entry = entries[i];
+        if (i > 0 && entries[i - 1].pathHash > entry.pathHash)
+            return false;
+
+        if (entry.pathOffset > header->pathsSize || entry.pathSize > header->pathsSize - entry.pathOffset)
+            return false;
+
+        if (entry.dataOffset > m_size || entry.storedSize > m_size - entry.dataOffset)
+            return false;
+
+        bool compressed = (entry.flags & PackFormat::Compressed) != 0;
+        if (!compressed && entry.storedSize != entry.size)
+            return false;
+
+        if (compressed && entry.storedSize < (uint64_t)PackFormat::blockCount(entry.size) * sizeof(uint32_t))
+            return false;
+    }
+
+    m_header = header;
+    m_entries = entries;
+    m_paths = m_view + header->pathsOffset;
+    return true;
+}
+
+const PackFormat::Entry* Pack::find(const std::string& path) const
+{
+    uint64_t hash = PackFormat::hashPath(path.data(), path.size());
+    const PackFormat::Entry* end = m_entries + m_header->entryCount;
+    const PackFormat::Entry* it = std::lower_bound(m_entries, end, hash,
+        [](const PackFormat::Entry& entry, uint64_t hash) { return entry.pathHash < hash; });
+
+    for (; it != end && it->pathHash == hash; ++it)
+    {
+        if (it->pathSize == (uint32_t)path.size() && memcmp(m_paths + it->pathOffset, path.data(), path.size()) == 0)
+            return it;
+    }
+
+    return nullptr;
+}
+
+bool Pack::inflate(ITaskSystem& ts, const PackFormat::Entry& entry, uint64_t offset, uint64_t length, ByteBuffer& output, uint64_t& outputOffset) const
+{
+    //where each block starts, the table is not necessarily aligned for direct reads.
+    uint32_t blockCount = PackFormat::blockCount(entry.size);
+    const char* data = m_view + entry.dataOffset;
+    std::vector<uint64_t> blockOffsets(blockCount + 1);
+    blockOffsets[0] = (uint64_t)blockCount * sizeof(uint32_t);
+    for (uint32_t i = 0; i < blockCount; ++i)
+    {
+        uint32_t blockSize = 0;
+        memcpy(&blockSize, data + i * sizeof(uint32_t), sizeof(uint32_t));
+        blockOffsets[i + 1] = blockOffsets[i] + blockSize;
+    }
+
+    if (blockOffsets[blockCount] != entry.storedSize)
+        return false;
+
+    outputOffset = 0;
+    output.resize(0);
+    if (offset >= entry.size || length == 0)
+        return true;
+
+    length = std::min(length, entry.size - offset);
+    int firstBlock = (int)(offset / PackFormat::BlockSize);
+    int lastBlock = (int)((offset + length - 1) / PackFormat::BlockSize);
+    outputOffset = (uint64_t)firstBlock * PackFormat::BlockSize;
+    output.resize((size_t)(std::min(entry.size, (uint64_t)(lastBlock + 1) * PackFormat::BlockSize) - outputOffset));
+
+    std::atomic<bool> success = true;
+    ts.parallelFor(firstBlock, lastBlock + 1, 1, [&](int begin, int end)
+    {
+        for (int block = begin; block < end; ++block)
+        {
+            uint64_t blockStart = (uint64_t)block * PackFormat::BlockSize;
+            uLongf expectedSize = (uLongf)std::min((uint64_t)PackFormat::BlockSize, entry.size - blockStart);
+            uLongf inflatedSize = expectedSize;
+            int result = uncompress(
+                (Bytef*)output.data() + (blockStart - outputOffset), &inflatedSize,
+                (const Bytef*)data + blockOffsets[block], (uLong)(blockOffsets[block + 1] - blockOffsets[block]));
+
+            if (result != Z_OK || inflatedSize != expectedSize)
+                success = false;
+        }
+    });
+
+    return success;
+}
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "PackFormat.h"
+#include "InternalFileSystem.h"
+#include <coalpy.core/ByteBuffer.h>
+#include <string>
+
+namespace coalpy
+{
+
+class ITaskSystem;
+
+//A pack opened for reading: the whole file is mapped once, entries are found by a binary search over
+//their path hashes. Immutable, so any number of readers can share it.
+class Pack
+{
+public:
+    //null if the file cannot be mapped or is not a valid pack.
+    static Pack* open(const char* filePath);
+    ~Pack();
+
+    const std::string& filePath() const { return m_filePath; }
+
+    //path as PackFormat::normalizePath leaves it, relative to the mount point.
+    const PackFormat::Entry* find(const std::string& path) const;
+
+    //uncompressed entries only: their contents, in place.
+    const char* data(const PackFormat::Entry& entry) const { return m_view + entry.dataOffset; }
+
+    //inflates the blocks of a compressed entry covering [offset, offset + length) into output, in parallel.
+    //output starts with the first of these blocks, outputOffset tells where that is within the entry.
+    bool inflate(ITaskSystem& ts, const PackFormat::Entry& entry, uint64_t offset, uint64_t length, ByteBuffer& output, uint64_t& outputOffset) const;
+
+private:
+    Pack() {}
+    bool validate();
+
+    std::string m_filePath;
+    InternalFileSystem::OpaqueFileHandle m_file = {};
+    const char* m_view = nullptr;
+    size_t m_size = 0;
+    const PackFormat::Header* m_header = nullptr;
+    const PackFormat::Entry* m_entries = nullptr;
+    const char* m_paths = nullptr;
+};
+
+}
@@ -0,0 +1,268 @@
+#include <coalpy.files/PackBuilder.h>
+#include <coalpy.tasks/ITaskSystem.h>
+#include <coalpy.core/ByteBuffer.h>
+#include "PackFormat.h"
+#include "InternalFileSystem.h"
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+
+namespace coalpy
+{
+
+namespace
+{
+
+//a source file mapped only while it is compressed or written, so a large tree never has all of it open at once.
+struct SourceView
+{
+    InternalFileSystem::OpaqueFileHandle handle = {};
+    const char* contents = nullptr;
+    size_t size = 0;
+
+    ~SourceView()
+    {
+        if (InternalFileSystem::valid(handle))
+            InternalFileSystem::close(handle);
+    }
+
+    bool open(const std::string& path)
+    {
+        handle = InternalFileSystem::openFile(path.c_str(), InternalFileSystem::RequestType::Read);
+        return InternalFileSystem::valid(handle) && InternalFileSystem::mapFile(handle, contents, size);
+    }
+};
+
+struct BuildEntry
+{
+    std::string path;
+    const PackBuildFile* file = nullptr;
+    size_t size = 0;
+    bool readFailed = false;
+
+    //block sizes then blocks, empty when the file is stored as it is.
+    ByteBuffer compressed;
+    PackFormat::Entry entry = {};
+};
+
+void compressEntry(BuildEntry& buildEntry, const PackBuildDesc& desc)
+{
+    SourceView source;
+    if (!source.open(buildEntry.file->sourcePath))
+    {
+        buildEntry.readFailed = true;
+        return;
+    }
+
+    buildEntry.size = source.size;
+    if (desc.compressionLevel <= 0 || buildEntry.size == 0)
+        return;
+
+    uint32_t blockCount = PackFormat::blockCount(buildEntry.size);
+    uint64_t budget = (uint64_t)((double)buildEntry.size * (1.0 - (double)desc.minSavings));
+    std::vector<Bytef> block(compressBound(PackFormat::BlockSize));
+    ByteBuffer& compressed = buildEntry.compressed;
+    compressed.resize(blockCount * sizeof(uint32_t));
+    for (uint32_t i = 0; i < blockCount; ++i)
+    {
+        uint64_t blockStart = (uint64_t)i * PackFormat::BlockSize;
+        uLongf blockSize = (uLongf)block.size();
+        uLong sourceSize = (uLong)std::min((uint64_t)PackFormat::BlockSize, (uint64_t)buildEntry.size - blockStart);
+        int result = compress2(block.data(), &blockSize, (const Bytef*)source.contents + blockStart, sourceSize, std::min(desc.compressionLevel, 9));
+
+        //incompressible data gives up as soon as it is clear it will not save enough.
+        if (result != Z_OK || compressed.size() + blockSize > budget)
+        {
+            compressed.free();
+            return;
+        }
+
+        uint32_t storedSize = (uint32_t)blockSize;
+        memcpy(compressed.data() + i * sizeof(uint32_t), &storedSize, sizeof(uint32_t));
+        compressed.append((const u8*)block.data(), (size_t)blockSize);
+    }
+}
+
+bool writeAll(InternalFileSystem::OpaqueFileHandle h, const char* data, uint64_t size, uint64_t offset)
+{
+    const uint64_t maxPiece = 1ull << 30;
+    for (uint64_t written = 0; written < size; written += maxPiece)
+    {
+        uint64_t piece = std::min(maxPiece, size - written);
+        if (!InternalFileSystem::writeBytes(h, data + written, (int)piece, offset + written))
+            return false;
+    }
+    return true;
+}
+
+uint64_t alignUp(uint64_t offset, uint64_t alignment)
+{
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+}
+
+bool PackUtil::buildPack(const PackBuildDesc& desc, const char* packPath, std::string& error)
+{
+    if (desc.alignment <= 0 || (desc.alignment & (desc.alignment - 1)) != 0)
+    {
+        error = "Pack alignment must be a power of two.";
+        return false;
+    }
+
+    std::vector<BuildEntry> entries(desc.files.size());
+    for (size_t i = 0; i < desc.files.size(); ++i)
+    {
+        entries[i].file = &desc.files[i];
+        PackFormat::normalizePath(desc.files[i].path, entries[i].path);
+        entries[i].entry.pathHash = PackFormat::hashPath(entries[i].path.data(), entries[i].path.size());
+    }
+
+    //lookups binary search the hashes, collisions sit next to each other.
+    std::sort(entries.begin(), entries.end(), [](const BuildEntry& a, const BuildEntry& b)
+    {
+        return a.entry.pathHash != b.entry.pathHash ? a.entry.pathHash < b.entry.pathHash : a.path < b.path;
+    });
+
+    for (size_t i = 1; i < entries.size(); ++i)
+    {
+        if (entries[i - 1].path == entries[i].path)
+        {
+            error = "Path added twice to the pack: " + entries[i].path;
+            return false;
+        }
+    }
+
+    if (desc.taskSystem != nullptr)
+    {
+        desc.taskSystem->parallelFor(0, (int)entries.size(), 1, [&entries, &desc](int begin, int end)
+        {
+            for (int i = begin; i < end; ++i)
+                compressEntry(entries[i], desc);
+        });
+    }
+    else
+    {
+        for (BuildEntry& buildEntry : entries)
+            compressEntry(buildEntry, desc);
+    }
+
+    for (const BuildEntry& buildEntry : entries)
+    {
+        if (buildEntry.readFailed)
+        {
+            error = "Could not read " + buildEntry.file->sourcePath;
+            return false;
+        }
+    }
+
+    //header, entries and paths go first, so a mount only touches the start of the pack.
+    PackFormat::Header header = {};
+    header.magic = PackFormat::Magic;
+    header.version = PackFormat::Version;
+    header.entryCount = (uint32_t)entries.size();
+    header.alignment = (uint32_t)desc.alignment;
+    header.pathsOffset = sizeof(PackFormat::Header) + entries.size() * sizeof(PackFormat::Entry);
+
+    std::string paths;
+    for (BuildEntry& buildEntry : entries)
+    {
+        buildEntry.entry.pathOffset = paths.size();
+        buildEntry.entry.pathSize = (uint32_t)buildEntry.path.size();
+        paths += buildEntry.path;
+    }
+    header.pathsSize = paths.size();
+
+    uint64_t dataOffset = header.pathsOffset + header.pathsSize;
+    for (BuildEntry& buildEntry : entries)
+    {
+        PackFormat::Entry& entry = buildEntry.entry;
+        bool compressed = buildEntry.compressed.size() > 0;
+        entry.flags = compressed ? PackFormat::Compressed : 0u;
+        entry.size = buildEntry.size;
+        entry.storedSize = compressed ? buildEntry.compressed.size() : buildEntry.size;
+        if (entry.storedSize == 0)
+            continue;
+
+        dataOffset = alignUp(dataOffset, (uint64_t)desc.alignment);
+        entry.dataOffset = dataOffset;
+        dataOffset += entry.storedSize;
+    }
+
+    ByteBuffer index;
+    index.append(&header);
+    for (BuildEntry& buildEntry : entries)
+        index.append(&buildEntry.entry);
+    index.append((const u8*)paths.data(), paths.size());
+
+    //written next to the pack first: a mounted pack keeps its mapping of the old file.
+    std::string tempPathStr = std::string(packPath) + ".tmp";
+    if (!InternalFileSystem::carvePath(tempPathStr))
+    {
+        error = std::string("Could not create the directory of ") + packPath;
+        return false;
+    }
+
+    InternalFileSystem::OpaqueFileHandle pack = InternalFileSystem::openFile(tempPathStr.c_str(), InternalFileSystem::RequestType::Write);
+    if (!InternalFileSystem::valid(pack))
+    {
+        error = "Could not create " + tempPathStr;
+        return false;
+    }
+
+    bool success = writeAll(pack, (const char*)index.data(), index.size(), 0);
+    for (size_t i = 0; success && i < entries.size(); ++i)
+    {
+        const BuildEntry& buildEntry = entries[i];
+        if (buildEntry.compressed.size() > 0)
+        {
+            success = writeAll(pack, (const char*)buildEntry.compressed.data(), buildEntry.entry.storedSize, buildEntry.entry.dataOffset);
+            continue;
+        }
+
+        //stored files are mapped again, the one compressing them is long closed. One changed meanwhile fails the build.
+        if (buildEntry.entry.storedSize == 0)
+            continue;
+
+        SourceView source;
+        success = source.open(buildEntry.file->sourcePath) && source.size == buildEntry.size
+            && writeAll(pack, source.contents, buildEntry.entry.storedSize, buildEntry.entry.dataOffset);
+    }
+
+    InternalFileSystem::close(pack);
+
+    if (!success || !InternalFileSystem::renameFile(tempPathStr.c_str(), packPath))
+    {
+        InternalFileSystem::deleteFile(tempPathStr.c_str());
+        error = std::string("Failed writing ") + packPath;
+        return false;
+    }
+
+    return true;
+}
+
+void PackUtil::collectFiles(const std::string& directory, std::vector<PackBuildFile>& files)
+{
+    std::string root = directory;
+    while (root.size() > 1 && (root.back() == '/' || root.back() == '\\'))
+        root.pop_back();
+
+    std::vector<std::string> pending = { root };
+    while (!pending.empty())
+    {
+        std::string path = std::move(pending.back());
+        pending.pop_back();
+
+        std::vector<FileEntry> entries;
+        InternalFileSystem::listDirectory(path, [](const char* name, bool isDir) { return !isDir; }, pending, entries);
+        for (FileEntry& entry : entries)
+        {
+            PackBuildFile file;
+            PackFormat::normalizePath(entry.path.substr(root.size() + 1), file.path);
+            file.sourcePath = std::move(entry.path);
+            files.push_back(std::move(file));
+        }
+    }
+}
+
+}
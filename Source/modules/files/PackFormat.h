@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+namespace coalpy
+{
+
+//On disk layout of a pack, little endian:
+//  Header
+//  Entry[entryCount], sorted by path hash, then by path
+//  entry paths, back to back without terminators
+//  entry data, each one starting on a multiple of Header::alignment
+//Compressed entries are cut in BlockSize blocks deflated on their own, so they inflate in parallel and
+//ranged reads only inflate the blocks they cover. Their data starts with the compressed size of each
+//block (uint32_t), followed by the blocks.
+namespace PackFormat
+{
+    enum : uint32_t
+    {
+        Magic = 0x4b415043, //"CPAK"
+        Version = 1,
+        BlockSize = 256 * 1024
+    };
+
+    enum EntryFlags : uint32_t
+    {
+        Compressed = 1 << 0
+    };
+
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t entryCount;
+        uint32_t alignment;
+        uint64_t pathsOffset;
+        uint64_t pathsSize;
+    };
+
+    struct Entry
+    {
+        uint64_t pathHash;
+        uint64_t pathOffset; //from the start of the paths
+        uint64_t dataOffset; //from the start of the pack
+        uint64_t storedSize; //bytes in the pack, block sizes included
+        uint64_t size; //bytes once inflated
+        uint32_t pathSize;
+        uint32_t flags;
+    };
+
+    static_assert(sizeof(Header) == 32, "pack header layout changed");
+    static_assert(sizeof(Entry) == 48, "pack entry layout changed");
+
+    inline uint32_t blockCount(uint64_t size)
+    {
+        return (uint32_t)((size + BlockSize - 1) / BlockSize);
+    }
+
+    //64 bit fnv-1a, part of the format: packs built before keep resolving.
+    inline uint64_t hashPath(const char* path, size_t size)
+    {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= (uint64_t)(unsigned char)path[i];
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    //how paths are stored and looked up: forward slashes, without "." segments or repeated separators.
+    inline void normalizePath(const std::string& path, std::string& outPath)
+    {
+        outPath.clear();
+        outPath.reserve(path.size());
+        size_t i = 0;
+        while (i < path.size())
+        {
+            size_t segmentEnd = i;
+            while (segmentEnd < path.size() && path[segmentEnd] != '/' && path[segmentEnd] != '\\')
+                ++segmentEnd;
+
+            size_t segmentSize = segmentEnd - i;
+            bool isDot = segmentSize == 1 && path[i] == '.';
+            if (!isDot && (segmentSize > 0 || i == 0))
+            {
+                if (i > 0 && !outPath.empty() && outPath.back() != '/')
+                    outPath += '/';
+                outPath.append(path, i, segmentSize);
+                if (segmentSize == 0)
+                    outPath += '/'; //absolute paths keep their root
+            }
+            i = segmentEnd + 1;
+        }
+    }
+}
+
+}
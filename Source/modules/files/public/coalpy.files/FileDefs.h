@@ -4,15 +4,48 @@
 #include <vector>
 #include <string>
 #include <functional>
+#include <memory>
+#include <stdint.h>
 
 namespace coalpy
 {
 
 class ITaskSystem;
+class IFileWatcher;
 
 struct FileSystemDesc
 {
     ITaskSystem* taskSystem = nullptr;
+
+    //reads and writes go through io_uring when the kernel supports it, io workers then keep many requests
+    //in flight instead of blocking on each one. Memory mapped reads, and other platforms, use the regular path.
+    bool enableIoRing = true;
+
+    //bytes of recently read files kept in memory, 0 disables the cache. Cached files are checked against
+    //their size and modification time before being handed out, so reads never see stale contents.
+    //With the cache on, every whole file read goes through it. Memory mapped reads, ranged reads
+    //(FileReadRequest::offset / length) and files larger than the budget skip it.
+    size_t cacheBudget = 0;
+
+    //optional, cached files this watcher reports as changed are dropped right away.
+    IFileWatcher* fw = nullptr;
+
+    //requires fw. Reads remember which of their roots a path resolved to (or that none did) until the watcher
+    //reports a change. Only results whose every probed candidate lies under a watched directory are kept,
+    //anything the watcher would not report on is probed on every read.
+    bool cacheResolvedPaths = false;
+};
+
+//immutable file contents, shared by the cache and whoever holds on to them.
+using SharedFileBuffer = std::shared_ptr<const ByteBuffer>;
+
+struct FileCacheStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t bytes = 0;
+    int files = 0;
 };
 
 enum class IoError
@@ -61,7 +94,18 @@ struct FileReadResponse
     FileStatus status = FileStatus::Idle;
     std::string filePath;
     const char* buffer = nullptr;
-    int size = 0;
+    size_t size = 0;
+
+    //where buffer starts within the file.
+    uint64_t offset = 0;
+
+    //buffer is a read only view of the whole file (FileRequestFlags::MemoryMap), delivered in a single
+    //Reading response. It stays valid until the handle is closed, so it can be used without copying.
+    bool mapped = false;
+
+    //set when the contents went through the file cache: buffer points into it, and holding it keeps the
+    //contents alive without copying.
+    SharedFileBuffer sharedBuffer;
 };
 
 struct FileWriteResponse
@@ -76,7 +120,27 @@ using FileWriteDoneCallback = std::function<void(FileWriteResponse& response)>;
 
 enum class FileRequestFlags : int
 {
-    AutoStart = 1 << 0
+    AutoStart = 1 << 0,
+
+    //Reads map the file instead of copying it in chunks, see FileReadResponse::mapped. Falls back to
+    //chunked reads when the file cannot be mapped. The file must not be truncated while mapped.
+    MemoryMap = 1 << 1,
+
+    //Writes use the caller's buffer instead of copying it. It must stay alive and unchanged until the
+    //request finishes (wait or closeHandle). Applies to streamed appends too.
+    BorrowBuffer = 1 << 2,
+
+    //Writes go to a temporary file next to the target, which replaces it only once everything got written.
+    //Readers never see a half written file, and a failed write leaves the old one untouched.
+    AtomicReplace = 1 << 3
+};
+
+//how a read walks its file, so the os can size its read ahead: far ahead of the consumer for sequential
+//reads, none for random ones, where it would only waste io and memory.
+enum class FileAccessHint
+{
+    Sequential,
+    Random
 };
 
 struct FileReadRequest
@@ -86,6 +150,15 @@ struct FileReadRequest
     FileReadDoneCallback doneCallback;
     int flags;
 
+    //reads only length bytes from offset, clamped to the end of the file. A length of 0 reads to the end.
+    //Lets several requests consume one large file in parallel slices, see FileReadResponse::offset.
+    uint64_t offset = 0;
+    uint64_t length = 0;
+
+    //applies to chunked and memory mapped reads. Reads through the cache fetch the whole file at once,
+    //and the io ring reads large sequential pieces, neither needs it.
+    FileAccessHint access = FileAccessHint::Sequential;
+
     FileReadRequest() {}
 
     FileReadRequest(std::string path, FileReadDoneCallback doneCallback)
@@ -100,18 +173,78 @@ struct FileWriteRequest
     std::string path;
     FileWriteDoneCallback doneCallback;
     const char* buffer;
-    int size;
+    size_t size;
     int flags;
+
+    //when set, written instead of buffer / size. The request holds a reference until it finishes, so
+    //contents can be handed over without a copy and without lifetime rules.
+    SharedFileBuffer sharedBuffer;
     
     FileWriteRequest() {}
 
-    FileWriteRequest(std::string path, FileWriteDoneCallback doneCallback, const char* buffer, int size)
+    FileWriteRequest(std::string path, FileWriteDoneCallback doneCallback, const char* buffer, size_t size)
     : flags(0), path(path), doneCallback(doneCallback), buffer(buffer), size(size) {}
 
-    FileWriteRequest(std::string path, FileWriteDoneCallback doneCallback, const char* buffer, int size, int flags)
+    FileWriteRequest(std::string path, FileWriteDoneCallback doneCallback, const char* buffer, size_t size, int flags)
     : flags(flags), path(path), doneCallback(doneCallback), buffer(buffer), size(size) {}
 };
 
+struct FileEntry
+{
+    std::string path;
+    bool isDir = false;
+    uint64_t size = 0;
+
+    //in platform units, only good for comparing against other times.
+    uint64_t modifiedTime = 0;
+};
+
+struct FileEnumerateResponse
+{
+    IoError error = IoError::None;
+    FileStatus status = FileStatus::Idle;
+
+    //Reading responses carry the entries found in one directory.
+    const FileEntry* entries = nullptr;
+    int count = 0;
+};
+
+using FileEnumerateCallback = std::function<void(FileEnumerateResponse& response)>;
+
+struct FileEnumerateRequest
+{
+    std::string path;
+
+    //names to keep, globs with '*' and '?' such as "*.hlsl". Empty keeps everything.
+    std::vector<std::string> patterns;
+
+    bool recursive = true;
+    bool includeDirectories = false;
+
+    //Directories are listed in parallel, the callback gets each one's entries as soon as they are found,
+    //then Success once the walk is over. Never called concurrently. Fail means path is not a directory.
+    FileEnumerateCallback callback;
+    int flags = 0;
+};
+
+enum class PackMountOrder
+{
+    BeforeDisk, //a file in the pack hides the same file on disk, and saves probing the disk for it
+    AfterDisk //the pack only provides files none of the candidates of a read find on disk
+};
+
+struct PackMountRequest
+{
+    //pack built by PackUtil::buildPack, see coalpy.files/PackBuilder.h.
+    std::string path;
+
+    //where the pack contents appear: a read of mountPoint/a.hlsl gets the pack's a.hlsl. Empty mounts
+    //them as they are, relative to the working directory.
+    std::string mountPoint;
+
+    PackMountOrder order = PackMountOrder::BeforeDisk;
+};
+
 struct FileAttributes
 {
     bool exists;
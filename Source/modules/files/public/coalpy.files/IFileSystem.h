@@ -18,7 +18,37 @@ public:
     virtual ~IFileSystem() {}
 
     virtual AsyncFileHandle read (const FileReadRequest& request) = 0;
+
+    //Reads many files through a single handle: each file reports to its own callback as it would with read,
+    //and execute / wait / closeHandle act on the whole group. Only a few files are read at a time.
+    //The group starts right away if any of the requests has FileRequestFlags::AutoStart.
+    virtual AsyncFileHandle readBatch(const FileReadRequest* requests, int count) = 0;
+
     virtual AsyncFileHandle write(const FileWriteRequest& request) = 0;
+
+    //Streamed writes: the file opens right away, each appendWrite goes after the previous one, and endWrite
+    //starts the task of the handle, which closes the file and reports Success or Fail to the callback.
+    //The request buffer is ignored, its flags apply (AtomicReplace, BorrowBuffer for the appends).
+    //Appends keep going in the background while more get produced. An append after a failure is skipped.
+    virtual AsyncFileHandle beginWrite(const FileWriteRequest& request) = 0;
+    virtual void appendWrite(AsyncFileHandle handle, const char* buffer, size_t size) = 0;
+    virtual void endWrite(AsyncFileHandle handle) = 0;
+
+    //Hints that these files get read soon. A background io task loads them into the file cache, or into the
+    //os page cache when FileSystemDesc::cacheBudget is 0, so the reads that follow do not wait on the disk.
+    //Paths are taken as they are, no roots get probed. Missing files are skipped.
+    virtual void prefetch(const std::vector<std::string>& paths) = 0;
+
+    //Serves reads from a pack: each candidate of a read (its path, then each additional root) is looked up
+    //in the mounted packs, in mount order, before or after probing the disk. Mounting maps the pack and
+    //reads its index, nothing else touches the disk. Stored files come back as views into the pack
+    //(FileReadResponse::mapped), compressed ones get inflated in parallel (FileReadResponse::sharedBuffer).
+    //The pack file must not change while mounted. False if it is not a valid pack.
+    virtual bool mountPack(const PackMountRequest& request) = 0;
+
+    //reads already started keep the pack alive until their handles get closed.
+    virtual bool unmountPack(const char* packPath) = 0;
+
     virtual void execute(AsyncFileHandle handle) = 0;
     virtual Task asTask(AsyncFileHandle handle) = 0;
     virtual void wait(AsyncFileHandle handle) = 0;
@@ -27,9 +57,16 @@ public:
     virtual void closeHandle(AsyncFileHandle handle) = 0;
     virtual bool carveDirectoryPath(const char* directoryName) = 0;
     virtual void enumerateFiles(const char* directoryName, std::vector<std::string>& dirList) = 0;
+
+    //Walks a directory tree on io tasks, with entry types, sizes and times. The handle acts as a read's:
+    //execute (or FileRequestFlags::AutoStart), wait and closeHandle.
+    virtual AsyncFileHandle enumerate(const FileEnumerateRequest& request) = 0;
     virtual bool deleteDirectory(const char* directoryName) = 0;
     virtual bool deleteFile(const char* fileName) = 0;
     virtual void getFileAttributes(const char* fileName, FileAttributes& attributes) = 0;
+
+    //all zeros when FileSystemDesc::cacheBudget is 0.
+    virtual void getCacheStats(FileCacheStats& stats) = 0;
 };
 
 }
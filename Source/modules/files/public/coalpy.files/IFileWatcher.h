@@ -15,7 +15,9 @@ public:
 
 struct FileWatchDesc
 {
-    int pollingRateMS = 1000;
+    //changes are reported this long after the first one of a burst, together with everything else that
+    //changed meanwhile: an editor saving through a temporary file and a rename ends up in a single report.
+    int debounceMS = 50;
 };
 
 class IFileWatcher
@@ -24,7 +26,11 @@ public:
     static IFileWatcher* create(const FileWatchDesc& desc);
     virtual void start() = 0;
     virtual void stop() = 0;
+    //watches the whole tree under directory, subdirectories created later on included.
     virtual void addDirectory(const char* directory) = 0;
+    //true if path (absolute, or relative to the working directory) lies under a watched directory. The path
+    //does not need to exist.
+    virtual bool isWatched(const char* path) = 0;
     virtual void addListener(IFileWatchListener* listener) = 0;
     virtual void removeListener(IFileWatchListener* listener) = 0;
 };
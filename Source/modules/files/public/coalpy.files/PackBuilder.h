@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace coalpy
+{
+
+class ITaskSystem;
+
+struct PackBuildFile
+{
+    //what reads ask for, relative to the mount point of the pack.
+    std::string path;
+
+    //file on disk providing the contents.
+    std::string sourcePath;
+};
+
+struct PackBuildDesc
+{
+    //optional, files get compressed in parallel on it.
+    ITaskSystem* taskSystem = nullptr;
+
+    std::vector<PackBuildFile> files;
+
+    //contents of each file start on a multiple of this power of two, so mapped reads can use them in place.
+    int alignment = 16;
+
+    //zlib level from 1 to 9, 0 stores every file as it is.
+    int compressionLevel = 6;
+
+    //files are only stored compressed when it saves at least this fraction of their size.
+    float minSavings = 0.1f;
+};
+
+namespace PackUtil
+{
+    //Writes a pack that IFileSystem::mountPack serves reads from. The pack replaces packPath only once
+    //fully written. False on failure, with a reason in error.
+    bool buildPack(const PackBuildDesc& desc, const char* packPath, std::string& error);
+
+    //every file under directory, with its path relative to it.
+    void collectFiles(const std::string& directory, std::vector<PackBuildFile>& files);
+}
+
+}
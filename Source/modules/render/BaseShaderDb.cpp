@@ -231,6 +231,20 @@ void BaseShaderDb::requestRecompile(ShaderHandle handle)
             return;
     }
 
+    //the files the last compile used are most likely what this one reads: main file and includes get
+    //loaded in the background while the compile task waits to start.
+    {
+        std::vector<std::string> dependencies;
+        {
+            std::shared_lock dependencyLock(m_dependencyMutex);
+            auto it = m_shadersToFiles.find(handle);
+            if (it != m_shadersToFiles.end())
+                for (const FileLookup& file : it->second)
+                    dependencies.push_back(file.filename);
+        }
+        m_desc.fs->prefetch(dependencies);
+    }
+
     auto& recipe = shaderState->recipe;
     auto& compileState = *(new CompileState());
     compileState.shaderName = recipe.name;
@@ -391,7 +405,7 @@ void BaseShaderDb::prepareCompileJobs(CompileState& compileState)
             req.doneCallback = [](FileWriteResponse& response) {};
             req.path = ss.str();
             req.buffer = (const char*)payload.pdbBlob->GetBufferPointer();
-            req.size = (int)payload.pdbBlob->GetBufferSize();
+            req.size = (size_t)payload.pdbBlob->GetBufferSize();
             AsyncFileHandle writeHandle = m_desc.fs->write(req);
     
             m_desc.fs->execute(writeHandle);
@@ -433,7 +447,7 @@ void BaseShaderDb::resolve(ShaderHandle handle)
 
         if (m_desc.enableLiveEditing)
         {
-            std::shared_lock lock(m_dependencyMutex);
+            std::unique_lock lock(m_dependencyMutex);
             if (compileState->success)
             {
                 //step 1, clear the dependencies
@@ -1,7 +1,7 @@
 #pragma once
 
 #include <coalpy.core/GenericHandle.h>
-#include <coalpy.core/HandleContainer.h>
+#include <coalpy.core/GenerationalHandleContainer.h>
 #include <coalpy.render/IShaderDb.h>
 #include <coalpy.files/IFileWatcher.h>
 #include <coalpy.files/Utils.h>
@@ -83,7 +83,7 @@ protected:
     render::IDevice* m_parentDevice = nullptr;
 
     mutable std::shared_mutex m_shadersMutex;
-    HandleContainer<ShaderHandle, ShaderState*> m_shaders;
+    GenerationalHandleContainer<ShaderHandle, ShaderState*> m_shaders;
 
 private:
     void preparePdbDir();
@@ -0,0 +1,176 @@
+#include "Fiber.h"
+#include <coalpy.core/Assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+//thread sanitizer tracks every stack separately, so it has to be told about the switches.
+#if defined(__SANITIZE_THREAD__)
+#define CPY_TSAN_FIBERS 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define CPY_TSAN_FIBERS 1
+#endif
+#endif
+
+#if CPY_TSAN_FIBERS
+extern "C" {
+void* __tsan_get_current_fiber();
+void* __tsan_create_fiber(unsigned flags);
+void __tsan_destroy_fiber(void* fiber);
+void __tsan_switch_to_fiber(void* fiber, unsigned flags);
+}
+#endif
+
+namespace coalpy
+{
+
+struct Fiber
+{
+#ifdef _WIN32
+    LPVOID handle = nullptr;
+#else
+    ucontext_t context;
+    void* stack = nullptr;
+    size_t mappedSize = 0;
+#endif
+#if CPY_TSAN_FIBERS
+    void* tsanFiber = nullptr;
+#endif
+    InternalFiber::EntryFn entryFn = nullptr;
+    void* arg = nullptr;
+};
+
+namespace InternalFiber
+{
+
+#ifdef _WIN32
+
+static VOID CALLBACK fiberMain(LPVOID arg)
+{
+    Fiber* fiber = (Fiber*)arg;
+    fiber->entryFn(fiber->arg);
+    CPY_ERROR_MSG(false, "Fiber entry function returned.");
+    abort();
+}
+
+Fiber* createFromThread()
+{
+    auto* fiber = new Fiber;
+    fiber->handle = ConvertThreadToFiber(nullptr);
+    CPY_ERROR_MSG(fiber->handle != nullptr, "Could not convert thread to fiber.");
+    return fiber;
+}
+
+void destroyFromThread(Fiber* threadFiber)
+{
+    ConvertFiberToThread();
+    delete threadFiber;
+}
+
+Fiber* create(int stackSize, EntryFn entryFn, void* arg)
+{
+    auto* fiber = new Fiber;
+    fiber->entryFn = entryFn;
+    fiber->arg = arg;
+    fiber->handle = CreateFiber((SIZE_T)stackSize, fiberMain, fiber);
+    CPY_ERROR_MSG(fiber->handle != nullptr, "Could not create fiber.");
+    return fiber;
+}
+
+void destroy(Fiber* fiber)
+{
+    if (fiber->handle)
+        DeleteFiber(fiber->handle);
+    delete fiber;
+}
+
+void switchTo(Fiber* from, Fiber* to)
+{
+    SwitchToFiber(to->handle);
+}
+
+#else
+
+//makecontext only forwards int arguments, so the pointer travels in two halves.
+static void fiberMain(unsigned int hi, unsigned int lo)
+{
+    Fiber* fiber = (Fiber*)(((uintptr_t)hi << 32) | (uintptr_t)lo);
+    fiber->entryFn(fiber->arg);
+    CPY_ERROR_MSG(false, "Fiber entry function returned.");
+    abort();
+}
+
+Fiber* createFromThread()
+{
+    //the context gets filled in by the first switch away from the thread.
+    auto* fiber = new Fiber;
+#if CPY_TSAN_FIBERS
+    fiber->tsanFiber = __tsan_get_current_fiber();
+#endif
+    return fiber;
+}
+
+void destroyFromThread(Fiber* threadFiber)
+{
+    delete threadFiber;
+}
+
+Fiber* create(int stackSize, EntryFn entryFn, void* arg)
+{
+    auto* fiber = new Fiber;
+    fiber->entryFn = entryFn;
+    fiber->arg = arg;
+
+    //a guard page at the bottom turns a stack overflow into a fault instead of silent corruption.
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t stackBytes = ((size_t)stackSize + pageSize - 1) & ~(pageSize - 1);
+    fiber->mappedSize = stackBytes + pageSize;
+    fiber->stack = mmap(nullptr, fiber->mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    CPY_ERROR_MSG(fiber->stack != MAP_FAILED, "Could not allocate fiber stack.");
+    mprotect(fiber->stack, pageSize, PROT_NONE);
+
+    getcontext(&fiber->context);
+    fiber->context.uc_stack.ss_sp = (char*)fiber->stack + pageSize;
+    fiber->context.uc_stack.ss_size = stackBytes;
+    fiber->context.uc_link = nullptr;
+    uintptr_t ptr = (uintptr_t)fiber;
+    makecontext(&fiber->context, (void(*)())fiberMain, 2, (unsigned int)(ptr >> 32), (unsigned int)(ptr & 0xffffffff));
+#if CPY_TSAN_FIBERS
+    fiber->tsanFiber = __tsan_create_fiber(0);
+#endif
+    return fiber;
+}
+
+void destroy(Fiber* fiber)
+{
+#if CPY_TSAN_FIBERS
+    if (fiber->tsanFiber)
+        __tsan_destroy_fiber(fiber->tsanFiber);
+#endif
+    if (fiber->stack)
+        munmap(fiber->stack, fiber->mappedSize);
+    delete fiber;
+}
+
+void switchTo(Fiber* from, Fiber* to)
+{
+#if CPY_TSAN_FIBERS
+    __tsan_switch_to_fiber(to->tsanFiber, 0);
+#endif
+    swapcontext(&from->context, &to->context);
+}
+
+#endif
+
+}
+
+}
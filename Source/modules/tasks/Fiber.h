@@ -0,0 +1,26 @@
+#pragma once
+
+namespace coalpy
+{
+
+struct Fiber;
+
+//Stackful execution contexts, switched cooperatively. A fiber suspended on one thread can be
+//resumed on any other thread.
+namespace InternalFiber
+{
+    using EntryFn = void(*)(void* arg);
+
+    //Wraps the calling thread's own context, so it can switch into fibers and be switched back to.
+    Fiber* createFromThread();
+    void destroyFromThread(Fiber* threadFiber);
+
+    //entryFn must never return, fibers finish by switching away for good.
+    Fiber* create(int stackSize, EntryFn entryFn, void* arg);
+    void destroy(Fiber* fiber);
+
+    //Saves the calling context in from (which must be the fiber running on this thread) and resumes to.
+    void switchTo(Fiber* from, Fiber* to);
+}
+
+}
@@ -0,0 +1,145 @@
+#include "FiberScheduler.h"
+#include <coalpy.tasks/MpmcQueue.h>
+#include <coalpy.tasks/EventCount.h>
+#include <coalpy.core/Assert.h>
+#include <thread>
+
+namespace coalpy
+{
+
+struct FiberBlockingRequest
+{
+    Fiber* fiber = nullptr;
+    TaskBlockFn blockFn = {};
+};
+
+class FiberBlockingQueue : public MpmcQueue<FiberBlockingRequest> {};
+
+FiberScheduler::FiberScheduler(int stackSize, int blockingThreadCount, EventCount* idleEvent, InternalFiber::EntryFn loopEntryFn)
+: m_stackSize(stackSize)
+, m_idleEvent(idleEvent)
+, m_loopEntryFn(loopEntryFn)
+{
+    CPY_ASSERT(idleEvent != nullptr && loopEntryFn != nullptr);
+    m_blockingQueue = new FiberBlockingQueue;
+    if (blockingThreadCount < 1)
+        blockingThreadCount = 1;
+
+    for (int i = 0; i < blockingThreadCount; ++i)
+        m_blockingThreads.push_back(new std::thread([this]() { blockingLoop(); }));
+}
+
+FiberScheduler::~FiberScheduler()
+{
+    //an empty request (no fiber) tells a blocking thread to exit.
+    for (int i = 0; i < (int)m_blockingThreads.size(); ++i)
+        m_blockingQueue->push(FiberBlockingRequest());
+
+    for (std::thread* t : m_blockingThreads)
+    {
+        t->join();
+        delete t;
+    }
+
+    CPY_ASSERT_MSG(m_suspendedCount == 0, "Fiber scheduler destroyed with suspended tasks.");
+    for (Fiber* fiber : m_allFibers)
+        InternalFiber::destroy(fiber);
+
+    delete m_blockingQueue;
+}
+
+Fiber* FiberScheduler::acquireLoopFiber()
+{
+    std::unique_lock lock(m_fibersMutex);
+    if (!m_parkedFibers.empty())
+    {
+        Fiber* fiber = m_parkedFibers.back();
+        m_parkedFibers.pop_back();
+        return fiber;
+    }
+
+    Fiber* fiber = InternalFiber::create(m_stackSize, m_loopEntryFn, this);
+    m_allFibers.push_back(fiber);
+    return fiber;
+}
+
+void FiberScheduler::releaseLoopFiber(Fiber* fiber)
+{
+    std::unique_lock lock(m_fibersMutex);
+    m_parkedFibers.push_back(fiber);
+}
+
+void FiberScheduler::submitBlocking(Fiber* fiber, const TaskBlockFn& blockFn)
+{
+    beginSuspend();
+    FiberBlockingRequest request;
+    request.fiber = fiber;
+    request.blockFn = blockFn;
+    m_blockingQueue->push(request);
+}
+
+void FiberScheduler::pushReady(Fiber* fiber)
+{
+    {
+        std::unique_lock lock(m_readyMutex);
+        m_readyFibers.push_back(fiber);
+        m_readyCount.fetch_add(1, std::memory_order_release);
+    }
+    m_idleEvent->notifyOne();
+}
+
+Fiber* FiberScheduler::popReady()
+{
+    if (!hasReady())
+        return nullptr;
+
+    std::unique_lock lock(m_readyMutex);
+    if (m_readyFibers.empty())
+        return nullptr;
+
+    Fiber* fiber = m_readyFibers.front();
+    m_readyFibers.pop_front();
+    m_readyCount.fetch_sub(1, std::memory_order_release);
+    return fiber;
+}
+
+void FiberScheduler::blockingLoop()
+{
+    while (true)
+    {
+        FiberBlockingRequest request;
+        m_blockingQueue->waitPop(request);
+        if (request.fiber == nullptr)
+            break;
+
+        if (request.blockFn)
+            request.blockFn();
+
+        resumeSuspended(request.fiber);
+    }
+}
+
+void FiberScheduler::beginSuspend()
+{
+    m_suspendedCount.fetch_add(1, std::memory_order_acq_rel);
+}
+
+void FiberScheduler::resumeSuspended(Fiber* fiber)
+{
+    //the fiber stays counted as suspended until it sits in the ready queue, so workers never stop in between.
+    int remaining = 0;
+    {
+        std::unique_lock lock(m_readyMutex);
+        m_readyFibers.push_back(fiber);
+        m_readyCount.fetch_add(1, std::memory_order_release);
+        remaining = m_suspendedCount.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    }
+
+    //workers waiting to stop only re-check once the last suspended fiber is back, wake all of them then.
+    if (remaining == 0)
+        m_idleEvent->notifyAll();
+    else
+        m_idleEvent->notifyOne();
+}
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <coalpy.tasks/TaskDefs.h>
+#include "Fiber.h"
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <vector>
+
+namespace std
+{
+    class thread;
+}
+
+namespace coalpy
+{
+
+class EventCount;
+class FiberBlockingQueue;
+
+//Shared state of the fiber execution mode: the worker loop fibers, the fibers ready to resume,
+//and the small thread pool that runs blocking calls for suspended fibers.
+class FiberScheduler
+{
+public:
+    FiberScheduler(int stackSize, int blockingThreadCount, EventCount* idleEvent, InternalFiber::EntryFn loopEntryFn);
+    ~FiberScheduler();
+
+    //Loop fibers run the worker loop. Parked ones are reused before creating new ones.
+    Fiber* acquireLoopFiber();
+    void releaseLoopFiber(Fiber* fiber);
+
+    //Runs blockFn on the blocking pool, then marks fiber ready to resume.
+    void submitBlocking(Fiber* fiber, const TaskBlockFn& blockFn);
+
+    //Fibers suspended on something else than the blocking pool: counted from beginSuspend, and handed
+    //back to the workers by resumeSuspended, which can be called from any thread.
+    void beginSuspend();
+    void resumeSuspended(Fiber* fiber);
+
+    void pushReady(Fiber* fiber);
+    Fiber* popReady();
+    bool hasReady() const { return m_readyCount.load(std::memory_order_acquire) > 0; }
+
+    //Fibers that are blocked or waiting to be resumed.
+    int suspendedCount() const { return m_suspendedCount.load(std::memory_order_acquire); }
+
+private:
+    void blockingLoop();
+
+    int m_stackSize;
+    EventCount* m_idleEvent;
+    InternalFiber::EntryFn m_loopEntryFn;
+
+    std::mutex m_fibersMutex;
+    std::vector<Fiber*> m_allFibers;
+    std::vector<Fiber*> m_parkedFibers;
+
+    std::mutex m_readyMutex;
+    std::deque<Fiber*> m_readyFibers;
+    std::atomic<int> m_readyCount = 0;
+    std::atomic<int> m_suspendedCount = 0;
+
+    FiberBlockingQueue* m_blockingQueue = nullptr;
+    std::vector<std::thread*> m_blockingThreads;
+};
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+namespace coalpy
+{
+
+//Small lock for very short critical sections (a handful of pointer writes).
+//Satisfies BasicLockable, so it can be used with std::unique_lock.
+class SpinLock
+{
+public:
+    void lock()
+    {
+        int spins = 0;
+        while (m_flag.exchange(true, std::memory_order_acquire))
+        {
+            while (m_flag.load(std::memory_order_relaxed))
+            {
+                if (++spins > 64)
+                    std::this_thread::yield();
+            }
+        }
+    }
+
+    bool try_lock()
+    {
+        return !m_flag.load(std::memory_order_relaxed) && !m_flag.exchange(true, std::memory_order_acquire);
+    }
+
+    void unlock()
+    {
+        m_flag.store(false, std::memory_order_release);
+    }
+
+private:
+    std::atomic<bool> m_flag = false;
+};
+
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <coalpy.core/Assert.h>
+#include <mutex>
+#include <vector>
+
+namespace coalpy
+{
+
+//Hands out objects carved from slabs of SlabSize elements. Objects are constructed once with
+//the slab and recycled, the owner is responsible for resetting them. Released objects go to a
+//free list, so steady state allocation never touches the heap.
+template<typename ItemType, int SlabSize = 256>
+class TaskPool
+{
+public:
+    ~TaskPool()
+    {
+        for (ItemType* slab : m_slabs)
+            delete [] slab;
+    }
+
+    ItemType* allocate()
+    {
+        std::unique_lock lock(m_mutex);
+        if (m_freeItems.empty())
+        {
+            ItemType* slab = new ItemType[SlabSize];
+            m_slabs.push_back(slab);
+            m_freeItems.reserve(m_freeItems.size() + SlabSize);
+            for (int i = SlabSize - 1; i >= 0; --i)
+                m_freeItems.push_back(&slab[i]);
+        }
+
+        ItemType* item = m_freeItems.back();
+        m_freeItems.pop_back();
+        return item;
+    }
+
+    void release(ItemType* item)
+    {
+        std::unique_lock lock(m_mutex);
+        m_freeItems.push_back(item);
+    }
+
+    int slabCount()
+    {
+        std::unique_lock lock(m_mutex);
+        return (int)m_slabs.size();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::vector<ItemType*> m_freeItems;
+    std::vector<ItemType*> m_slabs;
+};
+
+//Spill storage of a TaskEdgeList, once its inline slots are full.
+template<typename ItemType>
+struct TaskEdgeBlock
+{
+    enum { Capacity = 14 };
+    ItemType items[Capacity];
+    TaskEdgeBlock* prev = nullptr;
+    TaskEdgeBlock* next = nullptr;
+};
+
+//Unordered list of graph edges. The first InlineCapacity edges live in the owner, the rest
+//in pooled blocks. Not thread safe, the owner guards it.
+template<typename ItemType, int InlineCapacity = 4>
+class TaskEdgeList
+{
+public:
+    using Block = TaskEdgeBlock<ItemType>;
+    using BlockPool = TaskPool<Block>;
+
+    int size() const { return m_count; }
+    bool empty() const { return m_count == 0; }
+
+    void push(ItemType item, BlockPool& pool)
+    {
+        int index = m_count++;
+        if (index < InlineCapacity)
+        {
+            m_inline[index] = item;
+            return;
+        }
+
+        int blockIndex = (index - InlineCapacity) % Block::Capacity;
+        if (blockIndex == 0)
+        {
+            Block* block = pool.allocate();
+            block->prev = m_tail;
+            block->next = nullptr;
+            if (m_tail)
+                m_tail->next = block;
+            else
+                m_head = block;
+            m_tail = block;
+        }
+        m_tail->items[blockIndex] = item;
+    }
+
+    //Removes one instance of item, swapping the last edge into its slot.
+    bool remove(ItemType item, BlockPool& pool)
+    {
+        ItemType* slot = find(item);
+        if (slot == nullptr)
+            return false;
+
+        ItemType& last = at(m_count - 1);
+        *slot = last;
+        --m_count;
+
+        if (m_count >= InlineCapacity && (m_count - InlineCapacity) % Block::Capacity == 0)
+        {
+            Block* emptyBlock = m_tail;
+            m_tail = emptyBlock->prev;
+            if (m_tail)
+                m_tail->next = nullptr;
+            else
+                m_head = nullptr;
+            pool.release(emptyBlock);
+        }
+        return true;
+    }
+
+    void clear(BlockPool& pool)
+    {
+        Block* block = m_head;
+        while (block)
+        {
+            Block* next = block->next;
+            pool.release(block);
+            block = next;
+        }
+        m_head = m_tail = nullptr;
+        m_count = 0;
+    }
+
+    template<typename FnType>
+    void forEach(FnType fn) const
+    {
+        int inlineCount = m_count < InlineCapacity ? m_count : InlineCapacity;
+        for (int i = 0; i < inlineCount; ++i)
+            fn(m_inline[i]);
+
+        int remaining = m_count - inlineCount;
+        for (const Block* block = m_head; block && remaining > 0; block = block->next)
+        {
+            int blockCount = remaining < (int)Block::Capacity ? remaining : (int)Block::Capacity;
+            for (int i = 0; i < blockCount; ++i)
+                fn(block->items[i]);
+            remaining -= blockCount;
+        }
+    }
+
+private:
+    ItemType& at(int index)
+    {
+        CPY_ASSERT(index >= 0 && index < m_count);
+        if (index < InlineCapacity)
+            return m_inline[index];
+
+        //only used for the last element, which always lives in the tail block.
+        CPY_ASSERT(index == m_count - 1);
+        return m_tail->items[(index - InlineCapacity) % Block::Capacity];
+    }
+
+    ItemType* find(ItemType item)
+    {
+        int inlineCount = m_count < InlineCapacity ? m_count : InlineCapacity;
+        for (int i = 0; i < inlineCount; ++i)
+            if (m_inline[i] == item)
+                return &m_inline[i];
+
+        int remaining = m_count - inlineCount;
+        for (Block* block = m_head; block && remaining > 0; block = block->next)
+        {
+            int blockCount = remaining < (int)Block::Capacity ? remaining : (int)Block::Capacity;
+            for (int i = 0; i < blockCount; ++i)
+                if (block->items[i] == item)
+                    return &block->items[i];
+            remaining -= blockCount;
+        }
+        return nullptr;
+    }
+
+    ItemType m_inline[InlineCapacity] = {};
+    Block* m_head = nullptr;
+    Block* m_tail = nullptr;
+    int m_count = 0;
+};
+
+}
@@ -1,62 +1,52 @@
 #include "TaskSystem.h"
-#include <coalpy.tasks/ThreadQueue.h>
 #include <coalpy.core/Assert.h>
+#include <algorithm>
 #include <chrono>
+#include <memory>
 #include <thread>
 
 namespace coalpy
 {
 
-enum class TaskScheduleMessageType
-{
-    Exit,
-    RunJob,
-    RunJobs
-};
-
-struct TaskScheduleMessage
-{
-    TaskScheduleMessageType type;
-    Task task;
-    std::vector<Task> tasks;
-};
-
-class TaskSchedulerQueue : public ThreadQueue<TaskScheduleMessage> {};
-
 Task TaskSystem::createTask(const TaskDesc& taskDesc, void* taskData)
 {
-
+    //task objects stay bound to their table slot, so lock free lookups never see the slot change object.
     Task outHandle;
+    TaskData* data = nullptr;
     {
         std::unique_lock lock(m_stateMutex);
-        TaskData& data = m_taskTable.allocate(outHandle);
-        data.desc = taskDesc;
-        data.data = taskData;
-        data.syncData = new SyncData;
+        TaskData*& slot = m_taskTable.allocate(outHandle);
+        if (slot == nullptr)
+            slot = m_taskPool.allocate();
+        data = slot;
     }
 
+    data->handle = outHandle;
+    data->desc = taskDesc;
+    data->data = taskData;
+    data->autoRelease = (taskDesc.flags & (int)TaskFlags::AutoRelease) != 0;
+    data->refs.store(1, std::memory_order_release);
+
+    m_trace.record(TaskTraceEventType::Created, outHandle.handleId, taskDesc.name);
+
     if ((taskDesc.flags & (int)TaskFlags::AutoStart) != 0)
         execute(outHandle);
     return outHandle;
 }
 
 TaskSystem::TaskSystem(const TaskSystemDesc& desc)
-: m_schedulerQueue(std::make_unique<TaskSchedulerQueue>())
-, m_nextWorker(0u)
+: m_desc(desc)
 {
 }
 
 TaskSystem::~TaskSystem()
 {
-    std::unique_lock lock(m_stateMutex);
-
     signalStop();
     join();
 
-    int aliveTasks = 0;
-    m_taskTable.forEach([&aliveTasks](Task task, TaskData& data){
-        aliveTasks += data.syncData == nullptr ? 0 : 1;
-    });
+    std::unique_lock lock(m_stateMutex);
+
+    int aliveTasks = m_taskTable.elementsCount();
 
     CPY_ASSERT_FMT(aliveTasks == 0, "%d still alive tasks detected. This will cause memory leaks.", aliveTasks);
 }
@@ -65,337 +55,826 @@ void TaskSystem::start()
 {
     std::unique_lock lock(m_stateMutex);
 
-    CPY_ASSERT_MSG(m_schedulerThread == nullptr, "Task system cannot start, must call signalStop followed by join().");
-    if (m_schedulerThread)
+    CPY_ASSERT_MSG(!m_running, "Task system cannot start, must call signalStop followed by join().");
+    if (m_running)
         return;
 
-    m_workers.resize(m_desc.threadPoolSize);
-    int nextId = 0;
-    for (auto& w : m_workers)
+    if (m_desc.enableFibers)
+        m_fiberScheduler = std::make_unique<FiberScheduler>(m_desc.fiberStackSize, m_desc.blockingThreadPoolSize, &m_idleEvents[(int)TaskLane::Cpu], &ThreadWorker::fiberEntry);
+
+    //workers of every lane live in one array, each lane is a contiguous range that only steals within itself.
+    const int laneSizes[(int)TaskLane::Count] = { std::max(m_desc.threadPoolSize, 1), std::max(m_desc.ioThreadPoolSize, 0) };
+    int workerCount = 0;
+    for (int l = 0; l < (int)TaskLane::Count; ++l)
+    {
+        m_lanes[l].begin = workerCount;
+        m_lanes[l].count = laneSizes[l];
+        m_lanes[l].nextWorker = 0;
+        workerCount += laneSizes[l];
+    }
+
+    m_workers.resize(workerCount);
+    for (int l = 0; l < (int)TaskLane::Count; ++l)
     {
-        w.setId(nextId++);
-        w.start([this](Task t) { this->onTaskComplete(t); });
+        LaneRange& lane = m_lanes[l];
+        for (int i = 0; i < lane.count; ++i)
+        {
+            ThreadWorker& w = m_workers[lane.begin + i];
+            w.setId(i);
+            w.setTrace(&m_trace);
+            //io tasks are expected to block, so their lane keeps plain threads even in fiber mode.
+            FiberScheduler* fiberScheduler = l == (int)TaskLane::Cpu ? m_fiberScheduler.get() : nullptr;
+            w.init(&m_workers[lane.begin], lane.count, &m_idleEvents[l], [this](ThreadWorkerJob& job)
+            {
+                //parallelFor ranges run without a task behind them.
+                if (job.userData == nullptr)
+                    return (ThreadWorkerJob*)nullptr;
+                return this->onTaskComplete(*(TaskData*)job.userData);
+            }, fiberScheduler);
+        }
     }
 
-    m_schedulerThread = std::make_unique<std::thread>([this]() { onMessageLoop(); });
+    //workers steal from each other, so all of them must be initialized before any starts.
+    for (auto& w : m_workers)
+        w.start();
+
+    m_running = true;
 }
 
 void TaskSystem::signalStop()
 {
-    TaskScheduleMessage msg;
-    msg.type = TaskScheduleMessageType::Exit;
-    m_schedulerQueue->push(msg);
+    //workers drain whatever is left in their queues before exiting.
+    for (auto& w : m_workers)
+        w.signalStop();
 }
 
 void TaskSystem::join()
 {
-    if (!m_schedulerThread)
+    if (!m_running)
         return;
 
-    m_schedulerThread->join();
     for (auto& w : m_workers)
         w.join();
 
-    m_schedulerThread.release();
+    m_fiberScheduler = nullptr;
+    m_running = false;
 }
 
 void TaskSystem::execute(Task task)
 {
-    TaskScheduleMessage msg = {};
-    msg.type = TaskScheduleMessageType::RunJob;
-    msg.task = task;
-    m_schedulerQueue->push(msg);
+    execute(&task, 1);
 }
 
 void TaskSystem::execute(Task* tasks, int counts)
 {
-    TaskScheduleMessage msg = {};
-    msg.type = TaskScheduleMessageType::RunJobs;
-    msg.tasks.assign(tasks, tasks + counts);
-    m_schedulerQueue->push(msg);
+    //scratch kept per thread, so steady state executes do not allocate. Nothing in here can
+    //switch fibers, so the thread cannot change under it.
+    thread_local std::vector<TaskData*> t_pendingTasks;
+    std::vector<TaskData*>& pendingTasks = t_pendingTasks;
+    pendingTasks.clear();
+    for (int i = 0; i < counts; ++i)
+    {
+        TaskData* taskData = findTask(tasks[i]);
+        CPY_ERROR_MSG(taskData != nullptr, "Missing task while scheduling it?");
+        if (taskData)
+            pendingTasks.push_back(taskData);
+    }
+
+    //walk the dependency tree of every task, and hand out the leaves that are ready to run.
+    //Tasks that still have pending dependencies get released later by onTaskComplete.
+    unsigned visitMark = m_visitMark.fetch_add(1, std::memory_order_relaxed) + 1;
+    while (!pendingTasks.empty())
+    {
+        TaskData* taskData = pendingTasks.back();
+        pendingTasks.pop_back();
+        if (taskData->visitMark.exchange(visitMark, std::memory_order_relaxed) == visitMark)
+            continue;
+
+        //graph tasks only start through launchGraph, dependents wait for its next launch.
+        if (taskData->inGraph || taskData->state.load(std::memory_order_acquire) != TaskState::Unscheduled)
+            continue;
+
+        if (taskData->pendingDependencies.load(std::memory_order_acquire) == 0)
+        {
+            tryLaunchTask(*taskData);
+            continue;
+        }
+
+        std::unique_lock lock(taskData->edgeLock);
+        taskData->dependencies.forEach([&pendingTasks](TaskData* dep)
+        {
+            if (dep->state.load(std::memory_order_acquire) == TaskState::Unscheduled)
+                pendingTasks.push_back(dep);
+        });
+    }
+}
+
+bool TaskSystem::tryLaunchTask(TaskData& taskData)
+{
+    CPY_ASSERT_MSG(!m_workers.empty(), "Task system must be started before executing tasks.");
+    if (m_workers.empty())
+        return false;
+
+    ThreadWorkerJob* job = claimJob(taskData);
+    if (job == nullptr)
+        return false;
+
+    //a worker keeps the work it releases in its own deque: it is the most likely to have the data
+    //hot, and idle peers steal from it anyway. Other threads spread their submissions round robin.
+    TaskLane lane = taskLane(taskData.desc.lane);
+    ThreadWorker* worker = localWorker(lane);
+    if (worker == nullptr)
+        worker = &nextWorker(lane);
+
+    worker->schedule(*job, taskData.desc.priority);
+    return true;
 }
 
-void TaskSystem::depends(Task src, Task dst)
+ThreadWorkerJob* TaskSystem::claimJob(TaskData& taskData)
 {
-    std::unique_lock lock(m_stateMutex);
+    //execute and the last completing dependency can race to launch the same task, the state decides.
+    TaskState expected = TaskState::Unscheduled;
+    if (!taskData.state.compare_exchange_strong(expected, TaskState::InWorker, std::memory_order_acq_rel))
+        return nullptr;
+
+    m_trace.record(TaskTraceEventType::Ready, taskData.handle.handleId, taskData.desc.name);
+
+    //the job lives in the task, so launching it allocates nothing and the functor is not copied.
+    ThreadWorkerJob& job = taskData.job;
+    job.fn = &taskData.desc.fn;
+    job.ctx = { taskData.handle, taskData.data, this };
+    job.userData = &taskData;
+    return &job;
+}
 
-    bool hasSrcTask = m_taskTable.contains(src);
-    bool hasDstTask = m_taskTable.contains(dst);
-    CPY_ASSERT_MSG(hasSrcTask, "Src task must exist");
-    CPY_ASSERT_MSG(hasDstTask, "Dst task must exist");
-    if (!hasSrcTask || !hasDstTask)
-        return;
+TaskLane TaskSystem::taskLane(TaskLane requested) const
+{
+    //a lane without threads falls back to the cpu lane.
+    return m_lanes[(int)requested].count > 0 ? requested : TaskLane::Cpu;
+}
 
-    TaskData& srcTaskData = m_taskTable[src];
-    TaskData& dstTaskData = m_taskTable[dst];
-    srcTaskData.initialDependencies.insert(dst);
-    srcTaskData.dependencies.insert(dst);
-    dstTaskData.parents.insert(src);
+ThreadWorker* TaskSystem::localWorker()
+{
+    ThreadWorker* worker = ThreadWorker::getLocalThreadWorker();
+    if (worker == nullptr || worker < m_workers.data() || worker >= m_workers.data() + m_workers.size())
+        return nullptr;
+    return worker;
 }
 
-void TaskSystem::depends(Task src, Task* dsts, int counts)
+ThreadWorker* TaskSystem::localWorker(TaskLane lane)
 {
-    std::unique_lock lock(m_stateMutex);
+    ThreadWorker* worker = localWorker();
+    const LaneRange& range = m_lanes[(int)lane];
+    if (worker == nullptr || worker < &m_workers[range.begin] || worker >= &m_workers[range.begin] + range.count)
+        return nullptr;
+    return worker;
+}
+
+ThreadWorker& TaskSystem::nextWorker(TaskLane lane)
+{
+    LaneRange& range = m_lanes[(int)lane];
+    int workerId = range.nextWorker.fetch_add(1, std::memory_order_relaxed) % range.count;
+    return m_workers[range.begin + workerId];
+}
 
-    bool hasSrcTask = m_taskTable.contains(src);
-    CPY_ASSERT_MSG(hasSrcTask, "Src task must exist");
-    if (!hasSrcTask)
+void TaskSystem::parallelFor(int begin, int end, int grainSize, ParallelForFn fn)
+{
+    int count = end - begin;
+    if (count <= 0 || !fn)
         return;
 
-    TaskData& srcTaskData = m_taskTable[src];
-    for (int i = 0; i < counts; ++i)
+    int workerCount = m_running ? m_lanes[(int)TaskLane::Cpu].count : 0;
+    if (grainSize <= 0)
+        grainSize = workerCount > 0 ? std::max(1, count / (workerCount * 8)) : count;
+
+    if (count <= grainSize || workerCount == 0)
     {
-        Task dstTask = dsts[i];
-        bool hasDstTask = m_taskTable.contains(dstTask);
-        CPY_ASSERT_MSG(hasDstTask, "Dst task must exist");
-        if (!hasDstTask)
-            continue;
-        
-        TaskData& dstTaskData = m_taskTable[dstTask];
+        fn(begin, end);
+        return;
+    }
+
+    ParallelForState state;
+    state.fn = &fn;
+    state.grainSize = grainSize;
+    state.pendingRanges = 1;
+    runParallelRange(state, begin, end);
+
+    if (localWorker() != nullptr)
+    {
+        //help with whatever is runnable while the rest of the ranges finish, and park on the idle event
+        //of the lane otherwise: it wakes for new work, and for the last range while helpers are registered.
+        //An io worker gets no ranges, so it mostly sleeps until they are done.
+        m_parallelForHelpers.fetch_add(1, std::memory_order_seq_cst);
+        ThreadWorker::helpUntil([&state]() { return state.pendingRanges.load(std::memory_order_seq_cst) == 0; });
+        m_parallelForHelpers.fetch_sub(1, std::memory_order_relaxed);
+        return;
+    }
 
-        srcTaskData.initialDependencies.insert(dstTask);
-        srcTaskData.dependencies.insert(dstTask);
-        dstTaskData.parents.insert(src);
+    while (state.pendingRanges.load(std::memory_order_acquire) != 0)
+    {
+        auto key = m_parallelForEvent.prepareWait();
+        if (state.pendingRanges.load(std::memory_order_acquire) == 0)
+        {
+            m_parallelForEvent.cancelWait();
+            break;
+        }
+        m_parallelForEvent.wait(key);
     }
 }
 
-void TaskSystem::onScheduleTask(Task* tasks, int counts)
+void TaskSystem::runParallelRange(ParallelForState& state, int begin, int end)
 {
-    struct RunCommand
+    //lazy binary splitting: hand off the upper half only while our own deque is empty, meaning
+    //previous halves got stolen. Otherwise keep eating grain sized chunks, so busy systems split little.
+    while (end - begin > state.grainSize)
     {
-        TaskContext context;
-        TaskFn fn;
-    };
+        ThreadWorker* worker = localWorker(TaskLane::Cpu);
+        if (worker != nullptr && worker->hasJobs())
+        {
+            int chunkEnd = begin + state.grainSize;
+            (*state.fn)(begin, chunkEnd);
+            begin = chunkEnd;
+            continue;
+        }
 
-    for (int i = 0; i < counts; ++i)
-    {
-        Task t = tasks[i];
+        int mid = begin + (end - begin) / 2;
+        int splitEnd = end;
+        ParallelForState* statePtr = &state;
+        state.pendingRanges.fetch_add(1, std::memory_order_relaxed);
+        TaskContext context = { Task(), nullptr, this };
+        TaskFn rangeFn = [statePtr, mid, splitEnd](TaskContext& ctx)
         {
-            std::unique_lock lock(m_stateMutex);
-            std::vector<Task> childTasks;
-            if (!m_taskTable.contains(t))
-            {
-                CPY_ERROR_MSG(false, "Missing task while scheduling it?");
-                continue;
-            }
-        
-            auto& taskData = m_taskTable[t];
-            if (taskData.syncData->state != TaskState::Unscheduled)
-                continue;
+            static_cast<TaskSystem*>(ctx.ts)->runParallelRange(*statePtr, mid, splitEnd);
+        };
+        (worker != nullptr ? *worker : nextWorker(TaskLane::Cpu)).schedule(rangeFn, context);
+        end = mid;
+    }
 
-            if (!taskData.dependencies.empty())
-            {
-                taskData.syncData->state = TaskState::Unscheduled;
-                for (auto dep : taskData.dependencies)
-                {
-                    if (m_taskTable[dep].syncData->state == TaskState::Unscheduled)
-                        childTasks.push_back(dep);
-                }
-            }
-            else
-            {
-                taskData.syncData->state = TaskState::InWorker;
-                taskData.syncData->workerId = m_nextWorker;
-                TaskContext context = { t, taskData.data, this };
-                m_workers[m_nextWorker].schedule(taskData.desc.fn, context);
-                m_nextWorker = (m_nextWorker + 1) % (int)m_workers.size();
-            }
-            execute(childTasks.data(), (int)childTasks.size());
+    if (begin < end)
+        (*state.fn)(begin, end);
+
+    //state lives in the stack of the parallelFor caller, so it cannot be touched after the last decrement.
+    //Either a helper registering sees the ranges done, or we see it registered.
+    if (state.pendingRanges.fetch_sub(1, std::memory_order_seq_cst) == 1)
+    {
+        m_parallelForEvent.notifyAll();
+        if (m_parallelForHelpers.load(std::memory_order_seq_cst) > 0)
+        {
+            for (EventCount& idleEvent : m_idleEvents)
+                idleEvent.notifyAll();
         }
     }
 }
 
-void TaskSystem::onMessageLoop()
+void TaskSystem::depends(Task src, Task dst)
+{
+    depends(src, &dst, 1);
+}
+
+void TaskSystem::depends(Task src, Task* dsts, int counts)
 {
-    bool active = true;
-    while (active)
+    std::shared_lock lock(m_stateMutex);
+
+    TaskData* srcTaskData = findTask(src);
+    CPY_ASSERT_MSG(srcTaskData != nullptr, "Src task must exist");
+    if (!srcTaskData)
+        return;
+
+    CPY_ASSERT_MSG(srcTaskData->state.load() == TaskState::Unscheduled, "Cannot add dependencies to a task that already started.");
+    CPY_ASSERT_MSG(!srcTaskData->inGraph, "Graph tasks can only depend on tasks recorded in their graph.");
+    for (int i = 0; i < counts; ++i)
     {
-        TaskScheduleMessage msg;
-        m_schedulerQueue->waitPop(msg);
-        switch (msg.type)
+        //a valid handle that does not resolve belongs to a task already reclaimed, so it has finished.
+        TaskData* dstTaskData = findTask(dsts[i]);
+        CPY_ASSERT_MSG(dstTaskData != nullptr || dsts[i].valid(), "Dst task must exist");
+        if (!dstTaskData)
+            continue;
+
+        //the edge keeps an auto released dst alive, until src gets removed.
+        if (dstTaskData->autoRelease && !tryAddRef(*dstTaskData))
+            continue;
+
         {
-        case TaskScheduleMessageType::RunJob:
-            onScheduleTask(&msg.task, 1);
-            break;
-        case TaskScheduleMessageType::RunJobs:
-            onScheduleTask(msg.tasks.data(), msg.tasks.size());
-            break;
-        case TaskScheduleMessageType::Exit:
-        default:
-            for (auto& w : m_workers)
-                w.signalStop();
-            active = false;
-            break;
+            std::unique_lock edgeLock(srcTaskData->edgeLock);
+            srcTaskData->dependencies.push(dstTaskData, m_edgePool);
+        }
+
+        {
+            //the edge is always recorded, but only counts as pending if dst has not completed yet.
+            //onTaskComplete flips the state under this same lock before walking its parents.
+            std::unique_lock edgeLock(dstTaskData->edgeLock);
+            dstTaskData->parents.push(srcTaskData, m_edgePool);
+            TaskState dstState = dstTaskData->state.load(std::memory_order_acquire);
+            if (dstState != TaskState::Completing && dstState != TaskState::Finished)
+                srcTaskData->pendingDependencies.fetch_add(1, std::memory_order_acq_rel);
         }
     }
 }
 
 void TaskSystem::runSingleJob(ThreadWorker& worker)
 {
-    TaskFn fn;
-    TaskContext ctx;
-    for (ThreadWorker& otherWorker : m_workers)
+    worker.runPendingJob();
+}
+
+ThreadWorkerJob* TaskSystem::onTaskComplete(TaskData& taskData)
+{
+    //a regular task can be cleaned and reused as soon as it reads Finished, so read this before.
+    bool autoRelease = taskData.autoRelease;
+    TaskWaiter* waiters = nullptr;
+    bool wakeHelpers = false;
+    ThreadWorkerJob* inlineJob = nullptr;
+    {
+        //no global lock: parents are released by decrementing their counters, and the ones
+        //that reach zero go straight into this worker's deque.
+        std::unique_lock edgeLock(taskData.edgeLock);
+        taskData.state.store(TaskState::Completing, std::memory_order_release);
+        waiters = taskData.waiters;
+        taskData.waiters = nullptr;
+        wakeHelpers = taskData.helpers > 0;
+        taskData.parents.forEach([this, &inlineJob](TaskData* parent)
+        {
+            if (parent->pendingDependencies.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                return;
+
+            //the first inline parent of our lane runs next on this thread, the worker loop picks it up.
+            bool runInline = inlineJob == nullptr
+                          && (parent->desc.flags & (int)TaskFlags::Inline) != 0
+                          && localWorker(taskLane(parent->desc.lane)) != nullptr;
+            if (runInline)
+                inlineJob = claimJob(*parent);
+            else
+                tryLaunchTask(*parent);
+        });
+    }
+
+    //Finished is the last write to the task, removeTasks waits for it before recycling it.
+    taskData.state.store(TaskState::Finished, std::memory_order_release);
+
+    while (waiters != nullptr)
     {
-        if (otherWorker.stealJob(fn, ctx))
+        //the waiter lives on the stack of the blocked thread, read it before the group can release it.
+        TaskWaiter* next = waiters->next;
+        TaskWaitGroup* group = waiters->group;
+        if (group->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
         {
-            worker.runInThread(fn, ctx);
-            return;
+            //notify under the lock, the thread cannot see done and free the group before we let go.
+            std::unique_lock lock(group->mutex);
+            group->done = true;
+            group->cv.notify_one();
         }
+        waiters = next;
     }
+
+    if (wakeHelpers)
+    {
+        for (EventCount& idleEvent : m_idleEvents)
+            idleEvent.notifyAll();
+    }
+
+    if (autoRelease)
+        releaseTask(taskData);
+
+    return inlineJob;
+}
+
+TaskSystem::TaskData* TaskSystem::findTask(Task t)
+{
+    //lock free: the result is only safe to use while something keeps the task alive.
+    if (!m_taskTable.contains(t))
+        return nullptr;
+    return m_taskTable[t];
 }
 
-void TaskSystem::onTaskComplete(Task t)
+TaskSystem::TaskData* TaskSystem::acquireTask(Task t)
 {
-    std::vector<Task> nextTasks;
-    SyncData* syncData = nullptr;
+    TaskData* taskData = findTask(t);
+    if (taskData == nullptr || !tryAddRef(*taskData))
+        return nullptr;
+
+    //the slot might have been reclaimed and reused between the lookup and the reference.
+    if (!m_taskTable.contains(t))
     {
-        std::unique_lock lock(m_stateMutex);
-        TaskData& taskData = m_taskTable[t];
-        syncData = taskData.syncData;
-        CPY_ERROR_MSG(syncData != nullptr, "Sync data not found when task has been completed.");
-        syncData->state = TaskState::Finished;
+        releaseTask(*taskData);
+        return nullptr;
+    }
 
-        for (auto p : taskData.parents)
-        {
-            auto& parentTask = m_taskTable[p];
-            parentTask.dependencies.erase(t);
-            if (parentTask.dependencies.empty() && parentTask.syncData->state == TaskState::Unscheduled)
-                nextTasks.push_back(p);
-        }
+    return taskData;
+}
 
-        {
-            std::unique_lock lock(m_finishedTasksMutex);
-            m_finishedTasksList.insert(t);
-        }
+bool TaskSystem::tryAddRef(TaskData& taskData)
+{
+    //a task that ran out of references is being reclaimed, it cannot come back.
+    int refs = taskData.refs.load(std::memory_order_acquire);
+    do
+    {
+        if (refs <= 0)
+            return false;
+    } while (!taskData.refs.compare_exchange_weak(refs, refs + 1, std::memory_order_acq_rel));
+    return true;
+}
+
+void TaskSystem::releaseTask(TaskData& taskData)
+{
+    //only auto released tasks run out of references, the rest are owned until cleaned.
+    if (taskData.refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
 
-        syncData->cv.notify_all();
+    std::unique_lock lock(m_stateMutex);
+    m_cleanTasks.clear();
+    m_cleanTasks.push_back(&taskData);
+    removeTasks(m_cleanTasks);
+}
+
+void TaskSystem::removeTasks(std::vector<TaskData*>& tasks)
+{
+    //must be called with m_stateMutex held exclusively. Auto released tasks losing their last
+    //reference on the way get removed in a following batch.
+    std::vector<TaskData*>& released = m_releasedTasks;
+    while (!tasks.empty())
+    {
+        released.clear();
+        removeTaskBatch(tasks, released);
+        tasks.swap(released);
     }
-    execute(nextTasks.data(), (int)nextTasks.size());
 }
 
-void TaskSystem::removeTask(Task t)
+void TaskSystem::removeTaskBatch(const std::vector<TaskData*>& tasks, std::vector<TaskData*>& released)
 {
-    auto& taskData = m_taskTable[t];
-    for (auto p : taskData.parents)
+    //Edges between tasks removed together are dropped in bulk, so cleaning a large tree costs one pass over its edges.
+    for (TaskData* taskData : tasks)
     {
-        if (!m_taskTable.contains(p))
-            continue;
-        auto& pdata = m_taskTable[p];
-        pdata.initialDependencies.erase(t);
-        pdata.dependencies.erase(t);
+        CPY_ASSERT_MSG(taskData->state.load() != TaskState::InWorker, "Cannot clean a task that is still running.");
+        taskData->removing = true;
+    }
+
+    for (TaskData* taskData : tasks)
+    {
+        //a completing task might still be inside onTaskComplete, wait for its last write.
+        while (taskData->state.load(std::memory_order_acquire) == TaskState::Completing)
+            std::this_thread::yield();
+
+        taskData->dependencies.forEach([this, taskData, &released](TaskData* dep)
+        {
+            if (dep->removing)
+                return;
+            {
+                std::unique_lock edgeLock(dep->edgeLock);
+                dep->parents.remove(taskData, m_edgePool);
+            }
+            if (dep->autoRelease && dep->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                released.push_back(dep);
+        });
+
+        taskData->parents.forEach([this, taskData](TaskData* parent)
+        {
+            if (parent->removing)
+                return;
+            std::unique_lock edgeLock(parent->edgeLock);
+            parent->dependencies.remove(taskData, m_edgePool);
+        });
+    }
+
+    for (TaskData* taskData : tasks)
+    {
+        //the task object stays in its slot for the next allocation, only the handle generation moves on.
+        taskData->refs = 0;
+        m_taskTable.free(taskData->handle, false);
+        taskData->dependencies.clear(m_edgePool);
+        taskData->parents.clear(m_edgePool);
+        taskData->handle = Task();
+        taskData->desc = TaskDesc();
+        taskData->data = nullptr;
+        taskData->state = TaskState::Unscheduled;
+        taskData->pendingDependencies = 0;
+        taskData->visitMark = 0;
+        taskData->removing = false;
+        taskData->inGraph = false;
+        taskData->autoRelease = false;
+        taskData->waiters = nullptr;
+        taskData->helpers = 0;
     }
-    delete taskData.syncData;
-    m_taskTable.free(t);
 }
 
 void TaskSystem::cleanFinishedTasks()
 {
     CPY_ASSERT_MSG(ThreadWorker::getLocalThreadWorker() == nullptr, "cleanFinishedTasks cannot be called from a worker thread.");
     std::unique_lock lock(m_stateMutex);
-    std::unique_lock lock2(m_finishedTasksMutex);
 
-    for (auto t : m_finishedTasksList)
-        removeTask(t);
+    std::vector<TaskData*>& finishedTasks = m_cleanTasks;
+    finishedTasks.clear();
+    m_taskTable.forEach([&finishedTasks](Task t, TaskData*& taskData)
+    {
+        if (!taskData->inGraph && !taskData->autoRelease && taskData->state.load(std::memory_order_acquire) == TaskState::Finished)
+            finishedTasks.push_back(taskData);
+    });
 
-    m_finishedTasksList.clear();
+    removeTasks(finishedTasks);
 }
 
 void TaskSystem::cleanTaskTree(Task src)
 {
     std::unique_lock lock(m_stateMutex);
-    std::unique_lock lock2(m_finishedTasksMutex);
-    std::vector<Task> tasksToClean;
-    std::set<Task> erasedTasks;
-    tasksToClean.push_back(src);
+    TaskData* srcTaskData = findTask(src);
+    if (!srcTaskData)
+        return;
+
+    std::vector<TaskData*>& tasksToClean = m_cleanTasks;
+    std::vector<TaskData*>& pendingTasks = m_cleanWalk;
+    tasksToClean.clear();
+    pendingTasks.clear();
+    unsigned visitMark = m_visitMark.fetch_add(1, std::memory_order_relaxed) + 1;
+    pendingTasks.push_back(srcTaskData);
+    while (!pendingTasks.empty())
+    {
+        TaskData* taskData = pendingTasks.back();
+        pendingTasks.pop_back();
+        //auto released tasks go away with their last reference, removing this tree drops the ones it holds.
+        if (taskData->inGraph || taskData->autoRelease || taskData->visitMark.exchange(visitMark, std::memory_order_relaxed) == visitMark)
+            continue;
+
+        tasksToClean.push_back(taskData);
+        taskData->dependencies.forEach([&pendingTasks](TaskData* dep) { pendingTasks.push_back(dep); });
+    }
+
+    removeTasks(tasksToClean);
+}
 
-    while (!tasksToClean.empty())
+TaskGraph TaskSystem::createGraph(const TaskGraphDesc& desc)
+{
+    int nodeCount = (int)desc.nodes.size();
+    std::vector<Task> handles(nodeCount + 1);
+    std::vector<bool> hasParents(nodeCount, false);
+    for (int i = 0; i < nodeCount; ++i)
+    {
+        CPY_ASSERT_MSG((desc.nodes[i].flags & ((int)TaskFlags::AutoStart | (int)TaskFlags::AutoRelease)) == 0, "Graph nodes cannot auto start or auto release, they live and run through the graph.");
+        TaskDesc nodeDesc = desc.nodes[i];
+        nodeDesc.flags &= ~((int)TaskFlags::AutoStart | (int)TaskFlags::AutoRelease);
+        handles[i] = createTask(nodeDesc, i < (int)desc.nodeData.size() ? desc.nodeData[i] : nullptr);
+    }
+
+    for (const auto& edge : desc.edges)
     {
-        auto t = tasksToClean.back();
-        tasksToClean.pop_back();
-        if (erasedTasks.insert(t).second == false)
+        CPY_ASSERT_MSG(edge.first >= 0 && edge.first < nodeCount && edge.second >= 0 && edge.second < nodeCount, "Graph edge references a node that does not exist.");
+        if (edge.first < 0 || edge.first >= nodeCount || edge.second < 0 || edge.second >= nodeCount)
             continue;
+        depends(handles[edge.first], handles[edge.second]);
+        hasParents[edge.second] = true;
+    }
+
+    //the task handed out on launch finishes after the top nodes, and so after the whole graph.
+    Task& sink = handles[nodeCount];
+    sink = createTask(TaskDesc("TaskGraph", nullptr), nullptr);
+    for (int i = 0; i < nodeCount; ++i)
+    {
+        if (!hasParents[i])
+            depends(sink, handles[i]);
+    }
 
-        auto& tableData = m_taskTable[t];
-        for (auto d : tableData.initialDependencies)
-            tasksToClean.push_back(d);
+    GraphData* graphData = new GraphData;
+    graphData->recordedData = desc.nodeData;
+    graphData->recordedData.resize(nodeCount, nullptr);
 
-        removeTask(t);
-        m_finishedTasksList.erase(t);
+    TaskGraph outHandle;
+    std::unique_lock lock(m_stateMutex);
+    for (Task handle : handles)
+    {
+        TaskData* taskData = findTask(handle);
+        int dependencyCount = taskData->pendingDependencies.load(std::memory_order_relaxed);
+        taskData->inGraph = true;
+        graphData->tasks.push_back(taskData);
+        graphData->dependencyCounts.push_back(dependencyCount);
+        if (dependencyCount == 0)
+            graphData->roots.push_back(taskData);
     }
+
+    CPY_ASSERT_MSG(nodeCount == 0 || !graphData->roots.empty(), "Task graph has no node without dependencies, it must contain a cycle.");
+    m_graphTable.allocate(outHandle) = graphData;
+    return outHandle;
 }
 
-bool TaskSystem::isTaskFinished(Task t)
+Task TaskSystem::launchGraph(TaskGraph graph, void* const* nodeData)
 {
     std::shared_lock lock(m_stateMutex);
-    SyncData* syncData = nullptr;
-    if (!m_taskTable.contains(t))
+    CPY_ASSERT_MSG(m_graphTable.contains(graph), "Cannot launch a task graph that does not exist.");
+    if (!m_graphTable.contains(graph))
+        return Task();
+
+    GraphData& graphData = *m_graphTable[graph];
+    TaskData& sink = *graphData.tasks.back();
+    CPY_ASSERT_MSG(!graphData.launched || sink.state.load(std::memory_order_acquire) == TaskState::Finished,
+        "Task graph launched while its previous launch is still running.");
+    graphData.launched = true;
+
     {
-        CPY_ASSERT_MSG(false, "Task does not exist");
-        return true;
+        //tasks depending on the previous launch have been released already, drop their edges so
+        //this launch cannot release them twice.
+        std::unique_lock edgeLock(sink.edgeLock);
+        sink.parents.forEach([this, &sink](TaskData* parent)
+        {
+            std::unique_lock parentLock(parent->edgeLock);
+            parent->dependencies.remove(&sink, m_edgePool);
+        });
+        sink.parents.clear(m_edgePool);
     }
-    
-    syncData = m_taskTable[t].syncData;
-    if (syncData == nullptr)
+
+    int nodeCount = (int)graphData.tasks.size() - 1;
+    for (int i = 0; i <= nodeCount; ++i)
     {
-        CPY_ASSERT_MSG(false, "Task does not exist");
-        return true;
+        TaskData& taskData = *graphData.tasks[i];
+
+        //the graph can finish while a node is still inside onTaskComplete, wait for its last write.
+        while (taskData.state.load(std::memory_order_acquire) == TaskState::Completing)
+            std::this_thread::yield();
+
+        if (i < nodeCount)
+            taskData.data = nodeData != nullptr ? nodeData[i] : graphData.recordedData[i];
+        taskData.pendingDependencies.store(graphData.dependencyCounts[i], std::memory_order_relaxed);
+        taskData.state.store(TaskState::Unscheduled, std::memory_order_release);
     }
-    
-    if (syncData->state == TaskState::Finished)
-        return true;
 
-    return false;
+    //only after every counter is reset, a fast node could release a parent that still holds the old state.
+    for (TaskData* root : graphData.roots)
+        tryLaunchTask(*root);
+
+    return sink.handle;
+}
+
+void TaskSystem::destroyGraph(TaskGraph graph)
+{
+    std::unique_lock lock(m_stateMutex);
+    CPY_ASSERT_MSG(m_graphTable.contains(graph), "Cannot destroy a task graph that does not exist.");
+    if (!m_graphTable.contains(graph))
+        return;
+
+    GraphData* graphData = m_graphTable[graph];
+    CPY_ASSERT_MSG(!graphData->launched || graphData->tasks.back()->state.load(std::memory_order_acquire) == TaskState::Finished,
+        "Cannot destroy a task graph that is still running.");
+
+    m_cleanTasks = graphData->tasks;
+    removeTasks(m_cleanTasks);
+    m_graphTable.free(graph);
+    delete graphData;
 }
 
 void TaskSystem::wait(Task other)
 {
-    ThreadWorker* worker = ThreadWorker::getLocalThreadWorker();
-    if (worker != nullptr)
+    //a valid handle that does not resolve anymore belongs to a reclaimed task, which has finished.
+    TaskData* taskData = acquireTask(other);
+    CPY_ASSERT_MSG(taskData != nullptr || other.valid(), "Cannot wait for task that does not exist");
+    if (!taskData)
+        return;
+
+    TaskWaiter waiter;
+    internalWait(&taskData, &waiter, 1);
+    releaseTask(*taskData);
+}
+
+void TaskSystem::waitAll(Task* tasks, int counts)
+{
+    //small groups wait off the stack like wait does, only large ones touch the heap.
+    enum { InlineWaits = 16 };
+    TaskData* inlineTaskDatas[InlineWaits];
+    TaskWaiter inlineWaiters[InlineWaits];
+    std::unique_ptr<TaskData*[]> heapTaskDatas;
+    std::unique_ptr<TaskWaiter[]> heapWaiters;
+    TaskData** taskDatas = inlineTaskDatas;
+    TaskWaiter* waiters = inlineWaiters;
+    if (counts > InlineWaits)
     {
-        bool finished = false;
-        while (!isTaskFinished(other))
-            runSingleJob(*worker);
+        heapTaskDatas.reset(new TaskData*[counts]);
+        heapWaiters.reset(new TaskWaiter[counts]);
+        taskDatas = heapTaskDatas.get();
+        waiters = heapWaiters.get();
     }
-    else
+
+    int acquired = 0;
+    for (int i = 0; i < counts; ++i)
     {
-        internalWait(other);
+        TaskData* taskData = acquireTask(tasks[i]);
+        CPY_ASSERT_MSG(taskData != nullptr || tasks[i].valid(), "Cannot wait for task that does not exist");
+        if (taskData)
+            taskDatas[acquired++] = taskData;
     }
+
+    if (acquired == 0)
+        return;
+
+    internalWait(taskDatas, waiters, acquired);
+    for (int i = 0; i < acquired; ++i)
+        releaseTask(*taskDatas[i]);
 }
 
-void TaskSystem::internalWait(Task other)
+void TaskSystem::internalWait(TaskData** tasks, TaskWaiter* waiters, int counts)
 {
-    SyncData* syncData = nullptr;
+    if (tasksFinished(tasks, counts))
+        return;
+
+    if (localWorker() != nullptr)
     {
-        std::shared_lock lock(m_stateMutex);
-        if (!m_taskTable.contains(other))
+        //help with runnable jobs of the lane, and park once there are none. Finishing any of the
+        //tasks wakes the idle events, so the condition gets checked again.
+        for (int i = 0; i < counts; ++i)
+            waiters[i].registered = tryAddWaiter(*tasks[i], nullptr);
+
+        ThreadWorker::helpUntil([tasks, counts]() { return tasksFinished(tasks, counts); });
+
+        for (int i = 0; i < counts; ++i)
         {
-            CPY_ASSERT_MSG(false, "Cannot wait for task that does not exist");
-            return;
+            if (waiters[i].registered)
+                removeHelper(*tasks[i]);
         }
+        return;
+    }
+
+    //the group starts with a count of its own, so it cannot complete before every waiter is queued.
+    TaskWaitGroup group;
+    group.pending.store(1, std::memory_order_relaxed);
+    for (int i = 0; i < counts; ++i)
+    {
+        waiters[i].group = &group;
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        if (!tryAddWaiter(*tasks[i], &waiters[i]))
+            group.pending.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    if (group.pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+    {
+        std::unique_lock lock(group.mutex);
+        group.cv.wait(lock, [&group]() { return group.done; });
+    }
+
+    //tasks caught while completing had no wake left to send, they finish right after.
+    bool finished = tasksFinished(tasks, counts);
+    CPY_ASSERT(finished);
+}
 
-        syncData = m_taskTable[other].syncData;
-        CPY_ERROR_MSG(syncData != nullptr, "Error, no sync data found during wait.");
+bool TaskSystem::tryAddWaiter(TaskData& taskData, TaskWaiter* waiter)
+{
+    //same lock onTaskComplete takes the waiters in: either it sees this one, or we see the task completing.
+    std::unique_lock edgeLock(taskData.edgeLock);
+    TaskState state = taskData.state.load(std::memory_order_acquire);
+    if (state == TaskState::Completing || state == TaskState::Finished)
+        return false;
+
+    if (waiter)
+    {
+        waiter->next = taskData.waiters;
+        taskData.waiters = waiter;
+    }
+    else
+    {
+        ++taskData.helpers;
     }
+    return true;
+}
+
+void TaskSystem::removeHelper(TaskData& taskData)
+{
+    std::unique_lock edgeLock(taskData.edgeLock);
+    --taskData.helpers;
+}
 
+bool TaskSystem::tasksFinished(TaskData* const* tasks, int counts)
+{
+    for (int i = 0; i < counts; ++i)
     {
-        std::unique_lock lock(syncData->m);
-        syncData->cv.wait(lock, [syncData]() { return syncData->state == TaskState::Finished; });
+        //completing is a short window with no wake at the end of it for late waiters, poll it out.
+        TaskState state = tasks[i]->state.load(std::memory_order_acquire);
+        while (state == TaskState::Completing)
+        {
+            std::this_thread::yield();
+            state = tasks[i]->state.load(std::memory_order_acquire);
+        }
+
+        if (state != TaskState::Finished)
+            return false;
     }
+    return true;
+}
+
+void TaskSystem::beginCapture()
+{
+    m_trace.beginCapture();
+}
+
+bool TaskSystem::endCapture(const char* path)
+{
+    return m_trace.endCapture(path);
 }
 
 void TaskSystem::getStats(ITaskSystem::Stats& outStats)
 {
-    std::shared_lock lock(m_stateMutex);
     outStats.numElements = m_taskTable.elementsCount();
+    outStats.numPoolSlabs = m_taskPool.slabCount() + m_edgePool.slabCount();
 }
 
 void TaskSystem::yield()
 {
-    ThreadWorker* localWorker = ThreadWorker::getLocalThreadWorker();
-    if (!localWorker)
+    ThreadWorker* worker = localWorker();
+    if (!worker)
         return;
     
-    runSingleJob(*localWorker);
+    runSingleJob(*worker);
 }
 
 
@@ -420,4 +899,15 @@ void TaskUtil::yieldUntil(TaskBlockFn fn)
     localWorker->waitUntil(fn);
 }
 
+void TaskUtil::suspendUntil(TaskAsyncFn startFn)
+{
+    ThreadWorker* localWorker = ThreadWorker::getLocalThreadWorker();
+    CPY_ASSERT_MSG(localWorker != nullptr, "Calling TaskUtil::suspendUntil in a non task context is illegal. This function must be called within a tasks callstack.");
+
+    if (!localWorker)
+        return;
+
+    localWorker->suspendUntil(startFn);
+}
+
 }
@@ -2,23 +2,23 @@
 
 #include <coalpy.tasks/ITaskSystem.h>
 #include <coalpy.core/HandleContainer.h>
+#include <coalpy.core/GenerationalHandleContainer.h>
+#include <coalpy.tasks/EventCount.h>
 #include "ThreadWorker.h"
+#include "FiberScheduler.h"
+#include "SpinLock.h"
+#include "TaskPool.h"
+#include "TaskTrace.h"
 #include <memory>
-#include <set>
 #include <mutex>
 #include <shared_mutex>
 #include <condition_variable>
-
-namespace std
-{
-class thread;
-}
+#include <atomic>
+#include <vector>
 
 namespace coalpy
 {
 
-class TaskSchedulerQueue;
-
 class TaskSystem : public ITaskSystem
 {
 public:
@@ -33,63 +33,153 @@ public:
     virtual void depends(Task src, Task dst) override;
     virtual void depends(Task src, Task* dsts, int counts) override;
     virtual void wait(Task other) override;
+    virtual void waitAll(Task* tasks, int counts) override;
     virtual void execute(Task task) override;
     virtual void execute(Task* tasks, int counts) override;
     virtual void cleanFinishedTasks() override;
     virtual void cleanTaskTree(Task src) override;
     virtual void yield() override;
+    virtual void parallelFor(int begin, int end, int grainSize, ParallelForFn fn) override;
+    virtual TaskGraph createGraph(const TaskGraphDesc& desc) override;
+    virtual Task launchGraph(TaskGraph graph, void* const* nodeData) override;
+    virtual void destroyGraph(TaskGraph graph) override;
+    virtual void beginCapture() override;
+    virtual bool endCapture(const char* path) override;
 
     void getStats(Stats& outStats) override;
 
 protected:
-    void onMessageLoop();
-    void runSingleJob(ThreadWorker& worker);
-    void onScheduleTask(Task* t, int counts);
-    void internalWait(Task other);
-    void removeTask(Task t);
-    bool isTaskFinished(Task t);
-
     enum class TaskState
     {
         Unscheduled,
         InWorker,
+        Completing,
         Finished
     };
 
-    struct SyncData
+    //threads outside the workers blocked on one or more tasks: each task finishing decrements pending,
+    //and the one reaching zero wakes the thread.
+    struct TaskWaitGroup
     {
-        TaskState state = TaskState::Unscheduled;
-        int workerId = -1;
-        std::mutex m;
+        std::atomic<int> pending = 0;
+        std::mutex mutex;
         std::condition_variable cv;
+        bool done = false;
     };
 
+    //lives on the stack of the blocked thread, linked into the task it waits on.
+    struct TaskWaiter
+    {
+        TaskWaitGroup* group = nullptr;
+        TaskWaiter* next = nullptr;
+        bool registered = false;
+    };
+
+    struct TaskData;
+    using TaskEdges = TaskEdgeList<TaskData*>;
+
     struct TaskData
     {
+        Task handle;
         TaskDesc desc;
         void* data = nullptr;
-        std::set<Task> initialDependencies;
-        std::set<Task> dependencies;
-        std::set<Task> parents;
-        SyncData* syncData = nullptr;
+        std::atomic<TaskState> state = TaskState::Unscheduled;
+        std::atomic<int> pendingDependencies = 0;
+        std::atomic<unsigned> visitMark = 0;
+        bool removing = false;
+
+        //owned by a graph template: only launchGraph starts it, and only destroyGraph cleans it.
+        bool inGraph = false;
+
+        //one reference while it has not finished (or until cleaned, if not auto released), one per task
+        //depending on it when auto released, plus the ones of threads waiting on it.
+        std::atomic<int> refs = 0;
+        bool autoRelease = false;
+
+        //edges are only touched while holding edgeLock. dependencies keep every task this one
+        //depends on (used to walk and clean trees), parents are the tasks waiting on this one.
+        SpinLock edgeLock;
+        TaskEdges dependencies;
+        TaskEdges parents;
+
+        //scheduled into a worker when the task launches.
+        ThreadWorkerJob job;
+
+        //threads waiting on it, guarded by edgeLock. onTaskComplete takes them in the same lock it flips
+        //the state to Completing, and wakes them once Finished. Workers are only counted: they help
+        //with other jobs meanwhile, and get woken through the idle event of their lane.
+        TaskWaiter* waiters = nullptr;
+        int helpers = 0;
+    };
 
-        TaskState state() { return syncData->state; }
+    struct GraphData
+    {
+        //the node tasks in recording order, followed by the task finishing the graph.
+        std::vector<TaskData*> tasks;
+        std::vector<int> dependencyCounts;
+        std::vector<void*> recordedData;
+        std::vector<TaskData*> roots;
+        bool launched = false;
     };
 
-    void onTaskComplete(Task task);
+    void runSingleJob(ThreadWorker& worker);
+    bool tryLaunchTask(TaskData& taskData);
+    ThreadWorkerJob* claimJob(TaskData& taskData);
+    TaskLane taskLane(TaskLane requested) const;
+    ThreadWorker* localWorker();
+    ThreadWorker* localWorker(TaskLane lane);
+    ThreadWorker& nextWorker(TaskLane lane);
+
+    struct ParallelForState
+    {
+        ParallelForFn* fn = nullptr;
+        int grainSize = 1;
+        std::atomic<int> pendingRanges = 0;
+    };
+
+    void runParallelRange(ParallelForState& state, int begin, int end);
+    TaskData* findTask(Task t);
+    TaskData* acquireTask(Task t);
+    bool tryAddRef(TaskData& taskData);
+    void releaseTask(TaskData& taskData);
+    void internalWait(TaskData** tasks, TaskWaiter* waiters, int counts);
+    bool tryAddWaiter(TaskData& taskData, TaskWaiter* waiter);
+    void removeHelper(TaskData& taskData);
+    static bool tasksFinished(TaskData* const* tasks, int counts);
+    void removeTasks(std::vector<TaskData*>& tasks);
+    void removeTaskBatch(const std::vector<TaskData*>& tasks, std::vector<TaskData*>& released);
+    ThreadWorkerJob* onTaskComplete(TaskData& taskData);
 
     TaskSystemDesc m_desc;
-    std::unique_ptr<TaskSchedulerQueue> m_schedulerQueue;
-    std::unique_ptr<std::thread> m_schedulerThread;
+    bool m_running = false;
+    struct LaneRange
+    {
+        int begin = 0;
+        int count = 0;
+        std::atomic<int> nextWorker = 0;
+    };
+
+    EventCount m_idleEvents[(int)TaskLane::Count];
+    EventCount m_parallelForEvent;
+    std::atomic<int> m_parallelForHelpers = 0; //workers parked in parallelFor, on the idle events of their lanes
+    TaskTrace m_trace;
+    std::unique_ptr<FiberScheduler> m_fiberScheduler;
     std::vector<ThreadWorker> m_workers;
+    LaneRange m_lanes[(int)TaskLane::Count];
 
+    //the mutex serializes creating and removing tasks, lookups and the graph itself are lock free.
     mutable std::shared_mutex m_stateMutex;
-    HandleContainer<Task, TaskData> m_taskTable;
+    GenerationalHandleContainer<Task, TaskData*> m_taskTable;
+    TaskPool<TaskData> m_taskPool;
+    TaskEdges::BlockPool m_edgePool;
+    HandleContainer<TaskGraph, GraphData*> m_graphTable;
 
-    mutable std::shared_mutex m_finishedTasksMutex;
-    std::set<Task> m_finishedTasksList;
+    //scratch of the cleaning functions, guarded by the exclusive lock of m_stateMutex.
+    std::vector<TaskData*> m_cleanTasks;
+    std::vector<TaskData*> m_cleanWalk;
+    std::vector<TaskData*> m_releasedTasks;
 
-    int m_nextWorker;
+    std::atomic<unsigned> m_visitMark = 0;
 };
 
 }
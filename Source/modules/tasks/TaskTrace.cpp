@@ -0,0 +1,231 @@
+#include "TaskTrace.h"
+#include <coalpy.core/Assert.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+#include <stdio.h>
+#include <string.h>
+
+namespace coalpy
+{
+
+struct TaskTraceEvent
+{
+    unsigned long long timestamp;
+    unsigned taskId;
+    TaskTraceEventType type;
+    char name[TaskTrace::NameLength];
+};
+
+struct TaskTraceBuffer
+{
+    enum { Capacity = 1 << 15 }; //must be a power of 2.
+
+    std::thread::id thread;
+    int index = 0;
+    std::atomic<unsigned long long> head = 0;
+    TaskTraceEvent events[Capacity];
+};
+
+namespace InternalTaskTrace
+{
+
+//capture ids are unique across all recorders, so a cached buffer never outlives its owner's capture.
+static std::atomic<unsigned> s_nextCaptureId = 0;
+
+struct ThreadCache
+{
+    unsigned captureId = 0;
+    TaskTraceBuffer* buffer = nullptr;
+};
+
+thread_local ThreadCache t_cache;
+
+static unsigned long long now()
+{
+    return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void writeEscaped(FILE* file, const char* str)
+{
+    for (; *str; ++str)
+    {
+        char c = *str;
+        if (c == '"' || c == '\\')
+            fprintf(file, "\\%c", c);
+        else if ((unsigned char)c < 0x20)
+            fprintf(file, "\\u%04x", (unsigned)c);
+        else
+            fputc(c, file);
+    }
+}
+
+}
+
+TaskTrace::TaskTrace()
+{
+}
+
+TaskTrace::~TaskTrace()
+{
+    for (TaskTraceBuffer* buffer : m_buffers)
+        delete buffer;
+}
+
+void TaskTrace::beginCapture()
+{
+    CPY_ASSERT_MSG(!capturing(), "Task system capture already started, call endCapture first.");
+    if (capturing())
+        return;
+
+    {
+        std::unique_lock lock(m_buffersMutex);
+        for (TaskTraceBuffer* buffer : m_buffers)
+            buffer->head.store(0, std::memory_order_relaxed);
+    }
+
+    m_captureStart = InternalTaskTrace::now();
+    m_captureId.store(++InternalTaskTrace::s_nextCaptureId, std::memory_order_relaxed);
+    m_capturing.store(true, std::memory_order_release);
+}
+
+TaskTraceBuffer* TaskTrace::localBuffer()
+{
+    InternalTaskTrace::ThreadCache& cache = InternalTaskTrace::t_cache;
+    unsigned captureId = m_captureId.load(std::memory_order_relaxed);
+    if (cache.captureId == captureId)
+        return cache.buffer;
+
+    //first event of this thread in this capture: reuse the thread's ring if it has one.
+    std::unique_lock lock(m_buffersMutex);
+    std::thread::id thread = std::this_thread::get_id();
+    auto it = std::find_if(m_buffers.begin(), m_buffers.end(), [thread](TaskTraceBuffer* b) { return b->thread == thread; });
+    TaskTraceBuffer* buffer = nullptr;
+    if (it != m_buffers.end())
+    {
+        buffer = *it;
+    }
+    else
+    {
+        buffer = new TaskTraceBuffer;
+        buffer->thread = thread;
+        buffer->index = (int)m_buffers.size();
+        m_buffers.push_back(buffer);
+    }
+
+    cache.captureId = captureId;
+    cache.buffer = buffer;
+    return buffer;
+}
+
+void TaskTrace::record(TaskTraceEventType type, unsigned taskId, const char* name)
+{
+    if (!capturing())
+        return;
+
+    TaskTraceBuffer* buffer = localBuffer();
+    unsigned long long head = buffer->head.load(std::memory_order_relaxed);
+    TaskTraceEvent& ev = buffer->events[head & (TaskTraceBuffer::Capacity - 1)];
+    ev.timestamp = InternalTaskTrace::now();
+    ev.taskId = taskId;
+    ev.type = type;
+    ev.name[0] = '\0';
+    if (name)
+    {
+        strncpy(ev.name, name, sizeof(ev.name) - 1);
+        ev.name[sizeof(ev.name) - 1] = '\0';
+    }
+
+    //only the owner thread writes, readers see every event before head.
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+bool TaskTrace::endCapture(const char* path)
+{
+    CPY_ASSERT_MSG(capturing(), "Task system capture must be started before ending it.");
+    if (!capturing())
+        return false;
+
+    m_capturing.store(false, std::memory_order_release);
+
+    struct SortedEvent
+    {
+        TaskTraceEvent ev;
+        int threadIndex;
+    };
+
+    std::vector<SortedEvent> events;
+    int threadCount = 0;
+    {
+        std::unique_lock lock(m_buffersMutex);
+        threadCount = (int)m_buffers.size();
+        for (TaskTraceBuffer* buffer : m_buffers)
+        {
+            //a thread that saw the capture running right before it stopped might still be writing
+            //the slot at head, which once wrapped is the oldest one: skip it.
+            unsigned long long head = buffer->head.load(std::memory_order_acquire);
+            unsigned long long first = head > TaskTraceBuffer::Capacity ? head - TaskTraceBuffer::Capacity + 1 : 0;
+            for (unsigned long long i = first; i < head; ++i)
+                events.push_back(SortedEvent { buffer->events[i & (TaskTraceBuffer::Capacity - 1)], buffer->index });
+        }
+    }
+
+    std::stable_sort(events.begin(), events.end(), [](const SortedEvent& a, const SortedEvent& b) { return a.ev.timestamp < b.ev.timestamp; });
+
+    FILE* file = fopen(path, "w");
+    CPY_ERROR_FMT(file != nullptr, "Could not open task capture file %s", path);
+    if (!file)
+        return false;
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool firstEvent = true;
+    for (int t = 0; t < threadCount; ++t)
+    {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}", firstEvent ? "" : ",\n", t, t);
+        firstEvent = false;
+    }
+
+    //task ids get recycled, so a task is named by its latest Created or Ready event.
+    std::unordered_map<unsigned, std::string> names;
+    for (const SortedEvent& sorted : events)
+    {
+        const TaskTraceEvent& ev = sorted.ev;
+        if (ev.type == TaskTraceEventType::Created || ev.type == TaskTraceEventType::Ready)
+            names[ev.taskId] = ev.name[0] ? ev.name : "task";
+
+        const char* phase = "i";
+        const char* prefix = "";
+        switch (ev.type)
+        {
+        case TaskTraceEventType::Created: prefix = "create "; break;
+        case TaskTraceEventType::Ready: prefix = "ready "; break;
+        case TaskTraceEventType::Begin:
+        case TaskTraceEventType::Resume: phase = "B"; break;
+        case TaskTraceEventType::End:
+        case TaskTraceEventType::Yield: phase = "E"; break;
+        }
+
+        std::string name = "parallelFor";
+        if (ev.taskId != ~0u)
+        {
+            auto it = names.find(ev.taskId);
+            name = it != names.end() ? it->second : "task";
+        }
+
+        double ts = (double)(ev.timestamp - std::min(ev.timestamp, m_captureStart)) / 1000.0;
+        fprintf(file, ",\n{\"name\":\"%s", prefix);
+        InternalTaskTrace::writeEscaped(file, name.c_str());
+        fprintf(file, "\",\"cat\":\"task\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":0,\"tid\":%d", phase, ts, sorted.threadIndex);
+        if (phase[0] == 'i')
+            fprintf(file, ",\"s\":\"t\"");
+        fprintf(file, ",\"args\":{\"task\":%d%s}}", (int)ev.taskId, ev.type == TaskTraceEventType::Resume ? ",\"resumed\":true" : "");
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return true;
+}
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <string>
+
+namespace coalpy
+{
+
+struct TaskTraceBuffer;
+
+enum class TaskTraceEventType : unsigned char
+{
+    Created,
+    Ready,
+    Begin,
+    End,
+    Yield,
+    Resume
+};
+
+//Timeline recorder of the task system. Every thread writes into its own ring of fixed size
+//events, so recording takes no locks. Rings are only read back once the capture has stopped.
+class TaskTrace
+{
+public:
+    enum { NameLength = 19 };
+
+    TaskTrace();
+    ~TaskTrace();
+
+    bool capturing() const { return m_capturing.load(std::memory_order_relaxed); }
+
+    void beginCapture();
+
+    //Stops recording and writes every event as a chrome trace json (chrome://tracing, ui.perfetto.dev).
+    bool endCapture(const char* path);
+
+    //name is only read for Created and Ready events, later events of a task refer to it by id.
+    void record(TaskTraceEventType type, unsigned taskId, const char* name = nullptr);
+
+private:
+    TaskTraceBuffer* localBuffer();
+
+    std::atomic<bool> m_capturing = false;
+    std::atomic<unsigned> m_captureId = 0;
+    unsigned long long m_captureStart = 0;
+
+    std::mutex m_buffersMutex;
+    std::vector<TaskTraceBuffer*> m_buffers;
+};
+
+}
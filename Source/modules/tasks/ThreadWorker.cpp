@@ -1,7 +1,16 @@
 #include "ThreadWorker.h"
-#include <coalpy.tasks/ThreadQueue.h>
+#include "WorkStealingDeque.h"
+#include "FiberScheduler.h"
+#include "TaskTrace.h"
+#include "TaskPool.h"
+#include <coalpy.tasks/MpmcQueue.h>
+#include <coalpy.tasks/EventCount.h>
 #include <coalpy.core/Assert.h>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <set>
 #include <iostream>
 
 namespace coalpy
@@ -10,43 +19,121 @@ namespace coalpy
 enum class ThreadMessageType
 {
     Exit,
-    Signal,
-    RunJob,
     RunAuxLambda
 };
 
 struct ThreadWorkerMessage
 {
     ThreadMessageType type = ThreadMessageType::Exit;
-    TaskFn fn = {};
     TaskBlockFn blockFn = {};
-    TaskContext ctx = {};
     int targetStack = -1;
 };
 
-class ThreadWorkerQueue : public ThreadQueue<ThreadWorkerMessage>
+class ThreadWorkerQueue : public MpmcQueue<ThreadWorkerMessage> {};
+class ThreadWorkerJobPool : public TaskPool<ThreadWorkerJob> {};
+
+//Jobs scheduled by threads other than the owner. The owner (or any thief) moves them out.
+struct ThreadWorkerInbox
+{
+    std::mutex mutex;
+    std::vector<ThreadWorkerJob*> jobs;
+    size_t head = 0; //jobs before it got stolen, dropped once the owner drains the rest
+    std::atomic<int> count = 0;
+};
+
+//One deque and inbox per priority class, so higher classes can be drained first.
+struct ThreadWorkerPriorityQueue
+{
+    WorkStealingDeque<ThreadWorkerJob*> deque;
+    ThreadWorkerInbox inbox;
+};
+
+struct ThreadWorkerState
 {
-public:
-    void addInactiveMessage(ThreadWorkerMessage& msg)
+    ThreadWorkerPriorityQueue queues[(int)TaskPriority::Count];
+    ThreadWorkerJobPool jobPool;
+    ThreadWorkerQueue auxQueue;
+    std::atomic<bool> stopRequested = false;
+
+    //stack depths whose aux lambda has finished, and are ready to unwind.
+    std::mutex releasedMutex;
+    std::set<int> releasedDepths;
+    std::atomic<int> releasedCount = 0;
+
+    bool isReleased(int depth)
     {
-        m_inactiveMessages.push_back(msg);
+        if (releasedCount.load(std::memory_order_acquire) == 0)
+            return false;
+        std::unique_lock lock(releasedMutex);
+        return releasedDepths.find(depth) != releasedDepths.end();
     }
 
-    void recoverInactiveMessages()
+    bool consumeRelease(int depth)
     {
-        for (const auto& m : m_inactiveMessages)
-        {
-            push(m);
-        }
-
-        m_inactiveMessages.clear();
+        if (releasedCount.load(std::memory_order_acquire) == 0)
+            return false;
+        std::unique_lock lock(releasedMutex);
+        auto it = releasedDepths.find(depth);
+        if (it == releasedDepths.end())
+            return false;
+        releasedDepths.erase(it);
+        releasedCount.fetch_sub(1, std::memory_order_release);
+        return true;
     }
 
-private:
-    std::vector<ThreadWorkerMessage> m_inactiveMessages;
+    void release(int depth)
+    {
+        std::unique_lock lock(releasedMutex);
+        releasedDepths.insert(depth);
+        releasedCount.fetch_add(1, std::memory_order_release);
+    }
 };
 
 thread_local ThreadWorker* t_localWorker = nullptr;
+thread_local bool t_isAuxThread = false;
+
+//Per thread bookkeeping of fiber mode. The switch action is left by the fiber switching away,
+//and carried out by whichever fiber resumes on this thread, once the old context is saved.
+struct FiberThreadState
+{
+    Fiber* threadFiber = nullptr;
+    Fiber* currentFiber = nullptr;
+    int switchAction = 0;
+    Fiber* switchFiber = nullptr;
+    const TaskBlockFn* switchBlockFn = nullptr;
+    const TaskAsyncFn* switchAsyncFn = nullptr;
+};
+
+thread_local FiberThreadState t_fiberState;
+
+//task of the job running on this thread, for the trace. Whoever resumes a job restores it.
+thread_local unsigned t_currentTaskId = Task::InvalidId;
+
+//A fiber can resume on a different thread, so code that runs across a switch must not reuse
+//thread local addresses the compiler computed before it. These accessors are opaque to the
+//optimizer (gcc would otherwise infer them as const and merge calls around a switch).
+#if defined(_MSC_VER)
+#define CPY_TLS_ACCESSOR __declspec(noinline)
+#elif defined(__clang__)
+#define CPY_TLS_ACCESSOR __attribute__((noinline))
+#else
+#define CPY_TLS_ACCESSOR __attribute__((noinline, noipa))
+#endif
+
+CPY_TLS_ACCESSOR static ThreadWorker* currentWorker()
+{
+    return t_localWorker;
+}
+
+CPY_TLS_ACCESSOR static FiberThreadState* fiberThreadState()
+{
+    return &t_fiberState;
+}
+
+CPY_TLS_ACCESSOR static unsigned* currentTaskId()
+{
+    return &t_currentTaskId;
+}
 
 ThreadWorker::ThreadWorker()
 {
@@ -58,25 +145,31 @@ ThreadWorker::~ThreadWorker()
     join();
     CPY_ASSERT(m_thread == nullptr);
     CPY_ASSERT(m_auxThread == nullptr);
-    if (m_queue)
-        delete m_queue;
+    if (m_state)
+        delete m_state;
+}
 
-    if (m_auxQueue)
-        delete m_auxQueue;
+void ThreadWorker::init(ThreadWorker* peers, int peerCount, EventCount* idleEvent, OnTaskCompleteFn onTaskCompleteFn, FiberScheduler* fiberScheduler)
+{
+    CPY_ASSERT_MSG(m_thread == nullptr, "system must call signalStop and then join to re-initialize the thread worker.");
+    CPY_ASSERT(idleEvent != nullptr);
+    m_peers = peers;
+    m_peerCount = peerCount;
+    m_idleEvent = idleEvent;
+    m_onTaskCompleteFn = onTaskCompleteFn;
+    m_fibers = fiberScheduler;
+    if (!m_state)
+        m_state = new ThreadWorkerState;
+    m_state->stopRequested = false;
 }
 
-void ThreadWorker::start(OnTaskCompleteFn onTaskCompleteFn)
+void ThreadWorker::start()
 {
     CPY_ASSERT_MSG(m_thread == nullptr, "system must call signalStop and then join to restart the thread worker.");
-    if (m_thread)
+    CPY_ASSERT_MSG(m_state != nullptr, "thread worker must be initialized before starting.");
+    if (m_thread || !m_state)
         return;
 
-    m_onTaskCompleteFn = onTaskCompleteFn;
-    if (!m_queue)
-        m_queue = new ThreadWorkerQueue;
-    if (!m_auxQueue)
-        m_auxQueue = new ThreadWorkerQueue;
-
     CPY_ASSERT(m_thread == nullptr && m_auxThread == nullptr);
 
     m_thread = new std::thread(
@@ -84,15 +177,23 @@ void ThreadWorker::start(OnTaskCompleteFn onTaskCompleteFn)
         CPY_ASSERT(t_localWorker == nullptr);
         t_localWorker = this;
         m_activeDepth = 0;
-        this->run();
+        if (m_fibers)
+            this->runFibers();
+        else
+            this->run();
         CPY_ASSERT(m_activeDepth == 0);
         t_localWorker = nullptr;
     });
 
+    //fiber mode hands blocking calls to the shared pool of the fiber scheduler instead.
+    if (m_fibers)
+        return;
+
     m_auxThread = new std::thread(
     [this](){
         CPY_ASSERT(t_localWorker == nullptr);
         t_localWorker = this;
+        t_isAuxThread = true;
         this->auxLoop();
         t_localWorker = nullptr;
     });
@@ -100,78 +201,408 @@ void ThreadWorker::start(OnTaskCompleteFn onTaskCompleteFn)
 
 int ThreadWorker::queueSize() const
 {
-    if (!m_queue)
+    if (!m_state)
         return 0;
-    return m_queue->size();
+    int size = 0;
+    for (const ThreadWorkerPriorityQueue& queue : m_state->queues)
+        size += queue.deque.size() + queue.inbox.count.load(std::memory_order_relaxed);
+    return size;
+}
+
+bool ThreadWorker::hasJobs() const
+{
+    if (!m_state)
+        return false;
+
+    for (const ThreadWorkerPriorityQueue& queue : m_state->queues)
+        if (!queue.deque.empty() || queue.inbox.count.load(std::memory_order_relaxed) > 0)
+            return true;
+    return false;
+}
+
+bool ThreadWorker::hasWorkAvailable() const
+{
+    for (int i = 0; i < m_peerCount; ++i)
+        if (m_peers[i].hasJobs())
+            return true;
+    return false;
+}
+
+ThreadWorkerJob* ThreadWorker::popJob(TaskPriority priority)
+{
+    ThreadWorkerPriorityQueue& queue = m_state->queues[(int)priority];
+    if (ThreadWorkerJob* job = queue.deque.pop())
+        return job;
+
+    //move jobs scheduled from other threads into our deque, so thieves can balance them.
+    ThreadWorkerInbox& inbox = queue.inbox;
+    if (inbox.count.load(std::memory_order_acquire) == 0)
+        return nullptr;
+
+    ThreadWorkerJob* result = nullptr;
+    {
+        std::unique_lock lock(inbox.mutex);
+        for (size_t i = inbox.head; i < inbox.jobs.size(); ++i)
+        {
+            if (result == nullptr)
+                result = inbox.jobs[i];
+            else
+                queue.deque.push(inbox.jobs[i]);
+        }
+        inbox.count.fetch_sub((int)(inbox.jobs.size() - inbox.head), std::memory_order_release);
+        inbox.jobs.clear();
+        inbox.head = 0;
+    }
+
+    if (!queue.deque.empty())
+        m_idleEvent->notifyOne();
+
+    return result;
+}
+
+ThreadWorkerJob* ThreadWorker::stealJob(TaskPriority priority)
+{
+    if (!m_state)
+        return nullptr;
+
+    ThreadWorkerPriorityQueue& queue = m_state->queues[(int)priority];
+    if (ThreadWorkerJob* job = queue.deque.steal())
+        return job;
+
+    ThreadWorkerInbox& inbox = queue.inbox;
+    if (inbox.count.load(std::memory_order_acquire) == 0)
+        return nullptr;
+
+    std::unique_lock lock(inbox.mutex, std::try_to_lock);
+    if (!lock.owns_lock() || inbox.head == inbox.jobs.size())
+        return nullptr;
+
+    //oldest first without shifting the rest: a burst of external jobs stays linear to steal.
+    ThreadWorkerJob* job = inbox.jobs[inbox.head++];
+    if (inbox.head == inbox.jobs.size())
+    {
+        inbox.jobs.clear();
+        inbox.head = 0;
+    }
+    inbox.count.fetch_sub(1, std::memory_order_release);
+    return job;
+}
+
+ThreadWorkerJob* ThreadWorker::findJob()
+{
+    //a higher class is stolen from peers before a lower one is taken from our own deque.
+    for (int p = 0; p < (int)TaskPriority::Count; ++p)
+    {
+        auto priority = (TaskPriority)p;
+
+        //the aux thread is not the owner of the deque, so it can only steal (from its own worker too).
+        if (!t_isAuxThread)
+        {
+            if (ThreadWorkerJob* job = popJob(priority))
+                return job;
+        }
+
+        for (int i = t_isAuxThread ? 0 : 1; i < m_peerCount; ++i)
+        {
+            ThreadWorker& victim = m_peers[(m_workerId + i) % m_peerCount];
+            if (ThreadWorkerJob* job = victim.stealJob(priority))
+                return job;
+        }
+    }
+
+    return nullptr;
+}
+
+ThreadWorkerJob* ThreadWorker::spinForJob()
+{
+    //stay awake polling for a while before parking. Schedules skip the kernel wake while anyone
+    //spins, which on bursts of small jobs saves one per job. Anything else that would wake us
+    //cuts the spin short, the caller re-checks it before parking anyway.
+    m_idleEvent->beginSpin();
+    ThreadWorkerJob* job = nullptr;
+    for (int i = 0; i < SpinCount; ++i)
+    {
+        if (m_state->stopRequested.load(std::memory_order_relaxed)
+         || m_state->releasedCount.load(std::memory_order_relaxed) != 0
+         || (m_fibers && m_fibers->hasReady()))
+            break;
+
+        job = findJob();
+        if (job)
+            break;
+        std::this_thread::yield();
+    }
+
+    //the last spinner to find work hands the search over to a parked peer, in case there is more.
+    if (m_idleEvent->endSpin() && job && hasWorkAvailable())
+        m_idleEvent->notifyOne();
+    return job;
 }
 
 void ThreadWorker::run()
 {
-    bool active = true;
-    while (active)
+    const int depth = m_activeDepth;
+    while (true)
     {
-        ThreadWorkerMessage msg;
-        m_queue->waitPop(msg);
+        //a nested run() exits once the aux thread has finished the blocking call for this depth.
+        if (depth > 0 && m_state->consumeRelease(depth))
+            break;
 
-        switch (msg.type)
+        ThreadWorkerJob* job = findJob();
+        if (!job)
+            job = spinForJob();
+        if (job)
         {
-        case ThreadMessageType::RunJob:
+            runJob(job);
+            continue;
+        }
+
+        if (depth == 0 && m_state->stopRequested.load())
+        {
+            //the stop flag is raised after the last schedule, so look once more before leaving.
+            if (ThreadWorkerJob* job = findJob())
             {
-                runInThread(msg.fn, msg.ctx);
+                runJob(job);
+                continue;
             }
             break;
-        case ThreadMessageType::Exit:
-        default:
-            {
-                if (msg.targetStack == m_activeDepth || msg.targetStack < 0)
-                {
-                    active = false;
-                }
-                else
-                {
-                    m_queue->addInactiveMessage(msg);
-                }
-            }
         }
+
+        auto key = m_idleEvent->prepareWait();
+        bool canContinue = (depth > 0 && m_state->isReleased(depth))
+                        || (depth == 0 && m_state->stopRequested.load())
+                        || hasWorkAvailable();
+        if (canContinue)
+        {
+            m_idleEvent->cancelWait();
+            continue;
+        }
+        m_idleEvent->wait(key);
     }
 }
 
-bool ThreadWorker::stealJob(TaskFn& outFn, TaskContext& payload)
+bool ThreadWorker::runPendingJob()
 {
-    bool result = false;
-    std::vector<ThreadWorkerMessage> tmpMessages;
-    m_queue->acquireThread();
-    ThreadWorkerMessage currMessage;
-    while (m_queue->unsafePop(currMessage))
+    CPY_ASSERT(getLocalThreadWorker() == this);
+    if (ThreadWorkerJob* job = findJob())
     {
-        if (currMessage.type == ThreadMessageType::RunJob)
+        runJob(job);
+        return true;
+    }
+
+    //nothing to run: let a resumable fiber make progress, and queue the current one in its place.
+    if (m_fibers && !t_isAuxThread)
+    {
+        if (Fiber* readyFiber = m_fibers->popReady())
         {
-            outFn = currMessage.fn;
-            payload = currMessage.ctx;
-            result = true;
-            break;
+            switchFiber(readyFiber, FiberSwitchAction::Requeue);
+            return true;
         }
-        else
+    }
+
+    return false;
+}
+
+void ThreadWorker::helpUntil(const HelpDoneFn& isDone)
+{
+    int idleSpins = 0;
+    while (!isDone())
+    {
+        //fetch the worker every time, in fiber mode a nested job can resume us on another thread.
+        //only go through the queues of the lane when one of them holds a job we could steal.
+        ThreadWorker* worker = getLocalThreadWorker();
+        bool runnable = worker->hasWorkAvailable() || (worker->m_fibers && !t_isAuxThread && worker->m_fibers->hasReady());
+        if (runnable && worker->runPendingJob())
+        {
+            idleSpins = 0;
+            continue;
+        }
+
+        //what we wait on most likely runs on another worker, give it a moment before parking.
+        if (idleSpins < SpinCount)
         {
-            tmpMessages.push_back(currMessage);
+            ++idleSpins;
+            std::this_thread::yield();
+            continue;
         }
+
+        EventCount* idleEvent = worker->m_idleEvent;
+        auto key = idleEvent->prepareWait();
+        bool canContinue = isDone()
+                        || worker->hasWorkAvailable()
+                        || (worker->m_fibers && !t_isAuxThread && worker->m_fibers->hasReady());
+        if (canContinue)
+        {
+            idleEvent->cancelWait();
+            continue;
+        }
+        idleEvent->wait(key);
     }
+}
 
-    for (auto& tmpMsg : tmpMessages)
-        m_queue->unsafePush(tmpMsg);
-    m_queue->releaseThread();
-    return result;
+void ThreadWorker::runJob(ThreadWorkerJob* job)
+{
+    //continuations handed back by the completion callback run in this same loop, so chains do not grow the stack.
+    while (job != nullptr)
+    {
+        unsigned taskId = job->ctx.task.handleId;
+        unsigned parentTaskId = *currentTaskId();
+        *currentTaskId() = taskId;
+        if (TaskTrace* trace = currentWorker()->m_trace)
+            trace->record(TaskTraceEventType::Begin, taskId);
+
+        if (job->fn && *job->fn)
+            (*job->fn)(job->ctx);
+
+        //in fiber mode the job might have yielded and resumed on a different worker.
+        ThreadWorker* worker = currentWorker();
+        if (worker->m_trace)
+            worker->m_trace->record(TaskTraceEventType::End, taskId);
+        *currentTaskId() = parentTaskId;
+
+        //a job owned by the caller can be recycled as soon as it is reported complete, read it before.
+        ThreadWorkerJobPool* pool = job->pool;
+        ThreadWorkerJob* nextJob = nullptr;
+        if (worker->m_onTaskCompleteFn)
+            nextJob = worker->m_onTaskCompleteFn(*job);
+
+        if (pool)
+        {
+            job->ownedFn = nullptr;
+            pool->release(job);
+        }
+
+        job = nextJob;
+    }
 }
 
-void ThreadWorker::runInThread(TaskFn fn, TaskContext& payload)
+void ThreadWorker::runFibers()
 {
-    CPY_ASSERT(getLocalThreadWorker() == this);
+    FiberThreadState* fiberState = fiberThreadState();
+    fiberState->threadFiber = InternalFiber::createFromThread();
+    fiberState->currentFiber = fiberState->threadFiber;
+
+    //returns once a loop fiber sees the stop request and switches back to this thread's context.
+    switchFiber(m_fibers->acquireLoopFiber(), FiberSwitchAction::None);
+
+    fiberState = fiberThreadState();
+    InternalFiber::destroyFromThread(fiberState->threadFiber);
+    *fiberState = FiberThreadState();
+}
+
+void ThreadWorker::fiberEntry(void* arg)
+{
+    onFiberResumed();
+    fiberLoop();
+}
+
+void ThreadWorker::fiberLoop()
+{
+    //loop fibers get parked and resumed on other threads, so nothing here can hold on to a worker
+    //across a job or a switch.
+    while (true)
+    {
+        ThreadWorker* worker = currentWorker();
+        FiberScheduler& fibers = *worker->m_fibers;
+
+        if (Fiber* readyFiber = fibers.popReady())
+        {
+            //this loop has nothing on its stack, park it and continue the suspended task instead.
+            switchFiber(readyFiber, FiberSwitchAction::ParkLoop);
+            continue;
+        }
+
+        ThreadWorkerJob* job = worker->findJob();
+        if (!job)
+            job = worker->spinForJob();
+        if (job)
+        {
+            runJob(job);
+            continue;
+        }
+
+        //suspended tasks still need a worker to finish, so only stop once there are none.
+        bool canStop = worker->m_state->stopRequested.load() && fibers.suspendedCount() == 0 && !fibers.hasReady();
+        if (canStop)
+        {
+            //the stop flag is raised after the last schedule, so look once more before leaving.
+            if (ThreadWorkerJob* job = worker->findJob())
+            {
+                runJob(job);
+                continue;
+            }
+            switchFiber(fiberThreadState()->threadFiber, FiberSwitchAction::ParkLoop);
+            continue;
+        }
 
-    if (fn)
-        fn(payload);
-    
-    if (m_onTaskCompleteFn)
-        m_onTaskCompleteFn(payload.task);
+        auto key = worker->m_idleEvent->prepareWait();
+        bool canContinue = (worker->m_state->stopRequested.load() && fibers.suspendedCount() == 0)
+                        || fibers.hasReady()
+                        || worker->hasWorkAvailable();
+        if (canContinue)
+        {
+            worker->m_idleEvent->cancelWait();
+            continue;
+        }
+        worker->m_idleEvent->wait(key);
+    }
+}
+
+void ThreadWorker::switchFiber(Fiber* to, FiberSwitchAction action, const TaskBlockFn* blockFn, const TaskAsyncFn* asyncFn)
+{
+    FiberThreadState* fiberState = fiberThreadState();
+    Fiber* from = fiberState->currentFiber;
+    CPY_ASSERT(from != nullptr && from != to);
+    fiberState->switchAction = (int)action;
+    fiberState->switchFiber = from;
+    fiberState->switchBlockFn = blockFn;
+    fiberState->switchAsyncFn = asyncFn;
+    fiberState->currentFiber = to;
+    unsigned taskId = *currentTaskId();
+    InternalFiber::switchTo(from, to);
+
+    //resumed, possibly on another thread.
+    onFiberResumed();
+    *currentTaskId() = taskId;
+}
+
+void ThreadWorker::onFiberResumed()
+{
+    FiberThreadState* fiberState = fiberThreadState();
+    auto action = (FiberSwitchAction)fiberState->switchAction;
+    Fiber* fiber = fiberState->switchFiber;
+    const TaskBlockFn* blockFn = fiberState->switchBlockFn;
+    const TaskAsyncFn* asyncFn = fiberState->switchAsyncFn;
+    fiberState->switchAction = (int)FiberSwitchAction::None;
+    fiberState->switchFiber = nullptr;
+    fiberState->switchBlockFn = nullptr;
+    fiberState->switchAsyncFn = nullptr;
+
+    FiberScheduler* fibers = currentWorker()->m_fibers;
+    switch (action)
+    {
+    case FiberSwitchAction::ParkLoop:
+        fibers->releaseLoopFiber(fiber);
+        break;
+    case FiberSwitchAction::Suspend:
+        fibers->submitBlocking(fiber, *blockFn);
+        break;
+    case FiberSwitchAction::SuspendAsync:
+        {
+            //startFn lives on the suspended fiber, which the resume can send back running before startFn
+            //returns here: call a copy.
+            TaskAsyncFn startFn = *asyncFn;
+            fibers->beginSuspend();
+            startFn([fibers, fiber]() { fibers->resumeSuspended(fiber); });
+            break;
+        }
+    case FiberSwitchAction::Requeue:
+        fibers->pushReady(fiber);
+        break;
+    case FiberSwitchAction::None:
+    default:
+        break;
+    }
 }
 
 void ThreadWorker::auxLoop()
@@ -180,7 +611,7 @@ void ThreadWorker::auxLoop()
     while (active)
     {
         ThreadWorkerMessage msg;
-        m_auxQueue->waitPop(msg);
+        m_state->auxQueue.waitPop(msg);
 
         switch (msg.type)
         {
@@ -189,11 +620,9 @@ void ThreadWorker::auxLoop()
                 CPY_ASSERT(msg.blockFn);
                 msg.blockFn(); //this function, which is set internally, usually waits for responses.
 
-                //send a message to the main thread which is waiting, to wake up and exit the current stack frame (and resume previously asleep work)
-                ThreadWorkerMessage response;
-                response.type = ThreadMessageType::Exit;
-                response.targetStack = msg.targetStack;
-                m_queue->push(response);
+                //wake up the main thread, so it can exit the current stack frame (and resume previously asleep work)
+                m_state->release(msg.targetStack);
+                m_idleEvent->notifyAll();
                 break;
             }
         case ThreadMessageType::Exit:
@@ -205,16 +634,65 @@ void ThreadWorker::auxLoop()
 
 void ThreadWorker::waitUntil(TaskBlockFn fn)
 {
+    unsigned taskId = *currentTaskId();
+    if (m_trace)
+        m_trace->record(TaskTraceEventType::Yield, taskId);
+
+    if (m_fibers)
+    {
+        //suspend this fiber: the worker thread carries on with another loop fiber, the blocking pool
+        //runs fn and then any worker resumes us. Nothing here may touch this worker afterwards.
+        switchFiber(m_fibers->acquireLoopFiber(), FiberSwitchAction::Suspend, &fn);
+        if (TaskTrace* trace = currentWorker()->m_trace)
+            trace->record(TaskTraceEventType::Resume, taskId);
+        return;
+    }
+
     ThreadWorkerMessage msg;
     msg.type = ThreadMessageType::RunAuxLambda;
     msg.blockFn = fn;
     msg.targetStack = m_activeDepth + 1;
-    m_auxQueue->push(msg);
+    m_state->auxQueue.push(msg);
     ++m_activeDepth;
     run(); //trap and start a new job in the stack until the aux thread is finished.
     --m_activeDepth;
 
-    m_queue->recoverInactiveMessages();
+    if (m_trace)
+        m_trace->record(TaskTraceEventType::Resume, taskId);
+}
+
+void ThreadWorker::suspendUntil(const TaskAsyncFn& startFn)
+{
+    CPY_ASSERT_MSG(!t_isAuxThread, "suspendUntil cannot be called from a blocking call.");
+    unsigned taskId = *currentTaskId();
+    if (m_trace)
+        m_trace->record(TaskTraceEventType::Yield, taskId);
+
+    if (m_fibers)
+    {
+        //startFn runs once this fiber is switched out, so the resume cannot race with the switch.
+        switchFiber(m_fibers->acquireLoopFiber(), FiberSwitchAction::SuspendAsync, nullptr, &startFn);
+        if (TaskTrace* trace = currentWorker()->m_trace)
+            trace->record(TaskTraceEventType::Resume, taskId);
+        return;
+    }
+
+    //same trap as waitUntil, but whoever completes the operation releases the depth instead of the aux thread.
+    //A resume arriving before run() starts leaves the depth released, run() sees it right away.
+    int targetStack = m_activeDepth + 1;
+    ThreadWorkerState* state = m_state;
+    EventCount* idleEvent = m_idleEvent;
+    ++m_activeDepth;
+    startFn([state, idleEvent, targetStack]()
+    {
+        state->release(targetStack);
+        idleEvent->notifyAll();
+    });
+    run();
+    --m_activeDepth;
+
+    if (m_trace)
+        m_trace->record(TaskTraceEventType::Resume, taskId);
 }
 
 void ThreadWorker::signalStop()
@@ -222,10 +700,14 @@ void ThreadWorker::signalStop()
     if (!m_thread)
         return;
 
+    m_state->stopRequested = true;
+    m_idleEvent->notifyAll();
+    if (!m_auxThread)
+        return;
+
     ThreadWorkerMessage exitMessage;
     exitMessage.type = ThreadMessageType::Exit;
-    m_queue->push(exitMessage);
-    m_auxQueue->push(exitMessage);
+    m_state->auxQueue.push(exitMessage);
 }
 
 void ThreadWorker::join()
@@ -245,16 +727,44 @@ void ThreadWorker::join()
     }
 }
 
-void ThreadWorker::schedule(TaskFn fn, TaskContext& context)
+void ThreadWorker::schedule(TaskFn fn, TaskContext& context, void* userData, TaskPriority priority)
+{
+    if (!m_thread)
+        return;
+
+    ThreadWorkerJob* job = m_state->jobPool.allocate();
+    job->ownedFn = std::move(fn);
+    job->fn = &job->ownedFn;
+    job->ctx = context;
+    job->userData = userData;
+    job->pool = &m_state->jobPool;
+    pushJob(job, priority);
+}
+
+void ThreadWorker::schedule(ThreadWorkerJob& job, TaskPriority priority)
 {
     if (!m_thread)
         return;
 
-    ThreadWorkerMessage runMessage;
-    runMessage.type = ThreadMessageType::RunJob;
-    runMessage.fn = fn;
-    runMessage.ctx = context;
-    m_queue->push(runMessage);
+    job.pool = nullptr;
+    pushJob(&job, priority);
+}
+
+void ThreadWorker::pushJob(ThreadWorkerJob* job, TaskPriority priority)
+{
+    ThreadWorkerPriorityQueue& queue = m_state->queues[(int)priority];
+    if (t_localWorker == this && !t_isAuxThread)
+    {
+        queue.deque.push(job);
+    }
+    else
+    {
+        ThreadWorkerInbox& inbox = queue.inbox;
+        std::unique_lock lock(inbox.mutex);
+        inbox.jobs.push_back(job);
+        inbox.count.fetch_add(1, std::memory_order_release);
+    }
+    m_idleEvent->notifyOne();
 }
 
 ThreadWorker* ThreadWorker::getLocalThreadWorker()
@@ -12,34 +12,88 @@ namespace std
 namespace coalpy
 {
 
-class ThreadWorkerQueue;
+class EventCount;
+class FiberScheduler;
+class TaskTrace;
+struct Fiber;
+struct ThreadWorkerState;
+class ThreadWorkerJobPool;
 
-using OnTaskCompleteFn = std::function<void(Task)>;
+struct ThreadWorkerJob
+{
+    const TaskFn* fn = nullptr; //either ownedFn, or a functor kept alive by whoever scheduled the job.
+    TaskContext ctx;
+    void* userData = nullptr; //opaque to the worker, handed back to the completion callback.
+    TaskFn ownedFn;
+    ThreadWorkerJobPool* pool = nullptr; //jobs carved by the worker go back to it once run.
+};
+
+//can hand back a job to run next on the same thread, without going through a queue.
+using OnTaskCompleteFn = std::function<ThreadWorkerJob*(ThreadWorkerJob& job)>;
+using HelpDoneFn = std::function<bool()>;
 
 class ThreadWorker
 {
 public:
     ThreadWorker();
     ~ThreadWorker();
-    
+
     void setId(int workerId) { m_workerId = workerId; }
-    void start(OnTaskCompleteFn onTaskCompleteFn = nullptr);
-    void schedule(TaskFn fn, TaskContext& payload);
-    bool stealJob(TaskFn& fn, TaskContext& payload);
-    void runInThread(TaskFn fn, TaskContext& payload);
+    void setTrace(TaskTrace* trace) { m_trace = trace; }
+    //fiberScheduler switches the worker to fiber mode: one OS thread, and yields suspend the running fiber.
+    void init(ThreadWorker* peers, int peerCount, EventCount* idleEvent, OnTaskCompleteFn onTaskCompleteFn = nullptr, FiberScheduler* fiberScheduler = nullptr);
+    void start();
+    void schedule(TaskFn fn, TaskContext& payload, void* userData = nullptr, TaskPriority priority = TaskPriority::Normal);
+    //job is owned by the caller and must stay alive until its completion callback.
+    void schedule(ThreadWorkerJob& job, TaskPriority priority = TaskPriority::Normal);
+    bool runPendingJob();
     void signalStop();
     void join();
     int queueSize() const;
+    bool hasJobs() const;
     void waitUntil(TaskBlockFn fn);
+    void suspendUntil(const TaskAsyncFn& startFn);
+    //runs jobs of the lane on the calling worker until isDone returns true, and parks on the idle event
+    //while there is nothing runnable. Whatever makes isDone true must notify that event.
+    static void helpUntil(const HelpDoneFn& isDone);
     static ThreadWorker* getLocalThreadWorker();
+
+    //entry point of the loop fibers handed out by a FiberScheduler.
+    static void fiberEntry(void* arg);
 private:
+    enum { SpinCount = 64 };
+
+    enum class FiberSwitchAction
+    {
+        None,
+        ParkLoop,
+        Suspend,
+        SuspendAsync,
+        Requeue
+    };
+
     void run();
     void auxLoop();
+    void runFibers();
+    static void runJob(ThreadWorkerJob* job);
+    static void fiberLoop();
+    static void switchFiber(Fiber* to, FiberSwitchAction action, const TaskBlockFn* blockFn = nullptr, const TaskAsyncFn* asyncFn = nullptr);
+    static void onFiberResumed();
+    void pushJob(ThreadWorkerJob* job, TaskPriority priority);
+    ThreadWorkerJob* popJob(TaskPriority priority);
+    ThreadWorkerJob* stealJob(TaskPriority priority);
+    ThreadWorkerJob* findJob();
+    ThreadWorkerJob* spinForJob();
+    bool hasWorkAvailable() const;
     std::thread* m_thread = nullptr;
-    ThreadWorkerQueue* m_queue = nullptr;
     std::thread* m_auxThread = nullptr;
-    ThreadWorkerQueue* m_auxQueue = nullptr;
+    ThreadWorkerState* m_state = nullptr;
+    ThreadWorker* m_peers = nullptr;
+    int m_peerCount = 0;
+    EventCount* m_idleEvent = nullptr;
     OnTaskCompleteFn m_onTaskCompleteFn = nullptr;
+    FiberScheduler* m_fibers = nullptr;
+    TaskTrace* m_trace = nullptr;
     int m_activeDepth = 0;
     int m_workerId = -1;
 };
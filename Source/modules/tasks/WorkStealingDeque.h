@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+namespace coalpy
+{
+
+//Chase-Lev work stealing deque (Le, Pop, Cohen, Zappa Nardelli 2013).
+//Only the owner thread may push / pop (bottom end). Any thread may steal (top end).
+//ItemType must be a pointer: nullptr is returned to signal an empty deque or a lost race.
+template<typename ItemType>
+class WorkStealingDeque
+{
+public:
+    WorkStealingDeque(int initialCapacity = 256)
+    {
+        int capacity = 1;
+        while (capacity < initialCapacity)
+            capacity <<= 1;
+        m_array.store(new RingArray(capacity), std::memory_order_relaxed);
+    }
+
+    ~WorkStealingDeque()
+    {
+        delete m_array.load(std::memory_order_relaxed);
+        for (auto* a : m_retiredArrays)
+            delete a;
+    }
+
+    void push(ItemType item)
+    {
+        long long b = m_bottom.load(std::memory_order_relaxed);
+        long long t = m_top.load(std::memory_order_acquire);
+        RingArray* a = m_array.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1)
+            a = grow(a, b, t);
+
+        a->put(b, item);
+        //release on the store itself (not a standalone fence) so thieves see the item's contents.
+        m_bottom.store(b + 1, std::memory_order_release);
+    }
+
+    ItemType pop()
+    {
+        long long b = m_bottom.load(std::memory_order_relaxed) - 1;
+        RingArray* a = m_array.load(std::memory_order_relaxed);
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long long t = m_top.load(std::memory_order_relaxed);
+
+        ItemType item = nullptr;
+        if (t <= b)
+        {
+            item = a->get(b);
+            if (t == b)
+            {
+                //last element, race against thieves.
+                if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    item = nullptr;
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+            }
+        }
+        else
+        {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    ItemType steal()
+    {
+        long long t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long long b = m_bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+
+        RingArray* a = m_array.load(std::memory_order_acquire);
+        ItemType item = a->get(t);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+
+        return item;
+    }
+
+    //Approximation, only exact when called from the owner with no concurrent thieves.
+    bool empty() const
+    {
+        long long b = m_bottom.load(std::memory_order_relaxed);
+        long long t = m_top.load(std::memory_order_relaxed);
+        return b <= t;
+    }
+
+    int size() const
+    {
+        long long b = m_bottom.load(std::memory_order_relaxed);
+        long long t = m_top.load(std::memory_order_relaxed);
+        return b > t ? (int)(b - t) : 0;
+    }
+
+private:
+    struct RingArray
+    {
+        RingArray(long long c) : capacity(c), mask(c - 1), items(new std::atomic<ItemType>[c]) {}
+        ~RingArray() { delete [] items; }
+
+        ItemType get(long long i) const { return items[i & mask].load(std::memory_order_relaxed); }
+        void put(long long i, ItemType item) { items[i & mask].store(item, std::memory_order_relaxed); }
+
+        long long capacity;
+        long long mask;
+        std::atomic<ItemType>* items;
+    };
+
+    RingArray* grow(RingArray* oldArray, long long b, long long t)
+    {
+        auto* newArray = new RingArray(oldArray->capacity * 2);
+        for (long long i = t; i < b; ++i)
+            newArray->put(i, oldArray->get(i));
+
+        //thieves might still be reading the old array, keep it alive until destruction.
+        m_retiredArrays.push_back(oldArray);
+        m_array.store(newArray, std::memory_order_release);
+        return newArray;
+    }
+
+    alignas(64) std::atomic<long long> m_top = 0;
+    alignas(64) std::atomic<long long> m_bottom = 0;
+    alignas(64) std::atomic<RingArray*> m_array;
+    std::vector<RingArray*> m_retiredArrays;
+};
+
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+namespace coalpy
+{
+
+//Event count, allows threads to park on a condition without producers paying for a
+//lock or a kernel wake on every signal. Usage from the waiting side:
+//    auto key = ec.prepareWait();
+//    if (conditionMet()) { ec.cancelWait(); return; }
+//    ec.wait(key);
+//Producers make the condition true first and then call notifyOne / notifyAll, which only
+//go to the slow path when there are threads parked.
+//Threads can also announce they are awake and polling the condition with beginSpin / endSpin.
+//notifyOne skips the wake while any spins, so a spinner must re-check the condition after
+//endSpin, before it parks.
+class EventCount
+{
+public:
+    using Key = unsigned;
+
+    Key prepareWait()
+    {
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        return m_epoch.load(std::memory_order_seq_cst);
+    }
+
+    void cancelWait()
+    {
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    void wait(Key key)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this, key]() { return m_epoch.load(std::memory_order_relaxed) != key; });
+        }
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    template<class Rep, class Period>
+    bool waitFor(Key key, const std::chrono::duration<Rep, Period>& duration)
+    {
+        bool signaled = false;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            signaled = m_cv.wait_for(lock, duration, [this, key]() { return m_epoch.load(std::memory_order_relaxed) != key; });
+        }
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+        return signaled;
+    }
+
+    void beginSpin()
+    {
+        m_spinners.fetch_add(1, std::memory_order_seq_cst);
+    }
+
+    //returns true for the last thread to stop spinning.
+    bool endSpin()
+    {
+        return m_spinners.fetch_sub(1, std::memory_order_seq_cst) == 1;
+    }
+
+    void notifyOne()
+    {
+        if (!hasWaiters() || m_spinners.load(std::memory_order_relaxed) != 0)
+            return;
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_epoch.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_cv.notify_one();
+    }
+
+    void notifyAll()
+    {
+        if (!hasWaiters())
+            return;
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_epoch.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_cv.notify_all();
+    }
+
+private:
+    bool hasWaiters() const
+    {
+        //pairs with the seq_cst increment in prepareWait: either the waiter sees the new state
+        //when it re-checks its condition, or we see the waiter here.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return m_waiters.load(std::memory_order_relaxed) != 0;
+    }
+
+    std::atomic<int> m_waiters = 0;
+    std::atomic<int> m_spinners = 0;
+    std::atomic<Key> m_epoch = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+};
+
+}
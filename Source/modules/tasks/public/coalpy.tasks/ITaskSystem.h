@@ -1,5 +1,6 @@
 #pragma once
 #include <coalpy.tasks/TaskDefs.h>
+#include <mutex>
 
 namespace coalpy
 {
@@ -16,12 +17,50 @@ public:
     virtual void depends(Task src, Task dst) = 0;
     virtual void depends(Task src, Task* dsts, int counts) = 0;
     virtual void wait(Task other) = 0;
+    //Returns once every task has finished. Outside the workers the thread is woken a single time, by the last one.
+    virtual void waitAll(Task* tasks, int counts) = 0;
     virtual void execute(Task task) = 0;
     virtual void execute(Task* tasks, int counts) = 0;
     virtual void cleanFinishedTasks() = 0;
     virtual void cleanTaskTree(Task src) = 0;
     virtual void yield() = 0;
 
+    //Runs fn over sub ranges of [begin, end) on the workers, and returns once all of it has run.
+    //No task handles are created. grainSize is the smallest range worth sending to another thread,
+    //ranges not larger than it run inline. Pass 0 or less to let the system pick one.
+    virtual void parallelFor(int begin, int end, int grainSize, ParallelForFn fn) = 0;
+
+    //Like parallelFor, but each sub range folds into a value: rangeFn(begin, end, identity) -> ValueType.
+    //Partial values are combined with joinFn(a, b) -> ValueType, which must be associative and commutative.
+    template<typename ValueType, typename RangeFn, typename JoinFn>
+    inline ValueType parallelReduce(int begin, int end, int grainSize, ValueType identity, RangeFn rangeFn, JoinFn joinFn)
+    {
+        std::mutex resultMutex;
+        ValueType result = identity;
+        parallelFor(begin, end, grainSize, [&](int rangeBegin, int rangeEnd)
+        {
+            ValueType partial = rangeFn(rangeBegin, rangeEnd, identity);
+            std::unique_lock lock(resultMutex);
+            result = joinFn(result, partial);
+        });
+        return result;
+    }
+
+    //Graph templates: the tasks and edges of desc get created once, and live until destroyGraph.
+    //launchGraph resets every node and starts them, handing nodeData[i] to node i (recorded data if nodeData
+    //is null), so a launch neither creates nor cleans tasks. It returns a task that finishes after every
+    //node, the same one on each launch: wait on it or depend on it, but never clean it.
+    //A graph runs one launch at a time, so the previous one must have finished before launching again.
+    virtual TaskGraph createGraph(const TaskGraphDesc& desc) = 0;
+    virtual Task launchGraph(TaskGraph graph, void* const* nodeData = nullptr) = 0;
+    virtual void destroyGraph(TaskGraph graph) = 0;
+
+    //Records a timeline of every task (created, ready, running on which thread, yielding, finished)
+    //until endCapture, which writes it as a chrome trace json to path (chrome://tracing or ui.perfetto.dev).
+    //Recording is per thread and lock free, it costs a single flag check while no capture runs.
+    virtual void beginCapture() = 0;
+    virtual bool endCapture(const char* path) = 0;
+
     //convenience functions
     inline Task createTask()
     {
@@ -32,6 +71,9 @@ public:
     struct Stats
     {
         int numElements;
+
+        //slabs carved by the task and edge pools, flat once the pools hold enough for the load.
+        int numPoolSlabs;
     };
 
     virtual void getStats(Stats& outStats) = 0;
@@ -40,6 +82,12 @@ public:
 namespace TaskUtil
 {
     void yieldUntil(TaskBlockFn fn);
+
+    //Suspends the calling task until the operation started by startFn calls resume, once, from any thread.
+    //Unlike yieldUntil no thread blocks meanwhile: startFn only kicks off the work (submitting io for example)
+    //and returns, the worker carries on with other jobs until the task gets resumed.
+    void suspendUntil(TaskAsyncFn startFn);
+
     void sleepThread(int ms);
 }
 
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace coalpy
+{
+
+template<typename Signature, int Capacity = 48>
+class InlineFunction;
+
+//Drop in replacement of std::function that stores callables of up to Capacity bytes in place,
+//so creating, copying and calling one never allocates. Larger callables still work, but live
+//on the heap: capture pointers or references to keep them inline.
+template<typename ReturnType, typename... Args, int Capacity>
+class InlineFunction<ReturnType(Args...), Capacity>
+{
+public:
+    InlineFunction() {}
+    InlineFunction(std::nullptr_t) {}
+
+    template<typename Fn, typename = std::enable_if_t<!std::is_same<std::decay_t<Fn>, InlineFunction>::value>>
+    InlineFunction(Fn&& fn)
+    {
+        using Callable = std::decay_t<Fn>;
+        static_assert(std::is_copy_constructible<Callable>::value, "InlineFunction callables must be copyable.");
+        if constexpr (isInline<Callable>())
+            new (m_storage) Callable(std::forward<Fn>(fn));
+        else
+            new (m_storage) Callable*(new Callable(std::forward<Fn>(fn)));
+        m_ops = &s_ops<Callable>;
+    }
+
+    InlineFunction(const InlineFunction& other)
+    {
+        if (other.m_ops)
+            other.m_ops->copy(m_storage, other.m_storage);
+        m_ops = other.m_ops;
+    }
+
+    InlineFunction(InlineFunction&& other)
+    {
+        if (other.m_ops)
+            other.m_ops->move(m_storage, other.m_storage);
+        m_ops = other.m_ops;
+        other.m_ops = nullptr;
+    }
+
+    ~InlineFunction()
+    {
+        reset();
+    }
+
+    InlineFunction& operator=(const InlineFunction& other)
+    {
+        if (this != &other)
+        {
+            reset();
+            if (other.m_ops)
+                other.m_ops->copy(m_storage, other.m_storage);
+            m_ops = other.m_ops;
+        }
+        return *this;
+    }
+
+    InlineFunction& operator=(InlineFunction&& other)
+    {
+        if (this != &other)
+        {
+            reset();
+            if (other.m_ops)
+                other.m_ops->move(m_storage, other.m_storage);
+            m_ops = other.m_ops;
+            other.m_ops = nullptr;
+        }
+        return *this;
+    }
+
+    InlineFunction& operator=(std::nullptr_t)
+    {
+        reset();
+        return *this;
+    }
+
+    ReturnType operator()(Args... args) const
+    {
+        return m_ops->invoke(const_cast<unsigned char*>(m_storage), std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const { return m_ops != nullptr; }
+
+private:
+    struct Ops
+    {
+        ReturnType (*invoke)(void* storage, Args&&... args);
+        void (*copy)(void* dst, const void* src);
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* storage);
+    };
+
+    template<typename Callable>
+    static constexpr bool isInline()
+    {
+        return sizeof(Callable) <= Capacity && alignof(Callable) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible<Callable>::value;
+    }
+
+    template<typename Callable>
+    static Callable& target(void* storage)
+    {
+        if constexpr (isInline<Callable>())
+            return *static_cast<Callable*>(storage);
+        else
+            return **static_cast<Callable**>(storage);
+    }
+
+    template<typename Callable>
+    static const Callable& target(const void* storage)
+    {
+        return target<Callable>(const_cast<void*>(storage));
+    }
+
+    template<typename Callable>
+    static inline const Ops s_ops = {
+        [](void* storage, Args&&... args) -> ReturnType
+        {
+            return target<Callable>(storage)(std::forward<Args>(args)...);
+        },
+        [](void* dst, const void* src)
+        {
+            if constexpr (isInline<Callable>())
+                new (dst) Callable(target<Callable>(src));
+            else
+                new (dst) Callable*(new Callable(target<Callable>(src)));
+        },
+        [](void* dst, void* src)
+        {
+            if constexpr (isInline<Callable>())
+            {
+                new (dst) Callable(std::move(target<Callable>(src)));
+                target<Callable>(src).~Callable();
+            }
+            else
+            {
+                new (dst) Callable*(*static_cast<Callable**>(src));
+            }
+        },
+        [](void* storage)
+        {
+            if constexpr (isInline<Callable>())
+                target<Callable>(storage).~Callable();
+            else
+                delete &target<Callable>(storage);
+        }
+    };
+
+    void reset()
+    {
+        if (m_ops)
+            m_ops->destroy(m_storage);
+        m_ops = nullptr;
+    }
+
+    alignas(std::max_align_t) unsigned char m_storage[Capacity];
+    const Ops* m_ops = nullptr;
+};
+
+}
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <coalpy.tasks/EventCount.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <utility>
+
+namespace coalpy
+{
+
+//Bounded lock free queue for many producers and many consumers: a ring of Capacity cells (power of 2),
+//each one tagged with a sequence number telling whether it is ready to be written or read.
+//Same surface as ThreadQueue plus batches. Pushing and popping never take a lock, and waiting sides
+//spin for a bit before parking on an event count, so producers only pay for a wake up when somebody
+//is actually asleep. push waits while the ring is full, tryPush gives up instead.
+template<typename MessageType, int Capacity = 1024>
+class MpmcQueue
+{
+public:
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "MpmcQueue capacity must be a power of 2.");
+
+    enum { SpinCount = 64 };
+
+    MpmcQueue()
+    {
+        m_cells = new Cell[Capacity];
+        for (int i = 0; i < Capacity; ++i)
+            m_cells[i].sequence.store((size_t)i, std::memory_order_relaxed);
+    }
+
+    ~MpmcQueue()
+    {
+        delete [] m_cells;
+    }
+
+    //approximate while other threads push or pop.
+    int size() const
+    {
+        size_t tail = m_dequeuePos.load(std::memory_order_relaxed);
+        size_t head = m_enqueuePos.load(std::memory_order_relaxed);
+        return head > tail ? (int)(head - tail) : 0;
+    }
+
+    bool tryPush(const MessageType& msg)
+    {
+        if (!tryEnqueue(msg))
+            return false;
+        m_notEmpty.notifyOne();
+        return true;
+    }
+
+    bool tryPop(MessageType& msg)
+    {
+        if (!tryDequeue(msg))
+            return false;
+        m_notFull.notifyOne();
+        return true;
+    }
+
+    void push(const MessageType& msg)
+    {
+        waitOn(m_notFull, [this, &msg]() { return tryEnqueue(msg); });
+        m_notEmpty.notifyOne();
+    }
+
+    //pushes every message, waiting for room when full, and wakes consumers once for the batch.
+    void pushBatch(const MessageType* msgs, int count)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            const MessageType& msg = msgs[i];
+            if (!tryEnqueue(msg))
+            {
+                m_notEmpty.notifyAll();
+                waitOn(m_notFull, [this, &msg]() { return tryEnqueue(msg); });
+            }
+        }
+
+        if (count > 1)
+            m_notEmpty.notifyAll();
+        else if (count == 1)
+            m_notEmpty.notifyOne();
+    }
+
+    //pops up to maxCount messages without waiting, returns how many.
+    int tryPopBatch(MessageType* msgs, int maxCount)
+    {
+        int count = 0;
+        while (count < maxCount && tryDequeue(msgs[count]))
+            ++count;
+        if (count > 0)
+            m_notFull.notifyAll();
+        return count;
+    }
+
+    void waitPop(MessageType& msg)
+    {
+        waitOn(m_notEmpty, [this, &msg]() { return tryDequeue(msg); });
+        m_notFull.notifyOne();
+    }
+
+    //waits for at least one message, and takes whatever else is ready up to maxCount.
+    int waitPopBatch(MessageType* msgs, int maxCount)
+    {
+        if (maxCount <= 0)
+            return 0;
+        waitOn(m_notEmpty, [this, msgs]() { return tryDequeue(msgs[0]); });
+        int count = 1;
+        while (count < maxCount && tryDequeue(msgs[count]))
+            ++count;
+        m_notFull.notifyAll();
+        return count;
+    }
+
+    bool waitPopUntil(MessageType& msg, int milliseconds)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+        for (int spin = 0; spin < SpinCount; ++spin)
+        {
+            if (tryPop(msg))
+                return true;
+            std::this_thread::yield();
+        }
+
+        while (true)
+        {
+            auto key = m_notEmpty.prepareWait();
+            if (tryDequeue(msg))
+            {
+                m_notEmpty.cancelWait();
+                m_notFull.notifyOne();
+                return true;
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline)
+            {
+                m_notEmpty.cancelWait();
+                return false;
+            }
+            m_notEmpty.waitFor(key, deadline - now);
+        }
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        MessageType data;
+    };
+
+    bool tryEnqueue(const MessageType& msg)
+    {
+        //a cell is writable once its sequence matches the position, readable once it is one past.
+        Cell* cell = nullptr;
+        size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            cell = &m_cells[pos & (Capacity - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->data = msg;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryDequeue(MessageType& msg)
+    {
+        Cell* cell = nullptr;
+        size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            cell = &m_cells[pos & (Capacity - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        msg = std::move(cell->data);
+        cell->sequence.store(pos + Capacity, std::memory_order_release);
+        return true;
+    }
+
+    template<typename TryFn>
+    static void waitOn(EventCount& event, TryFn tryFn)
+    {
+        for (int spin = 0; spin < SpinCount; ++spin)
+        {
+            if (tryFn())
+                return;
+            std::this_thread::yield();
+        }
+
+        while (true)
+        {
+            auto key = event.prepareWait();
+            if (tryFn())
+            {
+                event.cancelWait();
+                return;
+            }
+            event.wait(key);
+        }
+    }
+
+    Cell* m_cells = nullptr;
+    alignas(64) std::atomic<size_t> m_enqueuePos = 0;
+    alignas(64) std::atomic<size_t> m_dequeuePos = 0;
+    EventCount m_notEmpty;
+    EventCount m_notFull;
+};
+
+}
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <coalpy.core/GenericHandle.h>
+#include <coalpy.tasks/InlineFunction.h>
 #include <string>
 #include <functional>
+#include <vector>
+#include <utility>
 
 namespace coalpy
 {
@@ -14,28 +17,96 @@ class ITaskSystem;
 
 struct TaskSystemDesc
 {
+    //threads of the cpu lane.
     int threadPoolSize = 8u;
+
+    //threads of the io lane, serving tasks that mostly block on the OS. With 0, io tasks run on the cpu lane.
+    int ioThreadPoolSize = 2;
+
+    //Fiber mode: tasks run on fibers, and TaskUtil::yieldUntil suspends the task while a shared pool
+    //runs the blocking call, instead of parking an auxiliary thread per worker. Nested yields
+    //do not grow the worker's native stack.
+    bool enableFibers = false;
+    int fiberStackSize = 256 * 1024;
+    int blockingThreadPoolSize = 4;
 };
 
 enum class TaskFlags : int
 {
-    AutoStart = 1 << 0
+    AutoStart = 1 << 0,
+
+    //Reclaimed once it finished and every task depending on it got removed, so it never needs cleaning.
+    //Its handle stops resolving afterwards: waiting on it returns right away and depending on it is a no-op.
+    AutoRelease = 1 << 1,
+
+    //Once its dependencies finish, runs right away on the worker that finished the last one, instead of
+    //going through a queue. It gets queued as usual when that worker belongs to another lane, or already
+    //picked another inline task. Meant for short continuations consuming what the dependency produced.
+    Inline = 1 << 2
+};
+
+//Workers always drain higher classes first, lower ones only run when nothing above is ready.
+enum class TaskPriority : int
+{
+    Critical,
+    Normal,
+    Background,
+    Count
+};
+
+//Pool of threads a task runs on.
+enum class TaskLane : int
+{
+    Cpu,
+    Io,
+    Count
 };
 
 using TaskBlockFn = std::function<void()>;
-using TaskFn = std::function<void(TaskContext& ctx)>;
+using TaskResumeFn = std::function<void()>;
+using TaskAsyncFn = std::function<void(TaskResumeFn resume)>;
+using TaskFn = InlineFunction<void(TaskContext& ctx)>;
+using ParallelForFn = std::function<void(int begin, int end)>;
 using Task = GenericHandle<unsigned int>;
+struct TaskGraph : public GenericHandle<unsigned int> {};
+using TaskGraphNode = int;
 
 struct TaskDesc
 {
     TaskDesc() : name(""), flags(0), fn(nullptr) {}
-    TaskDesc(TaskFn fn) : name(""), flags(0), fn(fn) {}
-    TaskDesc(std::string nm, int flags, TaskFn fn) : name(nm), flags(flags), fn(fn) {}
-    TaskDesc(std::string nm, TaskFn fn) : name(nm), flags(0), fn(fn) {}
+    TaskDesc(TaskFn fn) : name(""), flags(0), fn(std::move(fn)) {}
+    TaskDesc(const char* nm, int flags, TaskFn fn) : name(nm), flags(flags), fn(std::move(fn)) {}
+    TaskDesc(const char* nm, TaskFn fn) : name(nm), flags(0), fn(std::move(fn)) {}
+    TaskDesc(const char* nm, TaskPriority priority, TaskLane lane, TaskFn fn) : name(nm), flags(0), fn(std::move(fn)), priority(priority), lane(lane) {}
 
-    std::string name;
+    //not copied: the string must outlive the task (a literal, or owned by the task's data).
+    const char* name;
     int flags;
     TaskFn fn;
+    TaskPriority priority = TaskPriority::Normal;
+    TaskLane lane = TaskLane::Cpu;
+};
+
+//Tasks and dependencies of a graph template, see ITaskSystem::createGraph.
+struct TaskGraphDesc
+{
+    //returns the index of the node, used to declare edges and to pass data to the node on each launch.
+    TaskGraphNode addNode(const TaskDesc& desc, void* data = nullptr)
+    {
+        nodes.push_back(desc);
+        nodeData.push_back(data);
+        return (TaskGraphNode)nodes.size() - 1;
+    }
+
+    //src runs after dst, like ITaskSystem::depends.
+    void depends(TaskGraphNode src, TaskGraphNode dst)
+    {
+        edges.emplace_back(src, dst);
+    }
+
+    std::vector<TaskDesc> nodes;
+    std::vector<void*> nodeData;
+    std::vector<std::pair<TaskGraphNode, TaskGraphNode>> edges;
 };
 
 struct TaskContext
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <coalpy.core/Assert.h>
+#include <coalpy.tasks/ITaskSystem.h>
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace coalpy
+{
+
+enum class TaskFutureStatus
+{
+    Pending,
+    Ready,
+    Cancelled
+};
+
+template<typename T>
+class TaskFuture;
+
+namespace InternalTaskFuture
+{
+
+struct StateBase
+{
+    ITaskSystem* ts = nullptr;
+    Task task;
+    std::atomic<TaskFutureStatus> status = TaskFutureStatus::Pending;
+    std::atomic<bool> cancelRequested = false;
+
+    //a continuation only runs on a ready source nobody asked to cancel, even after it finished.
+    bool canContinue() const
+    {
+        return status.load(std::memory_order_acquire) == TaskFutureStatus::Ready
+            && !cancelRequested.load(std::memory_order_acquire);
+    }
+};
+
+template<typename T>
+struct State : public StateBase
+{
+    template<typename Fn>
+    void fulfill(Fn&& fn) { value.emplace(fn()); }
+    const T& get() const { return *value; }
+
+    std::optional<T> value;
+};
+
+template<>
+struct State<void> : public StateBase
+{
+    template<typename Fn>
+    void fulfill(Fn&& fn) { fn(); }
+    void get() const {}
+};
+
+//the state and the work producing it share one allocation, and the task only holds a pointer to it.
+template<typename T, typename BodyFn>
+struct TaskState : public State<T>
+{
+    explicit TaskState(BodyFn&& bodyFn) : body(std::move(bodyFn)) {}
+
+    //body(state) stores the value and returns true, or returns false to cancel.
+    //Dropped once run, so a long lived future does not keep its sources alive.
+    std::optional<BodyFn> body;
+};
+
+template<typename T, typename Fn>
+struct ContinuationResult
+{
+    using Type = std::decay_t<std::invoke_result_t<Fn&, const T&>>;
+};
+
+template<typename Fn>
+struct ContinuationResult<void, Fn>
+{
+    using Type = std::decay_t<std::invoke_result_t<Fn&>>;
+};
+
+template<typename T, typename Fn>
+decltype(auto) invokeWith(Fn& fn, const State<T>& source)
+{
+    if constexpr (std::is_void<T>::value)
+        return fn();
+    else
+        return fn(source.get());
+}
+
+struct Access
+{
+    template<typename T>
+    static TaskFuture<T> make(std::shared_ptr<State<T>> state) { return TaskFuture<T>(std::move(state)); }
+
+    template<typename T>
+    static const std::shared_ptr<State<T>>& state(const TaskFuture<T>& future) { return future.m_state; }
+};
+
+//creates the auto released task producing the future, running after the dependencies. With execute false
+//it is left for whoever decides when it can run.
+template<typename T, typename BodyFn>
+TaskFuture<T> createFuture(ITaskSystem& ts, const TaskDesc& desc, BodyFn body, Task* dependencies, int dependencyCount, bool execute = true)
+{
+    auto state = std::make_shared<TaskState<T, BodyFn>>(std::move(body));
+    state->ts = &ts;
+
+    TaskDesc taskDesc(desc.name, desc.flags | (int)TaskFlags::AutoRelease, [state](TaskContext& ctx)
+    {
+        bool ready = !state->cancelRequested.load(std::memory_order_acquire) && (*state->body)(*state);
+        state->body.reset();
+        state->status.store(ready ? TaskFutureStatus::Ready : TaskFutureStatus::Cancelled, std::memory_order_release);
+    });
+    taskDesc.priority = desc.priority;
+    taskDesc.lane = desc.lane;
+
+    state->task = ts.createTask(taskDesc);
+    if (dependencyCount > 0)
+        ts.depends(state->task, dependencies, dependencyCount);
+    if (execute)
+        ts.execute(state->task);
+    return Access::make<T>(std::move(state));
+}
+
+}
+
+//Value a task produces later on. Copies share the same state, which the producing task keeps alive
+//while it runs, so futures can be dropped at any time. Created by runAsync, then, whenAll and whenAny.
+template<typename T>
+class TaskFuture
+{
+public:
+    using ValueType = T;
+
+    TaskFuture() {}
+
+    bool valid() const { return m_state != nullptr; }
+
+    //the task producing the value, for depends. It is auto released: never clean it.
+    Task task() const { return m_state ? m_state->task : Task(); }
+
+    TaskFutureStatus status() const { return m_state->status.load(std::memory_order_acquire); }
+    bool isReady() const { return status() == TaskFutureStatus::Ready; }
+    bool isCancelled() const { return status() == TaskFutureStatus::Cancelled; }
+
+    //returns once the producing task finished. Workers run other jobs meanwhile.
+    void wait() const
+    {
+        m_state->ts->wait(m_state->task);
+    }
+
+    //waits, then returns the value. The future must not be cancelled.
+    decltype(auto) get() const
+    {
+        wait();
+        CPY_ASSERT_MSG(isReady(), "Cannot get the value of a cancelled future.");
+        return m_state->get();
+    }
+
+    //skips the work if it has not started yet, and cancels every continuation that has not run,
+    //even when this future finished already.
+    void cancel() const
+    {
+        m_state->cancelRequested.store(true, std::memory_order_release);
+    }
+
+    //runs fn(value), or fn() on void futures, once this one is ready. It runs inline on the worker
+    //that finished this future. A cancelled future cancels the continuation instead.
+    template<typename Fn>
+    TaskFuture<typename InternalTaskFuture::ContinuationResult<T, Fn>::Type> then(const char* name, Fn fn, TaskLane lane = TaskLane::Cpu) const
+    {
+        using ResultType = typename InternalTaskFuture::ContinuationResult<T, Fn>::Type;
+        std::shared_ptr<InternalTaskFuture::State<T>> source = m_state;
+        TaskDesc desc(name, (int)TaskFlags::Inline, nullptr);
+        desc.lane = lane;
+        return InternalTaskFuture::createFuture<ResultType>(*m_state->ts, desc,
+            [source, fn](InternalTaskFuture::State<ResultType>& state) mutable
+            {
+                if (!source->canContinue())
+                    return false;
+                state.fulfill([&source, &fn]() -> decltype(auto) { return InternalTaskFuture::invokeWith<T>(fn, *source); });
+                return true;
+            }, &m_state->task, 1);
+    }
+
+    template<typename Fn>
+    TaskFuture<typename InternalTaskFuture::ContinuationResult<T, Fn>::Type> then(Fn fn) const
+    {
+        return then("then", std::move(fn));
+    }
+
+private:
+    explicit TaskFuture(std::shared_ptr<InternalTaskFuture::State<T>> state) : m_state(std::move(state)) {}
+
+    std::shared_ptr<InternalTaskFuture::State<T>> m_state;
+
+    friend struct InternalTaskFuture::Access;
+};
+
+//runs fn() in a task, the future holds what it returns.
+template<typename Fn>
+TaskFuture<std::decay_t<std::invoke_result_t<Fn&>>> runAsync(ITaskSystem& ts, const char* name, Fn fn, TaskLane lane = TaskLane::Cpu, TaskPriority priority = TaskPriority::Normal)
+{
+    using ResultType = std::decay_t<std::invoke_result_t<Fn&>>;
+    TaskDesc desc(name, priority, lane, nullptr);
+    return InternalTaskFuture::createFuture<ResultType>(ts, desc,
+        [fn](InternalTaskFuture::State<ResultType>& state) mutable
+        {
+            state.fulfill([&fn]() -> decltype(auto) { return fn(); });
+            return true;
+        }, nullptr, 0);
+}
+
+//ready once every future is, cancelled if any of them is. Values are read from the inputs.
+template<typename T>
+TaskFuture<void> whenAll(ITaskSystem& ts, const std::vector<TaskFuture<T>>& futures)
+{
+    std::vector<std::shared_ptr<InternalTaskFuture::State<T>>> sources;
+    std::vector<Task> tasks;
+    sources.reserve(futures.size());
+    tasks.reserve(futures.size());
+    for (const TaskFuture<T>& future : futures)
+    {
+        sources.push_back(InternalTaskFuture::Access::state(future));
+        tasks.push_back(future.task());
+    }
+
+    TaskDesc desc("whenAll", (int)TaskFlags::Inline, nullptr);
+    return InternalTaskFuture::createFuture<void>(ts, desc,
+        [sources](InternalTaskFuture::State<void>& state)
+        {
+            for (const auto& source : sources)
+                if (!source->canContinue())
+                    return false;
+            return true;
+        }, tasks.data(), (int)tasks.size());
+}
+
+//holds the index of the first future to become ready, cancelled only if all of them are.
+template<typename T>
+TaskFuture<int> whenAny(ITaskSystem& ts, const std::vector<TaskFuture<T>>& futures)
+{
+    struct AnyState
+    {
+        std::atomic<int> remaining = 0;
+        std::atomic<int> winner = -1;
+    };
+
+    auto any = std::make_shared<AnyState>();
+    any->remaining.store((int)futures.size(), std::memory_order_relaxed);
+
+    //not executed here: the first input to be ready launches it, or the last one if none is.
+    TaskDesc desc("whenAny", (int)TaskFlags::Inline, nullptr);
+    TaskFuture<int> result = InternalTaskFuture::createFuture<int>(ts, desc,
+        [any](InternalTaskFuture::State<int>& state)
+        {
+            int winner = any->winner.load(std::memory_order_acquire);
+            if (winner < 0)
+                return false;
+            state.fulfill([winner]() { return winner; });
+            return true;
+        }, nullptr, 0, false);
+
+    Task resultTask = result.task();
+    if (futures.empty())
+    {
+        ts.execute(resultTask);
+        return result;
+    }
+
+    for (int i = 0; i < (int)futures.size(); ++i)
+    {
+        std::shared_ptr<InternalTaskFuture::State<T>> source = InternalTaskFuture::Access::state(futures[i]);
+        Task watcher = ts.createTask(TaskDesc("whenAnyInput", (int)TaskFlags::AutoRelease | (int)TaskFlags::Inline, [any, source, i, resultTask](TaskContext& ctx)
+        {
+            //claims come before the countdown, so the last input sees any winner there is.
+            int expected = -1;
+            if (source->canContinue() && any->winner.compare_exchange_strong(expected, i, std::memory_order_acq_rel))
+                ctx.ts->execute(resultTask);
+            if (any->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1 && any->winner.load(std::memory_order_acquire) < 0)
+                ctx.ts->execute(resultTask);
+        }));
+        ts.depends(watcher, source->task);
+        ts.execute(watcher);
+    }
+    return result;
+}
+
+}
@@ -127,11 +127,23 @@ TextureLoadResult TextureLoader::loadTextureInternal(const char* fileName, rende
     {
         if (response.status == FileStatus::Reading)
         {
-            loadState.fileBuffer.append((const u8*)response.buffer, response.size);
+            if (response.mapped || response.sharedBuffer)
+            {
+                loadState.cachedFile = response.sharedBuffer;
+                loadState.mappedData = (const u8*)response.buffer;
+                loadState.mappedSize = (size_t)response.size;
+            }
+            else
+            {
+                loadState.fileBuffer.append((const u8*)response.buffer, response.size);
+            }
         }
         else if (response.status == FileStatus::Success)
         {
-            ImgCodecResult codecResult = loadState.codec->decompress(loadState.fileBuffer.data(), loadState.fileBuffer.size(), *loadState.imageImporter);
+            //the codec reads the mapped file in place, the handle is only closed once the texture got processed.
+            const u8* fileData = loadState.mappedData != nullptr ? loadState.mappedData : loadState.fileBuffer.data();
+            size_t fileSize = loadState.mappedData != nullptr ? loadState.mappedSize : loadState.fileBuffer.size();
+            ImgCodecResult codecResult = loadState.codec->decompress(fileData, fileSize, *loadState.imageImporter);
             if (codecResult.success())
             {
                 loadState.loadResult = TextureLoadResult { TextureStatus::Ok, render::Texture() };
@@ -155,7 +167,7 @@ TextureLoadResult TextureLoader::loadTextureInternal(const char* fileName, rende
             std::lock_guard lock(m_completeStatesMutex);
             m_completeStates.push(&loadState);
         }
-    });
+    }, (int)FileRequestFlags::MemoryMap);
 
     request.additionalRoots = m_additionalPaths;
 
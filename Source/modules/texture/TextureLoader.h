@@ -84,6 +84,12 @@ private:
         std::string fileName;
         std::string resolvedFileName;
         ByteBuffer fileBuffer;
+
+        //view of the mapped file, valid until fileHandle gets closed. Used instead of fileBuffer when set.
+        //Files served by the file system cache are viewed the same way, cachedFile keeps them alive.
+        const u8* mappedData = nullptr;
+        size_t mappedSize = 0;
+        SharedFileBuffer cachedFile;
         TextureLoadResult loadResult;
         AsyncFileHandle fileHandle;
         render::Texture texture;
@@ -95,6 +101,9 @@ private:
             fileName.clear();
             resolvedFileName.clear();
             fileBuffer.resize(0u);
+            mappedData = nullptr;
+            mappedSize = 0;
+            cachedFile = nullptr;
             loadResult = TextureLoadResult();
             fileHandle = AsyncFileHandle();
             codec = nullptr;
@@ -0,0 +1,93 @@
+#include <iostream>
+#include <coalpy.core/ClParser.h>
+#include <coalpy.tasks/ITaskSystem.h>
+#include <coalpy.files/PackBuilder.h>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <stdio.h>
+
+using namespace coalpy;
+
+struct ArgParameters
+{
+    bool help = false;
+    bool verbose = false;
+    const char* input = "";
+    const char* output = "";
+    int level = 6;
+    int alignment = 16;
+};
+
+bool prepareCli(ClParser& p, ArgParameters& params)
+{
+    ClParser::GroupId gid= p.createGroup("General", "General Params:");
+    p.bind(gid, &params);
+    CliSwitch(gid, "help", "h", "help", Bool, ArgParameters, help);
+    CliSwitch(gid, "Directory packed, with everything under it. Files keep their path relative to it", "i", "input", String, ArgParameters, input);
+    CliSwitch(gid, "Path of the pack written", "o", "output", String, ArgParameters, output);
+    CliSwitch(gid, "zlib compression level, from 0 (store everything) to 9", "l", "level", Int, ArgParameters, level);
+    CliSwitch(gid, "Alignment in bytes of the contents of each file, a power of two", "a", "alignment", Int, ArgParameters, alignment);
+    CliSwitch(gid, "Prints every file packed", "v", "verbose", Bool, ArgParameters, verbose);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    ArgParameters params;
+    ClParser p;
+    if (!prepareCli(p, params))
+    {
+        std::cerr << "Error setting up cli parser\n";
+        return -1;
+    }
+
+    if (!p.parse(argc, argv))
+        return -1;
+
+    if (params.help)
+    {
+        p.prettyPrintHelp();
+        return 0;
+    }
+
+    if (params.input[0] == '\0' || params.output[0] == '\0')
+    {
+        std::cerr << "An input directory (-i) and an output pack (-o) are required, see -h" << std::endl;
+        return -1;
+    }
+
+    PackBuildDesc desc;
+    desc.compressionLevel = params.level;
+    desc.alignment = params.alignment;
+    PackUtil::collectFiles(params.input, desc.files);
+    if (params.verbose)
+    {
+        for (const PackBuildFile& file : desc.files)
+            fprintf(stderr, "  %s\n", file.path.c_str());
+    }
+
+    //files get compressed in parallel, there is no io to overlap with.
+    TaskSystemDesc tsDesc;
+    tsDesc.threadPoolSize = (int)std::max(std::thread::hardware_concurrency(), 1u);
+    tsDesc.ioThreadPoolSize = 0;
+    ITaskSystem* ts = ITaskSystem::create(tsDesc);
+    ts->start();
+    desc.taskSystem = ts;
+
+    std::string error;
+    bool success = PackUtil::buildPack(desc, params.output, error);
+
+    ts->signalStop();
+    ts->join();
+    delete ts;
+
+    if (!success)
+    {
+        std::cerr << error << std::endl;
+        return -1;
+    }
+
+    fprintf(stderr, "Packed %d files into %s\n", (int)desc.files.size(), params.output);
+    return 0;
+}
@@ -33,7 +33,7 @@ ModuleState::ModuleState(CoalpyTypeObject** types, int typesCount)
     registerTypes(types, typesCount);
 
     {
-        FileWatchDesc desc { 120 /*ms*/};
+        FileWatchDesc desc { 120 /*debounce ms*/};
         m_fw = IFileWatcher::create(desc);
         m_fw->start();
     }
@@ -47,6 +47,13 @@ ModuleState::ModuleState(CoalpyTypeObject** types, int typesCount)
     {
         FileSystemDesc desc;
         desc.taskSystem = m_ts;
+
+        //shader includes and textures get read again on every live edit recompile / reload.
+        desc.cacheBudget = 64 * 1024 * 1024;
+        desc.fw = m_fw;
+
+        //the data paths are watched, so which of them a file comes from is only probed again on changes.
+        desc.cacheResolvedPaths = true;
         m_fs = IFileSystem::create(desc);
     }
 
@@ -194,6 +201,7 @@ void ModuleState::addDataPath(const char* dataPath)
         return;
 
     m_additionalDataPaths.push_back(p);
+    m_fw->addDirectory(p.c_str());
     internalAddPath(p);
 }
 
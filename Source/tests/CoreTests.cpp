@@ -2,6 +2,9 @@
 #include <coalpy.core/Assert.h>
 #include <coalpy.core/ByteBuffer.h>
 #include <coalpy.core/HashStream.h>
+#include <coalpy.core/GenericHandle.h>
+#include <coalpy.core/GenerationalHandleContainer.h>
+#include <vector>
 
 namespace coalpy
 {
@@ -23,6 +26,12 @@ void testByteBuffer(TestContext& ctx)
             CPY_ASSERT(intArray[i] == cpy[i]);
         }
     }
+
+    //moving keeps the size, not the capacity.
+    buffer.reserve(1024);
+    ByteBuffer moved(std::move(buffer));
+    CPY_ASSERT(moved.size() == sizeof(int)*4 && buffer.size() == 0);
+    CPY_ASSERT(((const int*)moved.data())[3] == 4);
 }
 
 void testHashStream(TestContext& ctx)
@@ -46,11 +55,55 @@ void testHashStream(TestContext& ctx)
     CPY_ASSERT(hsA.val() != hsC.val());
 }
 
+void testGenerationalHandles(TestContext& ctx)
+{
+    using Handle = GenericHandle<unsigned>;
+    GenerationalHandleContainer<Handle, int> container;
+
+    Handle a;
+    container.allocate(a) = 1;
+    CPY_ASSERT(container.contains(a));
+    CPY_ASSERT(container[a] == 1);
+    container.free(a);
+    CPY_ASSERT(!container.contains(a));
+
+    //churn until slot of a gets reused: its old handle must never resolve to the new element.
+    std::vector<Handle> handles;
+    bool reused = false;
+    for (int i = 0; i < 4096 && !reused; ++i)
+    {
+        Handle h;
+        container.allocate(h) = i;
+        CPY_ASSERT(h.valid());
+        CPY_ASSERT(h != a);
+        reused = (h.handleId & decltype(container)::IndexMask) == (a.handleId & decltype(container)::IndexMask);
+        handles.push_back(h);
+        if ((i & 1) == 0)
+        {
+            container.free(handles.front());
+            handles.erase(handles.begin());
+        }
+    }
+
+    CPY_ASSERT(reused);
+    CPY_ASSERT(!container.contains(a));
+    CPY_ASSERT(container.elementsCount() == (int)handles.size());
+
+    int visited = 0;
+    container.forEach([&visited, &container](Handle h, int& value)
+    {
+        CPY_ASSERT(container.contains(h));
+        ++visited;
+    });
+    CPY_ASSERT(visited == (int)handles.size());
+}
+
 static TestCase* createCases(int& caseCounts)
 {
     static TestCase sCases[] = {
         { "byteBuffer", testByteBuffer },
-        { "hashstream", testHashStream }
+        { "hashstream", testHashStream },
+        { "generationalHandles", testGenerationalHandles }
     };
 
     caseCounts = (int)(sizeof(sCases) / sizeof(TestCase));
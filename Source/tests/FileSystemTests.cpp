@@ -4,10 +4,17 @@
 #include <coalpy.files/IFileSystem.h>
 #include <coalpy.files/IFileWatcher.h>
 #include <coalpy.files/Utils.h>
+#include <coalpy.files/PackBuilder.h>
 #include <unordered_map>
 #include <atomic>
 #include <sstream>
 #include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <chrono>
 
 namespace coalpy
 {
@@ -131,6 +138,726 @@ void testFileReadWrite(TestContext& ctx)
     testContext.end();
 }
 
+void testMemoryMappedRead(TestContext& ctx)
+{
+    auto& testContext = (FileSystemContext&)ctx;
+    testContext.begin();
+
+    IFileSystem& fs = *testContext.fs;
+    ITaskSystem& ts = *testContext.ts;
+
+    //large enough to take many chunks through the regular path.
+    std::string str;
+    for (int i = 0; str.size() < 200 * 1024; ++i)
+        str += std::to_string(i) + ",";
+
+    bool writeSuccess = false;
+    AsyncFileHandle writeHandle = fs.write(FileWriteRequest(
+        ".test_mmap/test.txt",
+        [&writeSuccess](FileWriteResponse& response)
+        {
+            CPY_ASSERT_FMT(response.status != FileStatus::Fail, "writing fail: %s", IoError2String(response.error));
+            if (response.status == FileStatus::Success)
+                writeSuccess = true;
+        },
+        str.c_str(),
+        (int)str.size()
+    ));
+
+    int readingCalls = 0;
+    bool readSuccess = false;
+    const char* view = nullptr;
+    int viewSize = 0;
+    AsyncFileHandle readHandle = fs.read(FileReadRequest(
+        ".test_mmap/test.txt",
+        [&](FileReadResponse& response)
+        {
+            CPY_ASSERT_FMT(response.status != FileStatus::Fail, "reading fail: %s", IoError2String(response.error));
+            if (response.status == FileStatus::Reading)
+            {
+                ++readingCalls;
+                CPY_ASSERT(response.mapped);
+                view = response.buffer;
+                viewSize = response.size;
+            }
+            else if (response.status == FileStatus::Success)
+            {
+                readSuccess = true;
+            }
+        },
+        (int)FileRequestFlags::MemoryMap
+    ));
+
+    ts.depends(fs.asTask(readHandle), fs.asTask(writeHandle));
+    ts.execute(fs.asTask(readHandle));
+    fs.wait(readHandle);
+
+    CPY_ASSERT(writeSuccess);
+    CPY_ASSERT(readSuccess);
+    CPY_ASSERT_FMT(readingCalls == 1, "%d", readingCalls);
+
+    //the view outlives the read, until the handle gets closed.
+    CPY_ASSERT_FMT(viewSize == (int)str.size(), "%d", viewSize);
+    CPY_ASSERT(view != nullptr && std::string(view, viewSize) == str);
+    fs.closeHandle(writeHandle);
+    fs.closeHandle(readHandle);
+
+    {
+        deleteAllDir(fs, ".test_mmap");
+    }
+
+    testContext.end();
+}
+
+void testConcurrentReads(TestContext& ctx)
+{
+    auto& testContext = (FileSystemContext&)ctx;
+    testContext.begin();
+
+    ITaskSystem& ts = *testContext.ts;
+
+    //the default file system goes through io_uring where supported, compare it against the posix path.
+    FileSystemDesc posixDesc { &ts };
+    posixDesc.enableIoRing = false;
+    IFileSystem* posixFs = IFileSystem::create(posixDesc);
+    IFileSystem* fileSystems[] = { testContext.fs, posixFs };
+
+    const int fileCount = 16;
+    auto getContents = [](int i)
+    {
+        //a few files span many ring chunks.
+        std::string str;
+        int size = (i % 4 == 0) ? 3 * 1024 * 1024 + 17 : 1000 * i;
+        for (int v = i; (int)str.size() < size; ++v)
+            str += std::to_string(v) + ",";
+        return str;
+    };
+
+    for (IFileSystem* fs : fileSystems)
+    {
+        std::vector<std::string> contents(fileCount);
+        std::vector<AsyncFileHandle> handles(fileCount);
+        std::atomic<int> writes = 0;
+        for (int i = 0; i < fileCount; ++i)
+        {
+            contents[i] = getContents(i);
+            handles[i] = fs->write(FileWriteRequest(".test_concurrent/file-" + std::to_string(i) + ".txt",
+                [&writes](FileWriteResponse& response)
+                {
+                    CPY_ASSERT_FMT(response.status != FileStatus::Fail, "writing fail: %s", IoError2String(response.error));
+                    if (response.status == FileStatus::Success)
+                        ++writes;
+                }, contents[i].c_str(), (int)contents[i].size(), (int)FileRequestFlags::AutoStart));
+        }
+
+        for (auto h : handles)
+        {
+            fs->wait(h);
+            fs->closeHandle(h);
+        }
+        CPY_ASSERT(writes == fileCount);
+
+        //every file is read from both paths at once, the first candidate root does not exist.
+        std::vector<std::string> results(fileCount * 2);
+        std::atomic<int> reads = 0;
+        for (int i = 0; i < fileCount * 2; ++i)
+        {
+            FileReadRequest request("file-" + std::to_string(i % fileCount) + ".txt",
+                [&reads, &results, i](FileReadResponse& response)
+                {
+                    CPY_ASSERT_FMT(response.status != FileStatus::Fail, "reading fail: %s", IoError2String(response.error));
+                    if (response.status == FileStatus::Reading)
+                        results[i].append(response.buffer, response.size);
+                    else if (response.status == FileStatus::Success)
+                        ++reads;
+                }, (int)FileRequestFlags::AutoStart);
+            request.additionalRoots.push_back(".test_missing");
+            request.additionalRoots.push_back(".test_concurrent/");
+            handles.push_back(fileSystems[i & 1]->read(request));
+        }
+
+        for (int i = 0; i < fileCount * 2; ++i)
+        {
+            IFileSystem* readFs = fileSystems[i & 1];
+            readFs->wait(handles[fileCount + i]);
+            readFs->closeHandle(handles[fileCount + i]);
+        }
+
+        CPY_ASSERT_FMT(reads == fileCount * 2, "%d", reads.load());
+        for (int i = 0; i < fileCount * 2; ++i)
+            CPY_ASSERT_FMT(results[i] == contents[i % fileCount], "mismatch reading file %d", i % fileCount);
+
+        deleteAllDir(*fs, ".test_concurrent");
+    }
+
+    {
+        bool failed = false;
+        AsyncFileHandle h = testContext.fs->read(FileReadRequest(".test_concurrent/none.txt",
+            [&failed](FileReadResponse& response)
+            {
+                if (response.status == FileStatus::Fail)
+                    failed = response.error == IoError::FailedOpening;
+            }, (int)FileRequestFlags::AutoStart));
+        testContext.fs->wait(h);
+        testContext.fs->closeHandle(h);
+        CPY_ASSERT(failed);
+    }
+
+    delete posixFs;
+    testContext.end();
+}
+
+void testReadBatch(TestContext& ctx)
+{
+    auto& testContext = (FileSystemContext&)ctx;
+    testContext.begin();
+
+    IFileSystem& fs = *testContext.fs;
+
+    //more files than the batch reads at once, the last one does not exist.
+    const int fileCount = 100;
+    std::vector<std::string> contents(fileCount);
+    std::vector<AsyncFileHandle> writeHandles;
+    for (int i = 0; i < fileCount - 1; ++i)
+    {
+        contents[i] = "file contents " + std::to_string(i * 7919);
+        writeHandles.push_back(fs.write(FileWriteRequest(".test_batch/file-" + std::to_string(i) + ".txt",
+            [](FileWriteResponse& response)
+            {
+                CPY_ASSERT_FMT(response.status != FileStatus::Fail, "writing fail: %s", IoError2String(response.error));
+            }, contents[i].c_str(), (int)contents[i].size(), (int)FileRequestFlags::AutoStart)));
+    }
+
+    for (auto h : writeHandles)
+    {
+        fs.wait(h);
+        fs.closeHandle(h);
+    }
+
+    std::vector<std::string> results(fileCount);
+    std::vector<int> statuses(fileCount, (int)FileStatus::Idle);
+    std::vector<FileReadRequest> requests;
+    for (int i = 0; i < fileCount; ++i)
+    {
+        requests.push_back(FileReadRequest(".test_batch/file-" + std::to_string(i) + ".txt",
+            [&results, &statuses, i](FileReadResponse& response)
+            {
+                if (response.status == FileStatus::Reading)
+                    results[i].append(response.buffer, response.size);
+                else if (response.status == FileStatus::Success || response.status == FileStatus::Fail)
+                    statuses[i] = (int)response.status;
+            }));
+    }
+
+    AsyncFileHandle batch = fs.readBatch(requests.data(), (int)requests.size());
+    fs.execute(batch);
+    fs.wait(batch);
+
+    for (int i = 0; i < fileCount - 1; ++i)
+    {
+        CPY_ASSERT_FMT(statuses[i] == (int)FileStatus::Success, "file %d status %d", i, statuses[i]);
+        CPY_ASSERT_FMT(results[i] == contents[i], "mismatch reading file %d", i);
+    }
+    CPY_ASSERT(statuses[fileCount - 1] == (int)FileStatus::Fail);
+    fs.closeHandle(batch);
+
+    //empty batches finish right away.
+    AsyncFileHandle emptyBatch = fs.readBatch(nullptr, 0);
+    fs.execute(emptyBatch);
+    fs.wait(emptyBatch);
+    fs.closeHandle(emptyBatch);
+
+    deleteAllDir(fs, ".test_batch");
+    testContext.end();
+}
+
+void testFileCache(TestContext& ctx)
+{
+    auto& testContext = (FileSystemContext&)ctx;
+    testContext.begin();
+
+    const int fileCount = 8;
+    const int fileSize = 4096;
+    FileSystemDesc desc { testContext.ts };
+    desc.cacheBudget = fileCount * fileSize;
+    IFileSystem& fs = *IFileSystem::create(desc);
+
+    auto fileName = [](int i) { return ".test_cache/include-" + std::to_string(i) + ".h"; };
+    auto writeFile = [&fs](const std::string& name, const std::string& contents)
+    {
+        AsyncFileHandle h = fs.write(FileWriteRequest(name, [](FileWriteResponse& response)
+        {
+            CPY_ASSERT_FMT(response.status != FileStatus::Fail, "writing fail: %s", IoError2String(response.error));
+        }, contents.c_str(), (int)contents.size(), (int)FileRequestFlags::AutoStart));
+        fs.wait(h);
+        fs.closeHandle(h);
+    };
+
+    auto readFile = [&fs](const std::string& name, SharedFileBuffer* sharedBuffer = nullptr)
+    {
+        std::string result;
+        AsyncFileHandle h = fs.read(FileReadRequest(name, [&result, sharedBuffer](FileReadResponse& response)
+        {
+            CPY_ASSERT_FMT(response.status != FileStatus::Fail, "reading fail: %s", IoError2String(response.error));
+            if (response.status == FileStatus::Reading)
+            {
+                CPY_ASSERT(response.sharedBuffer != nullptr);
+                result.append(response.buffer, response.size);
+                if (sharedBuffer)
+                    *sharedBuffer = response.sharedBuffer;
+            }
+        }, (int)FileRequestFlags::AutoStart));
+        fs.wait(h);
+        fs.closeHandle(h);
+        return result;
+    };
+
+    std::vector<std::string> contents(fileCount);
+    for (int i = 0; i < fileCount; ++i)
+    {
+        contents[i] = std::string(fileSize, (char)('a' + i));
+        writeFile(fileName(i), contents[i]);
+    }
+
+    //a warm set of compiles sharing the same includes only reads them once.
+    for (int compile = 0; compile < 50; ++compile)
+    {
+        for (int i = 0; i < fileCount; ++i)
+            CPY_ASSERT(readFile(fileName(i)) == contents[i]);
+    }
+
+    FileCacheStats stats;
+    fs.getCacheStats(stats);
+    CPY_ASSERT_FMT(stats.misses == fileCount, "%d", (int)stats.misses);
+    CPY_ASSERT_FMT(stats.hits == 49 * fileCount, "%d", (int)stats.hits);
+    CPY_ASSERT(stats.files == fileCount && stats.bytes == (size_t)(fileCount * fileSize));
+
+    //a changed file is read again, buffers handed out before keep the old contents.
+    SharedFileBuffer oldBuffer;
+    readFile(fileName(0), &oldBuffer);
+    std::string edited = "edited";
+    writeFile(fileName(0), edited);
+    CPY_ASSERT(readFile(fileName(0)) == edited);
+    CPY_ASSERT(oldBuffer != nullptr && std::string((const char*)oldBuffer->data(), oldBuffer->size()) == contents[0]);
+    fs.getCacheStats(stats);
+    CPY_ASSERT_FMT(stats.misses == fileCount + 1, "%d", (int)stats.misses);
+
+    //going over the budget evicts the least recently used files.
+    std::string extra(2 * fileSize, 'z');
+    writeFile(".test_cache/extra.h", extra);
+    CPY_ASSERT(readFile(".test_cache/extra.h") == extra);
+    fs.getCacheStats(stats);
+    CPY_ASSERT_FMT(stats.evictions == 2, "%d", (int)stats.evictions);
+    CPY_ASSERT(stats.bytes <= desc.cacheBudget);
+
+    uint64_t misses = stats.misses;
+    CPY_ASSERT(readFile(fileName(1)) == contents[1]);
+    fs.getCacheStats(stats);
+    CPY_ASSERT_FMT(stats.misses == misses + 1, "%d", (int)stats.misses);
+
+    //files over the whole budget, and mapped reads, go straight to disk without touching the cache.
+    std::string huge(desc.cacheBudget + 1, 'h');
+    writeFile(".test_cache/huge.h", huge);
+    bool mapped = false;
+    for (int flags : { (int)FileRequestFlags::AutoStart, (int)FileRequestFlags::AutoStart | (int)FileRequestFlags::MemoryMap })
+    {
+        std::string result;
+        AsyncFileHandle h = fs.read(FileReadRequest(".test_cache/huge.h", [&result, &mapped](FileReadResponse& response)
+        {
+            CPY_ASSERT_FMT(response.status != FileStatus::Fail, "reading fail: %s", IoError2String(response.error));
+            if (response.status == FileStatus::Reading)
+            {
+                CPY_ASSERT(response.sharedBuffer == nullptr);
+                result.append(response.buffer, response.size);
+                mapped = response.mapped;
+            }
+        }, flags));
+        fs.wait(h);
+        fs.closeHandle(h);
+        CPY_ASSERT(result == huge);
+    }
+    CPY_ASSERT(mapped);
+    fs.getCacheStats(stats);
+    CPY_ASSERT_FMT(stats.misses == misses + 1, "%d", (int)stats.misses);
+
+    deleteAllDir(fs, ".test_cache");
+    delete &fs;
+    testContext.end();
+}
+
+void testResolvedPathCache(TestContext& ctx)
+{
+    auto& testContext = (FileSystemContext&)ctx;
+    testContext.begin();
+
+    //changes are reported by hand, files are touched behind the file system's back.
+    class ManualWatcher : public IFileWatcher
+    {
+    public:
+        virtual void start() override {}
+        virtual void stop() override {}
+        virtual void addDirectory(const char* directory) override {}
+        virtual bool isWatched(const char* path) override { return watchesAll || std::string(path).rfind(".test_resolve", 0) == 0; }
+        virtual void addListener(IFileWatchListener* l) override { listener = l; }
+        virtual void removeListener(IFileWatchListener* l) override { listener = nullptr; }
+        void notify(const char* file) { listener->onFilesChanged(std::set<std::string> { file }); }
+        IFileWatchListener* listener = nullptr;
+        bool watchesAll = true;
+    } watcher;
+
+    FileSystemDesc desc { testContext.ts };
+    desc.fw = &watcher;
+    desc.cacheResolvedPaths = true;
+    IFileSystem& fs = *IFileSystem::create(desc);
+    CPY_ASSERT(watcher.listener != nullptr);
+
+    auto writeExternal = [](const char* name, const char* contents)
+    {
+        std::ofstream file(name, std::ios::binary | std::ios::trunc);
+        file << contents;
+    };
+
+    auto readFile = [&fs](const char* name, std::string& result)
+    {
+        result.clear();
+        bool success = false;
+        FileReadRequest request(name, [&result, &success](FileReadResponse& response)
+        {
+            if (response.status == FileStatus::Reading)
+                result.append(response.buffer, response.size);
+            else if (response.status == FileStatus::Success)
+                success = true;
+        }, (int)FileRequestFlags::AutoStart);
+        request.additionalRoots = { ".test_resolve/a", ".test_resolve/b" };
+        AsyncFileHandle h = fs.read(request);
+        fs.wait(h);
+        fs.closeHandle(h);
+        return success;
+    };
+
+    CPY_ASSERT(fs.carveDirectoryPath(".test_resolve/a"));
+    CPY_ASSERT(fs.carveDirectoryPath(".test_resolve/b"));
+    writeExternal(".test_resolve/b/f.txt", "b");
+
+    std::string result;
+    CPY_ASSERT(readFile("f.txt", result) && result == "b");
+
+    //a file shadowing the resolved one goes unnoticed until the watcher reports it.
+    writeExternal(".test_resolve/a/f.txt", "a");
+    CPY_ASSERT(readFile("f.txt", result) && result == "b");
+    watcher.notify(".test_resolve/a/f.txt");
+    CPY_ASSERT(readFile("f.txt", result) && result == "a");
+
+    //so does a file that did not exist.
+    CPY_ASSERT(!readFile("g.txt", result));
+    writeExternal(".test_resolve/b/g.txt", "g");
+    CPY_ASSERT(!readFile("g.txt", result));
+    watcher.notify(".test_resolve/b/g.txt");
+    CPY_ASSERT(readFile("g.txt", result) && result == "g");
+
+    //a resolved file gone missing falls back to the next root on its own.
+    std::remove(".test_resolve/a/f.txt");
+    CPY_ASSERT(readFile("f.txt", result) && result == "b");
+
+    //nothing is remembered past a candidate the watcher does not cover, the working directory here.
+    watcher.watchesAll = false;
+    watcher.notify(".test_resolve/a/f.txt");
+    CPY_ASSERT(readFile("f.txt", result) && result == "b");
+    writeExternal(".test_resolve/a/f.txt", "a");
+    CPY_ASSERT(readFile("f.txt", result) && result == "a");
+    std::remove(".test_resolve/a/f.txt");
+    CPY_ASSERT(!readFile("h.txt", result));
+    writeExternal(".test_resolve/a/h.txt", "h");
+    CPY_ASSERT(readFile("h.txt", result) && result == "h");
+    std::remove(".test_resolve/a/h.txt");
+
+    deleteAllDir(fs, ".test_resolve/b");
+    CPY_ASSERT(fs.deleteDirectory(".test_resolve/a"));
+    CPY_ASSERT(fs.deleteDirectory(".test_resolve"));
+    delete &fs;
+    CPY_ASSERT(watcher.listener == nullptr);
+    testContext.end();
+}
+
+void testStreamedWrite(TestContext& ctx)
+{
+    auto& testContext = (FileSystemContext&)ctx;
+    testContext.begin();
+
+    IFileSystem& fs = *testContext.fs;
+
+    auto readFile = [&fs](const std::string& name)
+    {
+        std::string result;
+        AsyncFileHandle h = fs.read(FileReadRequest(name, [&result](FileReadResponse& response)
+        {
+            CPY_ASSERT_FMT(response.status != FileStatus::Fail, "reading fail: %s", IoError2String(response.error));
+            if (response.status == FileStatus::Reading)
+                result.append(response.buffer, response.size);
+        }, (int)FileRequestFlags::AutoStart));
+        fs.wait(h);
+        fs.closeHandle(h);
+        return result;
+    };
+
+    auto onWrite = [](FileWriteResponse& response)
+    {
+        CPY_ASSERT_FMT(response.status != FileStatus::Fail, "writing fail: %s", IoError2String(response.error));
+    };
+
+    //a shared buffer is written without a copy, and the request keeps it alive.
+    std::string old = "old contents";
+    {
+        ByteBuffer contents;
+        contents.append((const u8*)old.c_str(), old.size());
+        FileWriteRequest request(".test_stream/test.txt", onWrite, nullptr, 0, (int)FileRequestFlags::AutoStart);
+        request.sharedBuffer = std::make_shared<const ByteBuffer>(std::move(contents));
+        AsyncFileHandle h = fs.write(request);
+        request.sharedBuffer = nullptr;
+        fs.wait(h);
+        fs.closeHandle(h);
+    }
+    CPY_ASSERT(readFile(".test_stream/test.txt") == old);
+
+    //chunks land one after the other, pieces bigger than a single blocking write included.
+    std::vector<std::string> chunks;
+    std::string expected;
+    for (int i = 0; i < 64; ++i)
+    {
+        chunks.push_back(std::string(i == 32 ? 3 * 1024 * 1024 + 7 : 1000 + i, (char)('a' + i % 26)));
+        expected += chunks.back();
+    }
+
+    bool writeSuccess = false;
+    AsyncFileHandle h = fs.beginWrite(FileWriteRequest(".test_stream/test.txt", [&writeSuccess](FileWriteResponse& response)
+    {
+        CPY_ASSERT_FMT(response.status != FileStatus::Fail, "writing fail: %s", IoError2String(response.error));
+        if (response.status == FileStatus::Success)
+            writeSuccess = true;
+    }, nullptr, 0, (int)FileRequestFlags::BorrowBuffer | (int)FileRequestFlags::AtomicReplace));
+
+    for (const std::string& chunk : chunks)
+        fs.appendWrite(h, chunk.c_str(), (int)chunk.size());
+
+    //the target is only replaced once the stream ends.
+    CPY_ASSERT(readFile(".test_stream/test.txt") == old);
+
+    //another instance replacing the same file meanwhile gets a temp file of its own.
+    {
+        FileSystemDesc otherDesc { testContext.ts };
+        IFileSystem* otherFs = IFileSystem::create(otherDesc);
+        std::string other = "other contents";
+        AsyncFileHandle otherHandle = otherFs->write(FileWriteRequest(".test_stream/test.txt", onWrite,
+            other.c_str(), (int)other.size(), (int)FileRequestFlags::AutoStart | (int)FileRequestFlags::AtomicReplace));
+        otherFs->wait(otherHandle);
+        otherFs->closeHandle(otherHandle);
+        delete otherFs;
+        CPY_ASSERT(readFile(".test_stream/test.txt") == other);
+    }
+
+    fs.endWrite(h);
+    fs.wait(h);
+    fs.closeHandle(h);
+    CPY_ASSERT(writeSuccess);
+    CPY_ASSERT(readFile(".test_stream/test.txt") == expected);
+
+    //nothing is left next to the target.
+    std::vector<std::string> files;
+    fs.enumerateFiles(".test_stream", files);
+    int fileCount = 0;
+    for (auto& f : files)
+    {
+        FileAttributes attributes = {};
+        fs.getFileAttributes(f.c_str(), attributes);
+        fileCount += attributes.isDir ? 0 : 1;
+    }
+    CPY_ASSERT_FMT(fileCount == 1, "%d", fileCount);
+
+    deleteAllDir(fs, ".test_stream");
+    testContext.end();
+}
+
+void testRangedRead(TestContext& ctx)
+{
+    auto& testContext = (FileSystemContext&)ctx;
+    testContext.begin();
+
+    IFileSystem& fs = *testContext.fs;
+
+    std::string str;
+    for (int i = 0; str.size() < 300 * 1024; ++i)
+        str += std::to_string(i) + ",";
+
+    AsyncFileHandle writeHandle = fs.write(FileWriteRequest(".test_ranged/test.txt", [](FileWriteResponse& response)
+    {
+        CPY_ASSERT_FMT(response.status != FileStatus::Fail, "writing fail: %s", IoError2String(response.error));
+    }, str.c_str(), str.size(), (int)FileRequestFlags::AutoStart));
+    fs.wait(writeHandle);
+    fs.closeHandle(writeHandle);
+
+    //slices read in parallel land where their offsets say, mapped or not.
+    for (int flags : { 0, (int)FileRequestFlags::MemoryMap })
+    {
+        const int sliceCount = 4;
+        const uint64_t sliceSize = (uint64_t)str.size() / sliceCount + 1;
+        std::string result(str.size(), '\0');
+        std::vector<AsyncFileHandle> handles;
+        for (int i = 0; i < sliceCount; ++i)
+        {
+            FileReadRequest request(".test_ranged/test.txt", [&result](FileReadResponse& response)
+            {
+                CPY_ASSERT_FMT(response.status != FileStatus::Fail, "reading fail: %s", IoError2String(response.error));
+                if (response.status == FileStatus::Reading)
+                {
+                    CPY_ASSERT(response.offset + response.size <= result.size());
+                    memcpy(&result[(size_t)response.offset], response.buffer, response.size);
+                }
+            }, flags);
+            request.offset = i * sliceSize;
+            request.length = sliceSize;
+            handles.push_back(fs.read(request));
+            fs.execute(handles.back());
+        }
+
+        for (AsyncFileHandle h : handles)
+        {
+            fs.wait(h);
+            fs.closeHandle(h);
+        }
+        CPY_ASSERT(result == str);
+    }
+
+    //offsets past 4GB, on a sparse file.
+    const uint64_t largeOffset = 5ull * 1024 * 1024 * 1024;
+    {
+        std::ofstream largeFile(".test_ranged/large.bin", std::ios::binary);
+        largeFile.seekp((std::streamoff)largeOffset);
+        largeFile << "tail";
+    }
+
+    for (int flags : { 0, (int)FileRequestFlags::MemoryMap })
+    {
+        std::string tail;
+        uint64_t tailOffset = 0;
+        FileReadRequest request(".test_ranged/large.bin", [&tail, &tailOffset](FileReadResponse& response)
+        {
+            CPY_ASSERT_FMT(response.status != FileStatus::Fail, "reading fail: %s", IoError2String(response.error));
+            if (response.status == FileStatus::Reading && response.size > 0)
+            {
+                tailOffset = response.offset;
+                tail.append(response.buffer, response.size);
+            }
+        }, flags | (int)FileRequestFlags::AutoStart);
+        request.offset = largeOffset;
+        AsyncFileHandle h = fs.read(request);
+        fs.wait(h);
+        fs.closeHandle(h);
+        CPY_ASSERT(tail == "tail" && tailOffset == largeOffset);
+    }
+
+    deleteAllDir(fs, ".test_ranged");
+    testContext.end();
+}
+
+void testEnumerate(TestContext& ctx)
+{
+    auto& testContext = (FileSystemContext&)ctx;
+    testContext.begin();
+
+    IFileSystem& fs = *testContext.fs;
+
+    //a few levels of shaders and textures.
+    std::unordered_map<std::string, size_t> shaders;
+    std::vector<std::string> allFiles;
+    for (int i = 0; i < 24; ++i)
+    {
+        std::stringstream dir;
+        dir << ".test_enum/d" << (i % 3) << "/s" << (i % 4);
+        std::string shader = dir.str() + "/shader-" + std::to_string(i) + ".hlsl";
+        std::string texture = dir.str() + "/texture-" + std::to_string(i) + ".png";
+        std::string contents(100 + i, 'x');
+        for (const std::string& fileName : { shader, texture })
+        {
+            AsyncFileHandle h = fs.write(FileWriteRequest(fileName, [](FileWriteResponse& response)
+            {
+                CPY_ASSERT_FMT(response.status != FileStatus::Fail, "writing fail: %s", IoError2String(response.error));
+            }, contents.c_str(), contents.size(), (int)FileRequestFlags::AutoStart));
+            fs.wait(h);
+            fs.closeHandle(h);
+            allFiles.push_back(fileName);
+        }
+        shaders[shader] = contents.size();
+    }
+
+    auto enumerate = [&fs](FileEnumerateRequest request, std::vector<FileEntry>& entries)
+    {
+        bool success = false;
+        std::atomic<int> inCallback = 0;
+        request.flags = (int)FileRequestFlags::AutoStart;
+        request.callback = [&entries, &success, &inCallback](FileEnumerateResponse& response)
+        {
+            CPY_ASSERT(inCallback.fetch_add(1) == 0);
+            if (response.status == FileStatus::Reading)
+                entries.insert(entries.end(), response.entries, response.entries + response.count);
+            success = response.status == FileStatus::Success;
+            inCallback.fetch_sub(1);
+        };
+        AsyncFileHandle h = fs.enumerate(request);
+        fs.wait(h);
+        fs.closeHandle(h);
+        return success;
+    };
+
+    //the whole tree, filtered by extension, with sizes.
+    {
+        FileEnumerateRequest request;
+        request.path = ".test_enum";
+        request.patterns = { "*.hlsl" };
+        std::vector<FileEntry> entries;
+        CPY_ASSERT(enumerate(request, entries));
+        CPY_ASSERT_FMT(entries.size() == shaders.size(), "%d entries", (int)entries.size());
+        for (const FileEntry& entry : entries)
+        {
+            std::string path;
+            FileUtils::fixStringPath(entry.path, path);
+            auto it = shaders.find(path);
+            CPY_ASSERT_FMT(it != shaders.end(), "unexpected %s", entry.path.c_str());
+            CPY_ASSERT(it != shaders.end() && !entry.isDir && entry.size == it->second && entry.modifiedTime != 0);
+        }
+    }
+
+    //directories, one level at a time.
+    {
+        FileEnumerateRequest request;
+        request.path = ".test_enum";
+        request.includeDirectories = true;
+        request.recursive = false;
+        request.patterns = { "d?" };
+        std::vector<FileEntry> entries;
+        CPY_ASSERT(enumerate(request, entries));
+        CPY_ASSERT(entries.size() == 3);
+        for (const FileEntry& entry : entries)
+            CPY_ASSERT(entry.isDir);
+    }
+
+    {
+        FileEnumerateRequest request;
+        request.path = ".test_enum_missing";
+        std::vector<FileEntry> entries;
+        CPY_ASSERT(!enumerate(request, entries));
+    }
+
+    for (const std::string& fileName : allFiles)
+        CPY_ASSERT(fs.deleteFile(fileName.c_str()));
+    for (int d = 0; d < 3; ++d)
+    {
+        std::string dir = ".test_enum/d" + std::to_string(d);
+        deleteAllDir(fs, dir.c_str());
+    }
+    CPY_ASSERT(fs.deleteDirectory(".test_enum"));
+    testContext.end();
+}
+
 void testFileWatcher(TestContext& ctx)
 {
     auto& testContext = (FileSystemContext&)ctx;
@@ -215,6 +942,12 @@ void testFileWatcher(TestContext& ctx)
     fileWatcher.addListener(&watchObj); 
     fileWatcher.addDirectory(".testWatchFile");
 
+    //paths under the directory are watched whether they exist or not, siblings sharing its prefix are not.
+    CPY_ASSERT(fileWatcher.isWatched(getFileName(0).c_str()));
+    CPY_ASSERT(fileWatcher.isWatched("./.testWatchFile/missing/file.txt"));
+    CPY_ASSERT(!fileWatcher.isWatched(".testWatchFileSibling/file.txt"));
+    CPY_ASSERT(!fileWatcher.isWatched("file.txt"));
+
     for (int j = 0; j < 16; ++j)
     {
         for (int i = 0; i < numFiles; ++i)
@@ -246,12 +979,339 @@ void testFileWatcher(TestContext& ctx)
 
 }
 
+void testFileWatcherEvents(TestContext& ctx)
+{
+    auto& testContext = (FileSystemContext&)ctx;
+    testContext.begin();
+    IFileSystem& fs = *testContext.fs;
+
+    CPY_ASSERT(fs.carveDirectoryPath(".testWatchTree/sub"));
+
+    class WatchObj : public IFileWatchListener
+    {
+    public:
+        virtual void onFilesChanged(const std::set<std::string>& filesChanged) override
+        {
+            std::unique_lock lock(m_mutex);
+            ++m_reports;
+            for (auto& fn : filesChanged)
+            {
+                std::string resolvedPath;
+                FileUtils::getAbsolutePath(fn, resolvedPath);
+                m_files.insert(resolvedPath);
+            }
+        }
+
+        //true once the file got reported, gives up after a few seconds.
+        bool waitFor(const char* fileName)
+        {
+            std::string resolvedPath;
+            FileUtils::getAbsolutePath(fileName, resolvedPath);
+            for (int i = 0; i < 300; ++i)
+            {
+                {
+                    std::unique_lock lock(m_mutex);
+                    if (m_files.count(resolvedPath) != 0)
+                        return true;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            return false;
+        }
+
+        int reset()
+        {
+            std::unique_lock lock(m_mutex);
+            int reports = m_reports;
+            m_reports = 0;
+            m_files.clear();
+            return reports;
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::set<std::string> m_files;
+        int m_reports = 0;
+    };
+
+    auto touch = [](const char* fileName)
+    {
+        std::ofstream file(fileName);
+        file << "hello world";
+    };
+
+    FileWatchDesc fwdesc;
+    fwdesc.debounceMS = 100;
+    IFileWatcher& fileWatcher = *IFileWatcher::create(fwdesc);
+    fileWatcher.start();
+    WatchObj watchObj;
+    fileWatcher.addListener(&watchObj);
+    fileWatcher.addDirectory(".testWatchTree");
+
+    //subdirectories are watched, those created afterwards included.
+    touch(".testWatchTree/sub/a.txt");
+    CPY_ASSERT(watchObj.waitFor(".testWatchTree/sub/a.txt"));
+    CPY_ASSERT(fs.carveDirectoryPath(".testWatchTree/new/deeper"));
+    touch(".testWatchTree/new/deeper/b.txt");
+    CPY_ASSERT(watchObj.waitFor(".testWatchTree/new/deeper/b.txt"));
+
+    //saving through a rename.
+    touch(".testWatchOutside.txt");
+    CPY_ASSERT(std::rename(".testWatchOutside.txt", ".testWatchTree/sub/a.txt") == 0);
+    CPY_ASSERT(watchObj.waitFor(".testWatchTree/sub/a.txt"));
+
+    //a burst of saves lands in the same report.
+    watchObj.reset();
+    for (int i = 0; i < 20; ++i)
+        touch(".testWatchTree/sub/a.txt");
+    CPY_ASSERT(watchObj.waitFor(".testWatchTree/sub/a.txt"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(3 * fwdesc.debounceMS));
+    int reports = watchObj.reset();
+    CPY_ASSERT_FMT(reports >= 1 && reports <= 3, "%d reports", reports);
+
+    fileWatcher.removeListener(&watchObj);
+    fileWatcher.stop();
+    delete &fileWatcher;
+
+    CPY_ASSERT(fs.deleteFile(".testWatchTree/new/deeper/b.txt"));
+    CPY_ASSERT(fs.deleteDirectory(".testWatchTree/new/deeper"));
+    CPY_ASSERT(fs.deleteDirectory(".testWatchTree/new"));
+    deleteAllDir(fs, ".testWatchTree/sub");
+    CPY_ASSERT(fs.deleteDirectory(".testWatchTree"));
+    testContext.end();
+}
+
+void testPrefetch(TestContext& ctx)
+{
+    auto& testContext = (FileSystemContext&)ctx;
+    testContext.begin();
+
+    const int fileCount = 8;
+    const int fileSize = 64 * 1024;
+    FileSystemDesc desc { testContext.ts };
+    desc.cacheBudget = fileCount * fileSize;
+    IFileSystem& fs = *IFileSystem::create(desc);
+
+    auto fileName = [](int i) { return ".test_prefetch/dep-" + std::to_string(i) + ".h"; };
+    std::vector<std::string> contents(fileCount);
+    std::vector<std::string> paths;
+    for (int i = 0; i < fileCount; ++i)
+    {
+        contents[i] = std::string(fileSize, (char)('a' + i));
+        paths.push_back(fileName(i));
+        AsyncFileHandle h = fs.write(FileWriteRequest(paths.back(), [](FileWriteResponse& response)
+        {
+            CPY_ASSERT_FMT(response.status != FileStatus::Fail, "writing fail: %s", IoError2String(response.error));
+        }, contents[i].c_str(), contents[i].size(), (int)FileRequestFlags::AutoStart));
+        fs.wait(h);
+        fs.closeHandle(h);
+    }
+
+    auto readFile = [](IFileSystem& fs, const std::string& name, FileAccessHint access, int flags)
+    {
+        std::string result;
+        FileReadRequest request(name, [&result](FileReadResponse& response)
+        {
+            CPY_ASSERT_FMT(response.status != FileStatus::Fail, "reading fail: %s", IoError2String(response.error));
+            if (response.status == FileStatus::Reading)
+                result.append(response.buffer, response.size);
+        }, flags | (int)FileRequestFlags::AutoStart);
+        request.access = access;
+        AsyncFileHandle h = fs.read(request);
+        fs.wait(h);
+        fs.closeHandle(h);
+        return result;
+    };
+
+    //missing files are skipped, the rest lands in the cache without counting as misses.
+    std::vector<std::string> prefetched = paths;
+    prefetched.push_back(".test_prefetch/missing.h");
+    fs.prefetch(prefetched);
+
+    FileCacheStats stats;
+    for (int attempt = 0; attempt < 500; ++attempt)
+    {
+        fs.getCacheStats(stats);
+        if (stats.files == fileCount)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    CPY_ASSERT_FMT(stats.files == fileCount, "%d", stats.files);
+    CPY_ASSERT_FMT(stats.misses == 0, "%d", (int)stats.misses);
+
+    //the compile that follows never waits on the disk.
+    for (int i = 0; i < fileCount; ++i)
+        CPY_ASSERT(readFile(fs, paths[i], FileAccessHint::Sequential, 0) == contents[i]);
+    fs.getCacheStats(stats);
+    CPY_ASSERT_FMT(stats.hits == fileCount && stats.misses == 0, "%d %d", (int)stats.hits, (int)stats.misses);
+
+    //prefetches still running when the file system goes away get waited on.
+    fs.prefetch(paths);
+    delete &fs;
+
+    //without a cache the hint goes to the os, and access hints leave the contents alone.
+    FileSystemDesc uncachedDesc { testContext.ts };
+    IFileSystem& uncachedFs = *IFileSystem::create(uncachedDesc);
+    uncachedFs.prefetch(prefetched);
+    for (int i = 0; i < fileCount; ++i)
+    {
+        CPY_ASSERT(readFile(uncachedFs, paths[i], FileAccessHint::Random, 0) == contents[i]);
+        CPY_ASSERT(readFile(uncachedFs, paths[i], FileAccessHint::Random, (int)FileRequestFlags::MemoryMap) == contents[i]);
+        CPY_ASSERT(readFile(uncachedFs, paths[i], FileAccessHint::Sequential, (int)FileRequestFlags::MemoryMap) == contents[i]);
+    }
+
+    deleteAllDir(uncachedFs, ".test_prefetch");
+    delete &uncachedFs;
+    testContext.end();
+}
+
+void testPack(TestContext& ctx)
+{
+    auto& testContext = (FileSystemContext&)ctx;
+    testContext.begin();
+
+    IFileSystem& fs = *testContext.fs;
+    auto writeFile = [&fs](const std::string& name, const std::string& contents)
+    {
+        AsyncFileHandle h = fs.write(FileWriteRequest(name, [](FileWriteResponse& response)
+        {
+            CPY_ASSERT_FMT(response.status != FileStatus::Fail, "writing fail: %s", IoError2String(response.error));
+        }, contents.c_str(), contents.size(), (int)FileRequestFlags::AutoStart));
+        fs.wait(h);
+        fs.closeHandle(h);
+    };
+
+    struct PackRead
+    {
+        bool success = false;
+        bool mapped = false;
+        bool shared = false;
+        const char* buffer = nullptr;
+        std::string contents;
+    };
+
+    auto readFile = [&fs](const std::string& name, std::vector<std::string> roots = {}, uint64_t offset = 0, uint64_t length = 0)
+    {
+        PackRead result;
+        FileReadRequest request(name, [&result](FileReadResponse& response)
+        {
+            if (response.status == FileStatus::Reading)
+            {
+                result.mapped = response.mapped;
+                result.shared = response.sharedBuffer != nullptr;
+                result.buffer = response.buffer;
+                result.contents.append(response.buffer, response.size);
+            }
+            result.success = response.status == FileStatus::Success;
+        }, (int)FileRequestFlags::AutoStart);
+        request.additionalRoots = roots;
+        request.offset = offset;
+        request.length = length;
+        AsyncFileHandle h = fs.read(request);
+        fs.wait(h);
+        fs.closeHandle(h);
+        return result;
+    };
+
+    std::string common;
+    for (int i = 0; common.size() < 600 * 1024; ++i)
+        common += "float4 value" + std::to_string(i) + ";\n";
+
+    std::string noise(8 * 1024, '\0');
+    unsigned state = 12345u;
+    for (char& c : noise)
+    {
+        state = state * 1664525u + 1013904223u;
+        c = (char)(state >> 24);
+    }
+
+    writeFile(".test_pack/src/shaders/common.hlsl", common);
+    writeFile(".test_pack/src/shaders/noise.bin", noise);
+    writeFile(".test_pack/src/a.png", "png");
+    writeFile(".test_pack/src/empty.txt", "");
+    writeFile(".test_pack/disk/shaders/common.hlsl", "disk");
+
+    PackBuildDesc buildDesc;
+    buildDesc.taskSystem = testContext.ts;
+    PackUtil::collectFiles(".test_pack/src/", buildDesc.files);
+    CPY_ASSERT_FMT(buildDesc.files.size() == 4, "%d", (int)buildDesc.files.size());
+    std::string error;
+    bool built = PackUtil::buildPack(buildDesc, ".test_pack/data.cpak", error);
+    CPY_ASSERT_FMT(built, "%s", error.c_str());
+
+    buildDesc.files.push_back(buildDesc.files.front());
+    CPY_ASSERT(!PackUtil::buildPack(buildDesc, ".test_pack/twice.cpak", error));
+    CPY_ASSERT(!fs.mountPack(PackMountRequest { ".test_pack/src/a.png" }));
+
+    //a header pointing its paths past the end of the pack is rejected.
+    {
+        std::ifstream packFile(".test_pack/data.cpak", std::ios::binary);
+        std::string bytes((std::istreambuf_iterator<char>(packFile)), std::istreambuf_iterator<char>());
+        uint64_t pathsOffset = (uint64_t)bytes.size() * 2;
+        memcpy(&bytes[16], &pathsOffset, sizeof(pathsOffset));
+        std::ofstream corruptFile(".test_pack/corrupt.cpak", std::ios::binary | std::ios::trunc);
+        corruptFile.write(bytes.data(), (std::streamsize)bytes.size());
+    }
+    CPY_ASSERT(!fs.mountPack(PackMountRequest { ".test_pack/corrupt.cpak" }));
+    CPY_ASSERT(fs.deleteFile(".test_pack/corrupt.cpak"));
+
+    //ahead of the disk, the pack hides what the disk has, and answers for every root it is mounted under.
+    CPY_ASSERT(fs.mountPack(PackMountRequest { ".test_pack/data.cpak", ".test_pack/disk" }));
+    {
+        PackRead compressed = readFile("shaders/common.hlsl", { ".test_pack/missing", ".test_pack/disk" });
+        CPY_ASSERT(compressed.success && compressed.shared && !compressed.mapped);
+        CPY_ASSERT(compressed.contents == common);
+
+        PackRead stored = readFile(".test_pack/disk/shaders/noise.bin");
+        CPY_ASSERT(stored.success && stored.mapped && stored.contents == noise);
+        CPY_ASSERT(((uintptr_t)stored.buffer % buildDesc.alignment) == 0);
+
+        PackRead empty = readFile("./.test_pack/disk//empty.txt");
+        CPY_ASSERT(empty.success && empty.contents.empty());
+
+        //slices only inflate the blocks they cover, one straddling two of them included.
+        const uint64_t blockSize = 256 * 1024;
+        PackRead slice = readFile(".test_pack/disk/shaders/common.hlsl", {}, blockSize - 10, 20);
+        CPY_ASSERT(slice.success && slice.contents == common.substr(blockSize - 10, 20));
+        PackRead tail = readFile(".test_pack/disk/shaders/common.hlsl", {}, 2 * blockSize + 7);
+        CPY_ASSERT(tail.success && tail.contents == common.substr(2 * blockSize + 7));
+    }
+    CPY_ASSERT(fs.unmountPack(".test_pack/data.cpak"));
+    CPY_ASSERT(!fs.unmountPack(".test_pack/data.cpak"));
+
+    //behind the disk, the pack only fills in what the disk does not have.
+    CPY_ASSERT(fs.mountPack(PackMountRequest { ".test_pack/data.cpak", ".test_pack/disk", PackMountOrder::AfterDisk }));
+    CPY_ASSERT(readFile(".test_pack/disk/shaders/common.hlsl").contents == "disk");
+    CPY_ASSERT(readFile(".test_pack/disk/a.png").contents == "png");
+    CPY_ASSERT(fs.unmountPack(".test_pack/data.cpak"));
+    CPY_ASSERT(!readFile(".test_pack/disk/a.png").success);
+
+    CPY_ASSERT(fs.deleteFile(".test_pack/data.cpak"));
+    deleteAllDir(fs, ".test_pack/src/shaders");
+    deleteAllDir(fs, ".test_pack/src");
+    deleteAllDir(fs, ".test_pack/disk/shaders");
+    CPY_ASSERT(fs.deleteDirectory(".test_pack/disk"));
+    CPY_ASSERT(fs.deleteDirectory(".test_pack"));
+    testContext.end();
+}
+
 static const TestCase* createCases(int& caseCounts)
 {
     static TestCase sCases[] = {
         { "createDeleteDir", testCreateDeleteDir },
         { "fileReadWrite", testFileReadWrite },
-        { "fileWatcher", testFileWatcher }
+        { "memoryMappedRead", testMemoryMappedRead },
+        { "concurrentReads", testConcurrentReads },
+        { "readBatch", testReadBatch },
+        { "fileCache", testFileCache },
+        { "resolvedPathCache", testResolvedPathCache },
+        { "streamedWrite", testStreamedWrite },
+        { "rangedRead", testRangedRead },
+        { "enumerate", testEnumerate },
+        { "prefetch", testPrefetch },
+        { "pack", testPack },
+        { "fileWatcher", testFileWatcher },
+        { "fileWatcherEvents", testFileWatcherEvents }
     };
 
     caseCounts = (int)(sizeof(sCases) / sizeof(TestCase));
@@ -1,7 +1,15 @@
 #include "testsystem.h"
 #include <coalpy.core/Assert.h>
 #include <coalpy.tasks/ITaskSystem.h>
+#include <coalpy.tasks/MpmcQueue.h>
+#include <coalpy.tasks/TaskFuture.h>
 #include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
 
 namespace coalpy
 {
@@ -120,6 +128,185 @@ void testTaskDeps(TestContext& ctx)
     ts.join();
 }
 
+void testTaskChain(TestContext& ctx)
+{
+    auto& testContext = (TaskSystemContext&)ctx;
+    auto& ts = *testContext.ts;
+    ASSERT_NO_TASKS(ts);
+    ts.start();
+
+    //each link depends on the previous one, so every hop goes through onTaskComplete.
+    const int chainLength = 2000;
+    std::vector<int> order(chainLength, -1);
+    int counter = 0;
+    auto linkJob = TaskDesc([&counter](TaskContext& ctx)
+    {
+        int& slot = *(int*)ctx.data;
+        slot = counter++;
+    });
+
+    std::vector<Task> links(chainLength);
+    for (int i = 0; i < chainLength; ++i)
+    {
+        links[i] = ts.createTask(linkJob, &order[i]);
+        if (i > 0)
+            ts.depends(links[i], links[i - 1]);
+    }
+
+    //also schedule from inside a worker, which must enqueue locally and not deadlock on wait.
+    int nestedValue = 0;
+    Task nested = ts.createTask(TaskDesc([&nestedValue](TaskContext& ctx)
+    {
+        Task child = ctx.ts->createTask(TaskDesc([&nestedValue](TaskContext& ctx) { nestedValue = 7; }));
+        ctx.ts->execute(child);
+        ctx.ts->wait(child);
+        nestedValue *= 2;
+    }));
+
+    Task root = ts.createTask();
+    ts.depends(root, links.back());
+    ts.depends(root, nested);
+    ts.execute(root);
+    ts.wait(root);
+    ts.cleanTaskTree(root);
+    ts.cleanFinishedTasks();
+
+    for (int i = 0; i < chainLength; ++i)
+        CPY_ASSERT_FMT(order[i] == i, "%d != %d", order[i], i);
+    CPY_ASSERT_FMT(nestedValue == 14, "%d", nestedValue);
+
+    ts.signalStop();
+    ts.join();
+}
+
+void testLargeGraph(TestContext& ctx)
+{
+    auto& testContext = (TaskSystemContext&)ctx;
+    auto& ts = *testContext.ts;
+    ASSERT_NO_TASKS(ts);
+    ts.start();
+
+    //every task depends on the whole previous layer, ~100k edges in total.
+    const int layerCount = 100;
+    const int layerWidth = 32;
+    std::vector<std::atomic<int>> layerDone(layerCount);
+    std::atomic<int> errors = 0;
+    struct NodeData { int layer; };
+    std::vector<NodeData> nodes(layerCount * layerWidth);
+    std::vector<Task> tasks(layerCount * layerWidth);
+
+    auto nodeJob = TaskDesc([&layerDone, &errors, layerWidth](TaskContext& ctx)
+    {
+        auto& node = *(NodeData*)ctx.data;
+        if (node.layer > 0 && layerDone[node.layer - 1].load() != layerWidth)
+            ++errors;
+        ++layerDone[node.layer];
+    });
+
+    for (int l = 0; l < layerCount; ++l)
+    {
+        layerDone[l] = 0;
+        for (int i = 0; i < layerWidth; ++i)
+        {
+            int index = l * layerWidth + i;
+            nodes[index].layer = l;
+            tasks[index] = ts.createTask(nodeJob, &nodes[index]);
+            if (l > 0)
+                ts.depends(tasks[index], &tasks[(l - 1) * layerWidth], layerWidth);
+        }
+    }
+
+    Task root = ts.createTask();
+    ts.depends(root, &tasks[(layerCount - 1) * layerWidth], layerWidth);
+    ts.execute(root);
+    ts.wait(root);
+
+    //depending on a finished task must not block the new one.
+    Task late = ts.createTask();
+    ts.depends(late, root);
+    ts.execute(late);
+    ts.wait(late);
+
+    ts.cleanTaskTree(late);
+    ASSERT_NO_TASKS(ts);
+
+    CPY_ASSERT_FMT(errors == 0, "%d tasks ran before their dependencies", errors.load());
+    for (int l = 0; l < layerCount; ++l)
+        CPY_ASSERT(layerDone[l] == layerWidth);
+
+    ts.signalStop();
+    ts.join();
+}
+
+void testParallelFor(TestContext& ctx)
+{
+    auto& testContext = (TaskSystemContext&)ctx;
+    auto& ts = *testContext.ts;
+    ASSERT_NO_TASKS(ts);
+    ts.start();
+
+    const int elementCount = 100000;
+    std::vector<int> values(elementCount, 0);
+    int grainSizes[] = { 0, 1, 64, elementCount };
+    for (int grainSize : grainSizes)
+    {
+        std::atomic<int> calls = 0;
+        ts.parallelFor(0, elementCount, grainSize, [&values, &calls](int b, int e)
+        {
+            ++calls;
+            for (int i = b; i < e; ++i)
+                values[i] += i;
+        });
+        CPY_ASSERT(calls >= 1);
+    }
+
+    for (int i = 0; i < elementCount; ++i)
+        CPY_ASSERT_FMT(values[i] == i * 4, "%d != %d", values[i], i * 4);
+
+    //empty and tiny ranges run inline.
+    int inlineCalls = 0;
+    ts.parallelFor(5, 5, 0, [&inlineCalls](int b, int e) { ++inlineCalls; });
+    ts.parallelFor(0, 3, 8, [&inlineCalls](int b, int e) { ++inlineCalls; });
+    CPY_ASSERT_FMT(inlineCalls == 1, "%d", inlineCalls);
+
+    long long sum = ts.parallelReduce(0, elementCount, 0, 0ll,
+        [](int b, int e, long long acc)
+        {
+            for (int i = b; i < e; ++i)
+                acc += i;
+            return acc;
+        },
+        [](long long a, long long b) { return a + b; });
+    CPY_ASSERT(sum == (long long)elementCount * (elementCount - 1) / 2);
+
+    //parallelFor from inside tasks must help instead of blocking the workers.
+    const int outerCount = 16;
+    std::vector<int> innerSums(outerCount, 0);
+    std::vector<Task> outerTasks;
+    for (int& innerSum : innerSums)
+    {
+        outerTasks.push_back(ts.createTask(TaskDesc([](TaskContext& ctx)
+        {
+            int& target = *(int*)ctx.data;
+            target = ctx.ts->parallelReduce(0, 1000, 10, 0,
+                [](int b, int e, int acc) { return acc + (e - b); },
+                [](int a, int b) { return a + b; });
+        }), &innerSum));
+    }
+
+    Task root = ts.createTask();
+    ts.depends(root, outerTasks.data(), (int)outerTasks.size());
+    ts.execute(root);
+    ts.wait(root);
+    ts.cleanTaskTree(root);
+    for (int innerSum : innerSums)
+        CPY_ASSERT_FMT(innerSum == 1000, "%d", innerSum);
+
+    ASSERT_NO_TASKS(ts);
+    ts.signalStop();
+    ts.join();
+}
+
 void testTaskYield(TestContext& ctx)
 {
     auto& testContext = (TaskSystemContext&)ctx;
@@ -167,6 +354,703 @@ void testTaskYield(TestContext& ctx)
     ts.join();
 }
 
+void testNestedYield(TestContext& ctx)
+{
+    auto& testContext = (TaskSystemContext&)ctx;
+    auto& ts = *testContext.ts;
+    ASSERT_NO_TASKS(ts);
+    ts.start();
+
+    //many more yielding tasks than workers, each one waiting on a child that yields too.
+    const int taskCount = 32;
+    std::atomic<int> finishedChildren = 0;
+    std::vector<int> results(taskCount, 0);
+    std::vector<Task> tasks;
+    for (int& result : results)
+    {
+        tasks.push_back(ts.createTask(TaskDesc([&finishedChildren](TaskContext& ctx)
+        {
+            TaskUtil::yieldUntil([](){ TaskUtil::sleepThread(2); });
+            Task child = ctx.ts->createTask(TaskDesc([&finishedChildren](TaskContext& ctx)
+            {
+                TaskUtil::yieldUntil([](){ TaskUtil::sleepThread(2); });
+                TaskUtil::yieldUntil([](){ TaskUtil::sleepThread(1); });
+                ++finishedChildren;
+            }));
+            ctx.ts->execute(child);
+            ctx.ts->wait(child);
+            *(int*)ctx.data = 1;
+        }), &result));
+    }
+
+    Task root = ts.createTask();
+    ts.depends(root, tasks.data(), (int)tasks.size());
+    ts.execute(root);
+    ts.wait(root);
+    ts.cleanTaskTree(root);
+    ts.cleanFinishedTasks();
+
+    CPY_ASSERT_FMT(finishedChildren == taskCount, "%d", finishedChildren.load());
+    for (int result : results)
+        CPY_ASSERT(result == 1);
+
+    ts.signalStop();
+    ts.join();
+}
+
+void testPriorities(TestContext& ctx)
+{
+    //a single worker, so the order it picks jobs in is observable.
+    TaskSystemDesc desc;
+    desc.threadPoolSize = 1;
+    desc.ioThreadPoolSize = 0;
+    ITaskSystem* ts = ITaskSystem::create(desc);
+    ts->start();
+
+    std::atomic<bool> gateStarted = false;
+    std::atomic<bool> gateReleased = false;
+    Task gate = ts->createTask(TaskDesc([&gateStarted, &gateReleased](TaskContext& ctx)
+    {
+        gateStarted = true;
+        while (!gateReleased)
+            std::this_thread::yield();
+    }));
+    ts->execute(gate);
+    while (!gateStarted)
+        std::this_thread::yield();
+
+    //queued while the worker is busy, lowest class first.
+    std::mutex orderMutex;
+    std::vector<TaskPriority> order;
+    const TaskPriority priorities[] = { TaskPriority::Background, TaskPriority::Normal, TaskPriority::Critical };
+    std::vector<Task> tasks;
+    for (int i = 0; i < 2; ++i)
+    {
+        for (TaskPriority priority : priorities)
+        {
+            Task t = ts->createTask(TaskDesc("priority", priority, TaskLane::Cpu, [&orderMutex, &order, priority](TaskContext& ctx)
+            {
+                std::unique_lock lock(orderMutex);
+                order.push_back(priority);
+            }));
+            ts->execute(t);
+            tasks.push_back(t);
+        }
+    }
+
+    gateReleased = true;
+    ts->wait(gate);
+    for (Task t : tasks)
+        ts->wait(t);
+
+    CPY_ASSERT(order.size() == tasks.size());
+    for (int i = 1; i < (int)order.size(); ++i)
+        CPY_ASSERT((int)order[i - 1] <= (int)order[i]);
+
+    ts->cleanFinishedTasks();
+    ts->signalStop();
+    ts->join();
+    delete ts;
+}
+
+void testIoLane(TestContext& ctx)
+{
+    TaskSystemDesc desc;
+    desc.threadPoolSize = 2;
+    desc.ioThreadPoolSize = 1;
+    ITaskSystem* ts = ITaskSystem::create(desc);
+    ts->start();
+
+    //an io task blocking its lane must not hold back the cpu lane.
+    std::atomic<bool> ioReleased = false;
+    std::thread::id ioThread;
+    Task ioTask = ts->createTask(TaskDesc("io", TaskPriority::Normal, TaskLane::Io, [&ioReleased, &ioThread](TaskContext& ctx)
+    {
+        ioThread = std::this_thread::get_id();
+        while (!ioReleased)
+            std::this_thread::yield();
+    }));
+    ts->execute(ioTask);
+
+    std::vector<std::thread::id> cpuThreads(16);
+    std::vector<Task> cpuTasks;
+    for (auto& cpuThread : cpuThreads)
+    {
+        Task t = ts->createTask(TaskDesc([](TaskContext& ctx)
+        {
+            *(std::thread::id*)ctx.data = std::this_thread::get_id();
+        }), &cpuThread);
+        ts->execute(t);
+        cpuTasks.push_back(t);
+    }
+
+    for (Task t : cpuTasks)
+        ts->wait(t);
+
+    ioReleased = true;
+    ts->wait(ioTask);
+    for (auto& cpuThread : cpuThreads)
+        CPY_ASSERT(cpuThread != ioThread);
+
+    ts->cleanFinishedTasks();
+    ts->signalStop();
+    ts->join();
+    delete ts;
+}
+
+void testCapture(TestContext& ctx)
+{
+    auto& testContext = (TaskSystemContext&)ctx;
+    auto& ts = *testContext.ts;
+    ASSERT_NO_TASKS(ts);
+    ts.start();
+    ts.beginCapture();
+
+    std::atomic<int> counter = 0;
+    Task root = ts.createTask(TaskDesc("captureRoot", [](TaskContext& ctx) {}));
+    for (int i = 0; i < 8; ++i)
+    {
+        Task child = ts.createTask(TaskDesc("captureChild", [&counter](TaskContext& ctx)
+        {
+            TaskUtil::yieldUntil([](){ TaskUtil::sleepThread(1); });
+            ++counter;
+        }));
+        ts.depends(root, child);
+    }
+    ts.execute(root);
+    ts.wait(root);
+
+    const char* capturePath = ".test_capture.json";
+    bool written = ts.endCapture(capturePath);
+    CPY_ASSERT(written);
+    CPY_ASSERT(counter == 8);
+
+    std::ifstream file(capturePath);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    file.close();
+    std::string json = contents.str();
+    CPY_ASSERT(json.find("\"traceEvents\"") != std::string::npos);
+    CPY_ASSERT(json.find("\"name\":\"captureRoot\",\"cat\":\"task\",\"ph\":\"B\"") != std::string::npos);
+    CPY_ASSERT(json.find("\"name\":\"captureChild\",\"cat\":\"task\",\"ph\":\"B\"") != std::string::npos);
+    CPY_ASSERT(json.find("\"resumed\":true") != std::string::npos);
+    remove(capturePath);
+
+    ts.cleanTaskTree(root);
+    ts.signalStop();
+    ts.join();
+}
+
+void testCreateTaskBenchmark(TestContext& ctx)
+{
+    auto& testContext = (TaskSystemContext&)ctx;
+    auto& ts = *testContext.ts;
+    ASSERT_NO_TASKS(ts);
+    ts.start();
+
+    //createTask + execute + wait + clean of an empty task. Pools warm up in the first round, the
+    //second one must run in steady state, recycling what is pooled without carving new slabs.
+    const int iterations = 20000;
+    ITaskSystem::Stats warmStats = {};
+    ITaskSystem::Stats steadyStats = {};
+    Task bench = ts.createTask(TaskDesc("createTaskBenchmark", [&warmStats, &steadyStats, iterations](TaskContext& ctx)
+    {
+        for (int round = 0; round < 2; ++round)
+        {
+            for (int i = 0; i < iterations; ++i)
+            {
+                Task t = ctx.ts->createTask(TaskDesc("empty", [](TaskContext& ctx) {}));
+                ctx.ts->execute(t);
+                ctx.ts->wait(t);
+                ctx.ts->cleanTaskTree(t);
+            }
+            ctx.ts->getStats(round == 0 ? warmStats : steadyStats);
+        }
+    }));
+    ts.execute(bench);
+    ts.wait(bench);
+    ts.cleanTaskTree(bench);
+    CPY_ASSERT(warmStats.numPoolSlabs > 0);
+    CPY_ASSERT_FMT(steadyStats.numPoolSlabs == warmStats.numPoolSlabs, "pools grew in steady state: %d slabs, %d after warm up", steadyStats.numPoolSlabs, warmStats.numPoolSlabs);
+    CPY_ASSERT(steadyStats.numElements == warmStats.numElements);
+
+    ASSERT_NO_TASKS(ts);
+    ts.signalStop();
+    ts.join();
+}
+
+void testGraphReplay(TestContext& ctx)
+{
+    auto& testContext = (TaskSystemContext&)ctx;
+    auto& ts = *testContext.ts;
+    ASSERT_NO_TASKS(ts);
+    ts.start();
+
+    //diamond: read -> (compileA, compileB) -> patch, each node writing into its launch's slots.
+    struct Slots
+    {
+        int read = 0;
+        int compileA = 0;
+        int compileB = 0;
+        int patch = 0;
+    };
+
+    TaskGraphDesc desc;
+    TaskGraphNode read = desc.addNode(TaskDesc("read", [](TaskContext& ctx)
+    {
+        ((Slots*)ctx.data)->read = 1;
+    }));
+    TaskGraphNode compileA = desc.addNode(TaskDesc("compileA", [](TaskContext& ctx)
+    {
+        Slots& slots = *(Slots*)ctx.data;
+        slots.compileA = slots.read + 1;
+    }));
+    TaskGraphNode compileB = desc.addNode(TaskDesc("compileB", [](TaskContext& ctx)
+    {
+        Slots& slots = *(Slots*)ctx.data;
+        slots.compileB = slots.read + 2;
+    }));
+    TaskGraphNode patch = desc.addNode(TaskDesc("patch", [](TaskContext& ctx)
+    {
+        Slots& slots = *(Slots*)ctx.data;
+        slots.patch = slots.compileA + slots.compileB;
+    }));
+    desc.depends(compileA, read);
+    desc.depends(compileB, read);
+    desc.depends(patch, compileA);
+    desc.depends(patch, compileB);
+
+    TaskGraph graph = ts.createGraph(desc);
+    ITaskSystem::Stats graphStats;
+    ts.getStats(graphStats);
+
+    const int launches = 200;
+    std::vector<Slots> slots(launches);
+    for (int i = 0; i < launches; ++i)
+    {
+        void* nodeData[] = { &slots[i], &slots[i], &slots[i], &slots[i] };
+        Task done = ts.launchGraph(graph, nodeData);
+
+        //regular tasks can wait on a launch, and get cleaned without touching the graph.
+        bool sawPatch = false;
+        Task after = ts.createTask(TaskDesc("after", [&sawPatch, &slots, i](TaskContext& ctx)
+        {
+            sawPatch = slots[i].patch == 5;
+        }));
+        ts.depends(after, done);
+        ts.execute(after);
+        ts.wait(after);
+        ts.wait(done);
+        ts.cleanTaskTree(after);
+        CPY_ASSERT_FMT(sawPatch, "launch %d: dependent task ran before the graph finished", i);
+    }
+
+    for (int i = 0; i < launches; ++i)
+        CPY_ASSERT_FMT(slots[i].patch == 5, "launch %d patched %d", i, slots[i].patch);
+
+    //launching must not create or leak tasks.
+    ITaskSystem::Stats stats;
+    ts.getStats(stats);
+    CPY_ASSERT_FMT(stats.numElements == graphStats.numElements, "%d tasks alive, expected %d", stats.numElements, graphStats.numElements);
+
+    ts.destroyGraph(graph);
+    ASSERT_NO_TASKS(ts);
+    ts.signalStop();
+    ts.join();
+}
+
+void waitForNoTasks(ITaskSystem& ts)
+{
+    //auto released tasks are reclaimed by whichever thread drops their last reference.
+    ITaskSystem::Stats stats;
+    for (int i = 0; i < 10000; ++i)
+    {
+        ts.getStats(stats);
+        if (stats.numElements == 0)
+            return;
+        TaskUtil::sleepThread(1);
+    }
+    CPY_ASSERT_FMT(stats.numElements == 0, "Auto released tasks were not reclaimed: %d alive", stats.numElements);
+}
+
+void testAutoRelease(TestContext& ctx)
+{
+    auto& testContext = (TaskSystemContext&)ctx;
+    auto& ts = *testContext.ts;
+    ASSERT_NO_TASKS(ts);
+    ts.start();
+
+    //fire and forget: nothing ever cleans these.
+    const int taskCount = 5000;
+    std::atomic<int> counter = 0;
+    for (int i = 0; i < taskCount; ++i)
+    {
+        Task t = ts.createTask(TaskDesc("fireAndForget", (int)TaskFlags::AutoRelease, [&counter](TaskContext& ctx)
+        {
+            counter.fetch_add(1);
+        }));
+        ts.execute(t);
+    }
+    waitForNoTasks(ts);
+    CPY_ASSERT_FMT(counter == taskCount, "%d", counter.load());
+
+    //a tree of auto released tasks lives until its root finishes.
+    int a = 0;
+    int b = 0;
+    Task leaf = ts.createTask(TaskDesc("leaf", (int)TaskFlags::AutoRelease, [&a](TaskContext& ctx) { a = 1; }));
+    Task root = ts.createTask(TaskDesc("root", (int)TaskFlags::AutoRelease, [&a, &b](TaskContext& ctx) { b = a + 1; }));
+    ts.depends(root, leaf);
+    ts.execute(root);
+    ts.wait(root);
+    CPY_ASSERT_FMT(b == 2, "%d", b);
+    waitForNoTasks(ts);
+
+    //stale handles never alias new tasks: waiting returns and depending is a no-op.
+    ts.wait(root);
+    int c = 0;
+    Task after = ts.createTask(TaskDesc("after", [&c](TaskContext& ctx) { c = 1; }));
+    CPY_ASSERT(after != root && after != leaf);
+    ts.depends(after, root);
+    ts.execute(after);
+    ts.wait(after);
+    ts.cleanTaskTree(after);
+    CPY_ASSERT(c == 1);
+
+    //a regular task keeps its auto released dependencies alive until it gets cleaned.
+    Task child = ts.createTask(TaskDesc("child", (int)TaskFlags::AutoRelease, [](TaskContext& ctx) {}));
+    Task owner = ts.createTask(TaskDesc("owner", [](TaskContext& ctx) {}));
+    ts.depends(owner, child);
+    ts.execute(owner);
+    ts.wait(owner);
+    ITaskSystem::Stats stats;
+    ts.getStats(stats);
+    CPY_ASSERT_FMT(stats.numElements == 2, "%d", stats.numElements);
+    ts.cleanTaskTree(owner);
+    ASSERT_NO_TASKS(ts);
+
+    ts.signalStop();
+    ts.join();
+}
+
+void testSuspendUntil(TestContext& ctx)
+{
+    auto& testContext = (TaskSystemContext&)ctx;
+    auto& ts = *testContext.ts;
+    ASSERT_NO_TASKS(ts);
+    ts.start();
+
+    //an outside thread completes the operations, like a kernel completion queue would.
+    std::mutex pendingMutex;
+    std::vector<TaskResumeFn> pending;
+    std::atomic<bool> stopCompleter = false;
+    std::thread completer([&]()
+    {
+        while (!stopCompleter.load())
+        {
+            std::vector<TaskResumeFn> ready;
+            {
+                std::unique_lock lock(pendingMutex);
+                ready.swap(pending);
+            }
+            for (auto& resume : ready)
+                resume();
+            std::this_thread::yield();
+        }
+    });
+
+    const int taskCount = 64;
+    std::atomic<int> finished = 0;
+    std::vector<Task> tasks;
+    for (int i = 0; i < taskCount; ++i)
+    {
+        tasks.push_back(ts.createTask(TaskDesc([&, i](TaskContext& ctx)
+        {
+            for (int s = 0; s < 4; ++s)
+            {
+                int value = 0;
+                TaskUtil::suspendUntil([&, i, s](TaskResumeFn resume)
+                {
+                    //some complete before startFn even returns.
+                    if (((i + s) % 3) == 0)
+                    {
+                        value = 1;
+                        resume();
+                        return;
+                    }
+
+                    std::unique_lock lock(pendingMutex);
+                    pending.push_back([&value, resume]() { value = 1; resume(); });
+                });
+                CPY_ASSERT(value == 1);
+            }
+            ++finished;
+        })));
+    }
+
+    Task root = ts.createTask();
+    ts.depends(root, tasks.data(), (int)tasks.size());
+    ts.execute(root);
+    ts.wait(root);
+    ts.cleanTaskTree(root);
+
+    stopCompleter = true;
+    completer.join();
+    CPY_ASSERT_FMT(finished == taskCount, "%d", finished.load());
+    ASSERT_NO_TASKS(ts);
+    ts.signalStop();
+    ts.join();
+}
+
+void testWaitAll(TestContext& ctx)
+{
+    auto& testContext = (TaskSystemContext&)ctx;
+    auto& ts = *testContext.ts;
+    ASSERT_NO_TASKS(ts);
+    ts.start();
+
+    //from outside the workers, mixing tasks that finish at different times.
+    const int taskCount = 64;
+    std::atomic<int> counter = 0;
+    std::vector<Task> tasks;
+    for (int i = 0; i < taskCount; ++i)
+    {
+        tasks.push_back(ts.createTask(TaskDesc("waitAllChild", [&counter, i](TaskContext& ctx)
+        {
+            if ((i % 8) == 0)
+                TaskUtil::sleepThread(1);
+            counter.fetch_add(1);
+        })));
+    }
+    ts.execute(tasks.data(), taskCount);
+    ts.waitAll(tasks.data(), taskCount);
+    CPY_ASSERT_FMT(counter == taskCount, "%d", counter.load());
+
+    //everything already finished returns right away.
+    ts.waitAll(tasks.data(), taskCount);
+    for (Task t : tasks)
+        ts.cleanTaskTree(t);
+    ASSERT_NO_TASKS(ts);
+
+    //from inside a task, which helps with the children while they run.
+    std::atomic<int> nestedCounter = 0;
+    Task parent = ts.createTask(TaskDesc("waitAllParent", [&nestedCounter](TaskContext& ctx)
+    {
+        Task children[16];
+        for (Task& child : children)
+        {
+            child = ctx.ts->createTask(TaskDesc("waitAllNested", (int)TaskFlags::AutoRelease, [&nestedCounter](TaskContext& ctx)
+            {
+                nestedCounter.fetch_add(1);
+            }));
+        }
+        ctx.ts->execute(children, 16);
+        ctx.ts->waitAll(children, 16);
+        CPY_ASSERT_FMT(nestedCounter == 16, "%d", nestedCounter.load());
+    }));
+    ts.execute(parent);
+    ts.wait(parent);
+    ts.cleanTaskTree(parent);
+    waitForNoTasks(ts);
+
+    //several threads waiting on the same task.
+    std::atomic<bool> release = false;
+    Task gate = ts.createTask(TaskDesc("waitAllGate", [&release](TaskContext& ctx)
+    {
+        while (!release.load())
+            TaskUtil::sleepThread(1);
+    }));
+    ts.execute(gate);
+    std::atomic<int> woken = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+        threads.emplace_back([&ts, &woken, gate]() mutable { ts.waitAll(&gate, 1); woken.fetch_add(1); });
+    TaskUtil::sleepThread(5);
+    CPY_ASSERT(woken == 0);
+    release = true;
+    for (auto& t : threads)
+        t.join();
+    CPY_ASSERT_FMT(woken == 4, "%d", woken.load());
+    ts.cleanTaskTree(gate);
+    ASSERT_NO_TASKS(ts);
+
+    ts.signalStop();
+    ts.join();
+}
+
+void testFutures(TestContext& ctx)
+{
+    auto& testContext = (TaskSystemContext&)ctx;
+    auto& ts = *testContext.ts;
+    ASSERT_NO_TASKS(ts);
+    ts.start();
+
+    //values flow down a chain, and continuations run on the worker that finished their source.
+    std::atomic<bool> go = false;
+    std::atomic<std::thread::id> sourceThread;
+    std::atomic<std::thread::id> continuationThread;
+    TaskFuture<int> source = runAsync(ts, "futureSource", [&go, &sourceThread]()
+    {
+        while (!go.load())
+            TaskUtil::sleepThread(1);
+        sourceThread = std::this_thread::get_id();
+        return 20;
+    });
+    TaskFuture<std::string> chained = source.then([&continuationThread](int v)
+    {
+        continuationThread = std::this_thread::get_id();
+        return v + 1;
+    }).then("toString", [](int v) { return std::to_string(v * 2); });
+    go = true;
+    CPY_ASSERT_FMT(chained.get() == "42", "%s", chained.get().c_str());
+    CPY_ASSERT(source.isReady() && source.get() == 20);
+    CPY_ASSERT(sourceThread.load() == continuationThread.load());
+
+    //cancelling a future that has not started cancels everything downstream, and skips the work.
+    go = false;
+    std::atomic<int> ran = 0;
+    TaskFuture<int> gate = runAsync(ts, "futureGate", [&go]()
+    {
+        while (!go.load())
+            TaskUtil::sleepThread(1);
+        return 1;
+    });
+    TaskFuture<int> skipped = gate.then([&ran](int v) { ran.fetch_add(1); return v; });
+    TaskFuture<void> downstream = skipped.then([&ran](int v) { ran.fetch_add(1); });
+    skipped.cancel();
+    go = true;
+    downstream.wait();
+    CPY_ASSERT(gate.isReady());
+    CPY_ASSERT(skipped.isCancelled() && downstream.isCancelled());
+    CPY_ASSERT_FMT(ran == 0, "%d", ran.load());
+
+    //whenAll waits on every input, whenAny on the first ready one.
+    std::vector<TaskFuture<int>> parts;
+    for (int i = 0; i < 16; ++i)
+        parts.push_back(runAsync(ts, "futurePart", [i]() { return i; }));
+    TaskFuture<int> sum = whenAll(ts, parts).then([parts]()
+    {
+        int total = 0;
+        for (const TaskFuture<int>& part : parts)
+            total += part.get();
+        return total;
+    });
+    CPY_ASSERT_FMT(sum.get() == 120, "%d", sum.get());
+
+    go = false;
+    std::vector<TaskFuture<int>> racers;
+    racers.push_back(runAsync(ts, "futureSlow", [&go]()
+    {
+        while (!go.load())
+            TaskUtil::sleepThread(1);
+        return 0;
+    }));
+    racers.push_back(runAsync(ts, "futureFast", []() { return 1; }));
+    TaskFuture<int> first = whenAny(ts, racers);
+    CPY_ASSERT_FMT(first.get() == 1, "%d", first.get());
+    go = true;
+
+    //an input cancelled before running makes whenAll cancelled, and whenAny of only cancelled inputs too.
+    std::atomic<bool> open = false;
+    TaskFuture<int> closed = runAsync(ts, "futureClosed", [&open]()
+    {
+        while (!open.load())
+            TaskUtil::sleepThread(1);
+        return 1;
+    });
+    std::vector<TaskFuture<int>> cancelled;
+    cancelled.push_back(closed.then([](int v) { return v; }));
+    cancelled.back().cancel();
+    open = true;
+    TaskFuture<int> none = whenAny(ts, cancelled);
+    none.wait();
+    CPY_ASSERT(none.isCancelled());
+    TaskFuture<void> all = whenAll(ts, cancelled);
+    all.wait();
+    CPY_ASSERT(all.isCancelled());
+
+    waitForNoTasks(ts);
+    ts.signalStop();
+    ts.join();
+}
+
+void testMpmcQueue(TestContext& ctx)
+{
+    //small ring, so producers keep running into a full queue and consumers into an empty one.
+    MpmcQueue<int, 64> queue;
+    int msg = 0;
+    CPY_ASSERT(!queue.tryPop(msg));
+    CPY_ASSERT(!queue.waitPopUntil(msg, 1));
+
+    const int producerCount = 4;
+    const int consumerCount = 4;
+    const int messagesPerProducer = 20000;
+    std::atomic<long long> sum = 0;
+    std::atomic<int> received = 0;
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producerCount; ++p)
+    {
+        threads.emplace_back([&queue, p, messagesPerProducer]()
+        {
+            int batch[8];
+            for (int i = 1; i <= messagesPerProducer; )
+            {
+                //every other round goes through the batch path.
+                if ((i & 16) != 0 && i + 8 <= messagesPerProducer + 1)
+                {
+                    for (int b = 0; b < 8; ++b)
+                        batch[b] = i + b;
+                    queue.pushBatch(batch, 8);
+                    i += 8;
+                }
+                else
+                {
+                    queue.push(i++);
+                }
+            }
+        });
+    }
+
+    for (int c = 0; c < consumerCount; ++c)
+    {
+        threads.emplace_back([&queue, &sum, &received, c]()
+        {
+            int batch[4];
+            while (true)
+            {
+                //one exit message per consumer: hand back any extra one a batch grabbed.
+                int count = (c & 1) ? queue.waitPopBatch(batch, 4) : (queue.waitPop(batch[0]), 1);
+                bool exit = false;
+                for (int i = 0; i < count; ++i)
+                {
+                    if (batch[i] == -1)
+                    {
+                        if (exit)
+                            queue.push(-1);
+                        exit = true;
+                        continue;
+                    }
+                    sum += batch[i];
+                    ++received;
+                }
+                if (exit)
+                    return;
+            }
+        });
+    }
+
+    for (int p = 0; p < producerCount; ++p)
+        threads[p].join();
+    for (int c = 0; c < consumerCount; ++c)
+        queue.push(-1);
+    for (int c = 0; c < consumerCount; ++c)
+        threads[producerCount + c].join();
+
+    const long long expectedSum = (long long)producerCount * messagesPerProducer * (messagesPerProducer + 1) / 2;
+    CPY_ASSERT_FMT(received == producerCount * messagesPerProducer, "%d", received.load());
+    CPY_ASSERT_FMT(sum == expectedSum, "%lld", sum.load());
+    CPY_ASSERT(queue.size() == 0);
+}
+
 }
 
 static const TestCase* createCases(int& caseCounts)
@@ -175,7 +1059,21 @@ static const TestCase* createCases(int& caseCounts)
         { "simpleParallel", testParallel0 },
         { "simpleParallelRestart", testParallel0 },
         { "dependencies", testTaskDeps },
-        { "yield", testTaskYield }
+        { "chain", testTaskChain },
+        { "largeGraph", testLargeGraph },
+        { "parallelFor", testParallelFor },
+        { "yield", testTaskYield },
+        { "nestedYield", testNestedYield },
+        { "priorities", testPriorities },
+        { "ioLane", testIoLane },
+        { "capture", testCapture },
+        { "createTaskBenchmark", testCreateTaskBenchmark },
+        { "graphReplay", testGraphReplay },
+        { "autoRelease", testAutoRelease },
+        { "suspendUntil", testSuspendUntil },
+        { "waitAll", testWaitAll },
+        { "futures", testFutures },
+        { "mpmcQueue", testMpmcQueue }
     };
 
     caseCounts = (int)(sizeof(sCases) / sizeof(TestCase));
@@ -191,6 +1089,16 @@ static TestContext* createContext()
     return testContext;
 }
 
+static TestContext* createFiberContext()
+{
+    auto testContext = new TaskSystemContext();
+    TaskSystemDesc desc;
+    desc.threadPoolSize = 4;
+    desc.enableFibers = true;
+    testContext->ts = ITaskSystem::create(desc);
+    return testContext;
+}
+
 static void destroyContext(TestContext* context)
 {
     auto testContext = static_cast<TaskSystemContext*>(context);
@@ -206,4 +1114,12 @@ void taskSystemSuite(TestSuiteDesc& suite)
     suite.destroyContextFn = destroyContext;
 }
 
+void taskSystemFibersSuite(TestSuiteDesc& suite)
+{
+    suite.name = "tasksystemFibers";
+    suite.cases = createCases(suite.casesCount);
+    suite.createContextFn = createFiberContext;
+    suite.destroyContextFn = destroyContext;
+}
+
 }
@@ -28,6 +28,7 @@ namespace coalpy
 extern void coreSuite(TestSuiteDesc& suite);
 extern void fileSystemSuite(TestSuiteDesc& suite);
 extern void taskSystemSuite(TestSuiteDesc& suite);
+extern void taskSystemFibersSuite(TestSuiteDesc& suite);
 extern void shaderSuite(TestSuiteDesc& suite);
 extern void renderSuite(TestSuiteDesc& suite);
 
@@ -36,6 +37,7 @@ extern void renderSuite(TestSuiteDesc& suite);
 CreateSuiteFn g_suites[] = {
     coreSuite,
     taskSystemSuite,
+    taskSystemFibersSuite,
     fileSystemSuite,
     shaderSuite,
     renderSuite